@@ -0,0 +1,210 @@
+/*
+ * Time digit benchmark - the runs digits.c draws from against the decoded
+ * bitmaps the time slots used to show, for memory and for drawing a slide.
+ *
+ *   cc -O2 -Wall -std=gnu99 -Ihost -Isrc host/pebble_host.c host/pebble_ui.c src/calendar.c src/outbox.c src/trace.c src/recorder.c src/bluetooth.c src/power.c src/digits.c host/bench_digits.c -o bench_digits
+ *   ./bench_digits [-r repeats] > digits.csv
+ *
+ * Memory is the RAM each path holds for the ten digits: the heap the
+ * bitmaps would take from gbitmap_create_with_resource(), at the watch's 1
+ * bit per pixel, against the static buffer the runs are read into. The
+ * bitmaps are no longer in the app, so they are made from
+ * resources/images/time_N.png, which encode_digits.js reads too. Drawing
+ * plays the top of the hour, 19:59 to 20:00 - all four slots sliding out
+ * and back in along their layout.h paths, one frame every
+ * HOST_ANIMATION_FRAME_MS - into an aplite-sized frame buffer:
+ *
+ *   bitmap  each slot copied from its bitmap a byte at a time, background
+ *           bits and all, as a BitmapLayer with GCompOpAssign does
+ *   rle     digits_draw() filling only the runs of ink, through
+ *           graphics_fill_rect() on a context over the frame buffer
+ *
+ * Both are clipped to the time area the same way and must leave the same
+ * pixels - the bitmaps are filled from the runs, and every frame is
+ * compared. Only the drawing is timed, not clearing the frame between.
+ */
+
+#include <unistd.h>
+
+#define main revolution_main
+#include "Revolution.c"
+#undef main
+
+#define FRAME_MS 33  // HOST_ANIMATION_FRAME_MS
+#define FRAME_BUFFER_ROW_BYTES 20
+#define PATHS 2
+
+static const char *path_names[PATHS] = { "bitmap", "rle" };
+// No longer resources - encode_digits.js makes the runs from them
+static const char *time_files[10] = {
+  "images/time_0.png", "images/time_1.png", "images/time_2.png", "images/time_3.png", "images/time_4.png",
+  "images/time_5.png", "images/time_6.png", "images/time_7.png", "images/time_8.png", "images/time_9.png"
+};
+static const int old_digits[NUMBER_OF_TIME_SLOTS] = { 1, 9, 5, 9 };
+static const int new_digits[NUMBER_OF_TIME_SLOTS] = { 2, 0, 0, 0 };
+
+static GBitmap *bitmaps[10];
+static uint8_t frame_data[PATHS][FRAME_BUFFER_ROW_BYTES * SCREEN_HEIGHT];
+static GBitmap frame_buffers[PATHS];
+
+typedef struct {
+  size_t ram_bytes;
+  size_t data_bytes;   // Of that, the digits themselves
+  uint32_t heap_allocs;
+  uint64_t draw_ns;
+  uint64_t pixels;
+  uint32_t frames;
+} PathTotals;
+
+static PathTotals totals[PATHS];
+
+static GRect clip_rect(GRect rect, GRect clip) {
+  int16_t x0 = rect.origin.x > clip.origin.x ? rect.origin.x : clip.origin.x;
+  int16_t y0 = rect.origin.y > clip.origin.y ? rect.origin.y : clip.origin.y;
+  int16_t x1 = rect.origin.x + rect.size.w < clip.origin.x + clip.size.w ? rect.origin.x + rect.size.w : clip.origin.x + clip.size.w;
+  int16_t y1 = rect.origin.y + rect.size.h < clip.origin.y + clip.size.h ? rect.origin.y + rect.size.h : clip.origin.y + clip.size.h;
+  return x1 > x0 && y1 > y0 ? GRect(x0, y0, x1 - x0, y1 - y0) : GRectZero;
+}
+
+// 1 bit copy, up to a destination byte at a time; returns the pixels written
+static uint32_t blit(GBitmap *dest, const GBitmap *src, GPoint origin, GRect clip) {
+  GRect rect = clip_rect((GRect){ origin, src->bounds.size }, clip);
+  uint8_t *dest_data = dest->addr;
+  const uint8_t *src_data = src->addr;
+  for (int y = rect.origin.y; y < rect.origin.y + rect.size.h; y++) {
+    const uint8_t *src_row = &src_data[(y - origin.y) * src->row_size_bytes];
+    uint8_t *dest_row = &dest_data[y * dest->row_size_bytes];
+    for (int x = rect.origin.x; x < rect.origin.x + rect.size.w;) {
+      int n = 8 - (x & 7);
+      if (n > rect.origin.x + rect.size.w - x)
+        n = rect.origin.x + rect.size.w - x;
+      int src_x = x - origin.x;
+      uint16_t window = src_row[src_x >> 3] | (src_row[(src_x >> 3) + 1] << 8);
+      uint8_t bits = (window >> (src_x & 7)) & ((1 << n) - 1);
+      uint8_t mask = ((1 << n) - 1) << (x & 7);
+      dest_row[x >> 3] = (dest_row[x >> 3] & ~mask) | (bits << (x & 7));
+      x += n;
+    }
+  }
+  return rect.size.w * rect.size.h;
+}
+
+static uint32_t ink_pixels(const uint8_t *data) {
+  uint32_t ink = 0;
+  for (size_t i = 0; i < FRAME_BUFFER_ROW_BYTES * SCREEN_HEIGHT; i++)
+    ink += __builtin_popcount(data[i]);
+  return ink;
+}
+
+static GRect slide_frame(GRect from, GRect to, uint32_t elapsed) {
+  return GRect(from.origin.x + (to.origin.x - from.origin.x) * (int)elapsed / TIME_SLOT_ANIMATION_DURATION,
+               from.origin.y + (to.origin.y - from.origin.y) * (int)elapsed / TIME_SLOT_ANIMATION_DURATION,
+               from.size.w, from.size.h);
+}
+
+static void draw_frame(GRect *frames, const int *digits, bool count) {
+  for (int p = 0; p < PATHS; p++) {
+    memset(frame_data[p], 0, sizeof(frame_data[p]));
+    uint32_t written = 0;
+    uint64_t start = host_clock_ns();
+    for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++) {
+      GPoint origin = GPoint(layout.time_layer.origin.x + frames[i].origin.x,
+                             layout.time_layer.origin.y + frames[i].origin.y);
+      if (p == 0) {
+        written += blit(&frame_buffers[p], bitmaps[digits[i]], origin, layout.time_layer);
+      } else {
+        GContext *ctx = host_bitmap_context(&frame_buffers[p]);
+        graphics_context_set_fill_color(ctx, GColorWhite);
+        digits_draw(ctx, digits[i], origin, layout.time_layer);
+      }
+    }
+    totals[p].draw_ns += host_clock_ns() - start;
+    if (!count)
+      continue;
+    totals[p].pixels += p == 0 ? written : ink_pixels(frame_data[p]);
+    totals[p].frames++;
+  }
+}
+
+static bool play_slide(bool count) {
+  bool same = true;
+  GRect frames[NUMBER_OF_TIME_SLOTS];
+  for (int half = 0; half < 2; half++) {
+    const int *digits = half == 0 ? old_digits : new_digits;
+    for (uint32_t elapsed = 0;; elapsed += FRAME_MS) {
+      if (elapsed > TIME_SLOT_ANIMATION_DURATION)
+        elapsed = TIME_SLOT_ANIMATION_DURATION;
+      for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++) {
+        frames[i] = half == 0 ? slide_frame(layout.time_slots[i], layout.slide_out_to[i], elapsed)
+                              : slide_frame(layout.slide_in_from[i], layout.time_slots[i], elapsed);
+      }
+      draw_frame(frames, digits, count);
+      if (memcmp(frame_data[0], frame_data[1], sizeof(frame_data[0])) != 0)
+        same = false;
+      if (elapsed == TIME_SLOT_ANIMATION_DURATION)
+        break;
+    }
+  }
+  return same;
+}
+
+int main(int argc, char **argv) {
+  int repeats = 2000;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:")) != -1) {
+    switch (opt) {
+      case 'r': repeats = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-r repeats]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  host_reset(0);
+  for (int p = 0; p < PATHS; p++)
+    frame_buffers[p] = (GBitmap){ frame_data[p], FRAME_BUFFER_ROW_BYTES, 0, GRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT) };
+
+  size_t heap_before = host_stats.heap_current;
+  uint32_t allocs_before = host_stats.heap_allocs;
+  for (int d = 0; d < 10; d++)
+    bitmaps[d] = host_bitmap_create_with_png(time_files[d]);
+  totals[0].ram_bytes = host_stats.heap_current - heap_before;
+  totals[0].heap_allocs = host_stats.heap_allocs - allocs_before;
+  for (int d = 0; d < 10; d++)
+    totals[0].data_bytes += bitmaps[d]->row_size_bytes * bitmaps[d]->bounds.size.h;
+
+  heap_before = host_stats.heap_current;
+  allocs_before = host_stats.heap_allocs;
+  if (!digits_load(RESOURCE_ID_TIME_DIGITS_RLE)) {
+    fprintf(stderr, "bench_digits: no time digits - run from the repository root\n");
+    return 1;
+  }
+  totals[1].ram_bytes = host_stats.heap_current - heap_before + DIGITS_MAX_BYTES;
+  totals[1].data_bytes = digits_bytes();
+  totals[1].heap_allocs = host_stats.heap_allocs - allocs_before;
+
+  // The bitmaps get the same pixels as the runs, so the two paths can be compared
+  for (int d = 0; d < 10; d++) {
+    GContext *ctx = host_bitmap_context(bitmaps[d]);
+    graphics_context_set_fill_color(ctx, GColorWhite);
+    digits_draw(ctx, d, GPoint(0, 0), bitmaps[d]->bounds);
+  }
+
+  bool same = play_slide(true);
+  for (int p = 0; p < PATHS; p++)
+    totals[p].draw_ns = 0;
+  for (int r = 0; r < repeats; r++)
+    same = play_slide(false) && same;
+
+  printf("path,ram_bytes,data_bytes,heap_allocs,frames,draw_ns_per_frame,pixels_per_frame,same_pixels\n");
+  for (int p = 0; p < PATHS; p++) {
+    printf("%s,%zu,%zu,%u,%u,%.1f,%.0f,%s\n", path_names[p], totals[p].ram_bytes, totals[p].data_bytes, totals[p].heap_allocs,
+           totals[p].frames, (double)totals[p].draw_ns / ((uint64_t)totals[p].frames * repeats),
+           (double)totals[p].pixels / totals[p].frames, same ? "yes" : "no");
+  }
+
+  digits_unload();
+  for (int d = 0; d < 10; d++)
+    gbitmap_destroy(bitmaps[d]);
+  return same ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+/*
+ * Event store scan benchmark - what one alert-planning pass costs with the
+ * old array of whole Events against the hot EventHot records.
+ *
+ *   cc -O2 -Wall -std=gnu99 -Ihost -Isrc host/pebble_host.c host/pebble_ui.c src/calendar.c src/outbox.c src/trace.c src/recorder.c src/bluetooth.c host/bench_event_store.c -o bench_event_store
+ *   ./bench_event_store
+ *
+ * The watch holds MAX_EVENTS, so the scans here run over their own arrays
+ * to show how the cost grows. "events" is the layout the planner used to
+ * walk: copy each Event out, test all_day, compare the date string with
+ * today and parse the start time. "hot" is what determine_if_alarm_needed()
+ * does now, over records filled in by decode_event_hot() at receipt.
+ *
+ * Output is one CSV row per layout and size.
+ */
+
+#include "common.h"
+
+#define BENCH_EPOCH 1402905600 // 2014-06-16 08:00:00 UTC
+#define SCAN_EVENTS_PER_ROW 5000000
+
+static const int sizes[] = { 15, 100, 500 };
+
+uint16_t today_day_key();
+int32_t ms_of_day();
+int a_to_i(const char *val, int len);
+
+// Calendar hooks normally provided by Revolution.c
+void set_event_status(int new_status_display) {
+}
+
+void display_event_text(char *text, char *relative) {
+}
+
+static Event *make_events(int n) {
+  Event *all = calloc(n, sizeof(Event));
+  for (int i = 0; i < n; i++) {
+    Event *e = &all[i];
+    e->index = i % MAX_EVENTS;
+    snprintf(e->title, sizeof(e->title), "Meeting %d", i);
+    e->has_location = (i % 2) == 0;
+    if (e->has_location)
+      snprintf(e->location, sizeof(e->location), "Room %d", 100 + i % 900);
+    e->all_day = (i % 7) == 6;
+    int minutes = (i * 25) % (24 * 60);
+    snprintf(e->start_date, sizeof(e->start_date), "06/%02d %02d:%02d", 16 + i / 60 % 3, minutes / 60, minutes % 60);
+  }
+  return all;
+}
+
+/*
+ * The planning pass as it was, over whole Events
+ */
+static int scan_events(Event *all, int n) {
+  Event event;
+  int alerts = 0;
+  for (int i = 0; i < n; i++) {
+    memcpy(&event, &all[i], sizeof(Event));
+    if (event.all_day)
+      continue;
+
+    char temp[6];
+    time_t rawtime;
+    time(&rawtime);
+    strftime(temp, sizeof(temp), "%m/%d", localtime(&rawtime));
+    if (strncmp(event.start_date, temp, 5) != 0)
+      continue;
+
+    int time_position = event.start_date[5] != '/' ? 6 : 9;
+    int hour = a_to_i(&event.start_date[time_position], 2);
+    int minute_position = event.start_date[time_position + 1] == ':' ? time_position + 2 : time_position + 3;
+    int minute = a_to_i(&event.start_date[minute_position], 2);
+    int32_t event_in_ms = (hour * 3600 + minute * 60) * 1000;
+    time(&rawtime);
+    struct tm *now = localtime(&rawtime);
+    int32_t now_in_ms = (now->tm_hour * 3600 + now->tm_min * 60 + now->tm_sec) * 1000;
+    if (event_in_ms - now_in_ms >= 0)
+      alerts++;
+  }
+  return alerts;
+}
+
+/*
+ * The planning pass now, over the hot records only
+ */
+static int scan_hot(EventHot *hot, int n) {
+  uint16_t day_key = today_day_key();
+  int32_t now_ms = ms_of_day();
+  int alerts = 0;
+  for (int i = 0; i < n; i++) {
+    if (hot[i].flags & EVENT_ALL_DAY)
+      continue;
+    if (hot[i].day_key != day_key)
+      continue;
+    if (hot[i].start_minute * 60000 - now_ms >= 0)
+      alerts++;
+  }
+  return alerts;
+}
+
+static void report(const char *layout, int n, int iterations, uint64_t ns, size_t stride, int alerts) {
+  printf("%s,%d,%d,%.1f,%.2f,%zu,%zu,%d\n", layout, n, iterations,
+         (double)ns / iterations, (double)ns / iterations / n, stride, stride * n, alerts);
+}
+
+int main(int argc, char **argv) {
+  setenv("TZ", "UTC", 1);
+  tzset();
+  host_reset(BENCH_EPOCH);
+
+  printf("layout,events,iterations,ns_per_scan,ns_per_event,bytes_per_event,bytes_scanned,alerts\n");
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    int n = sizes[s];
+    int iterations = SCAN_EVENTS_PER_ROW / n;
+    Event *all = make_events(n);
+    EventHot *hot = calloc(n, sizeof(EventHot));
+    for (int i = 0; i < n; i++) {
+      EventView view = { (const uint8_t *)&all[i] }; // Indices past MAX_EVENTS, so not event_view_init()
+      decode_event_hot(&view, &hot[i]);
+    }
+
+    volatile int sink = 0;
+    uint64_t start = host_clock_ns();
+    for (int it = 0; it < iterations; it++)
+      sink += scan_events(all, n);
+    report("events", n, iterations, host_clock_ns() - start, sizeof(Event), scan_events(all, n));
+
+    start = host_clock_ns();
+    for (int it = 0; it < iterations; it++)
+      sink += scan_hot(hot, n);
+    report("hot", n, iterations, host_clock_ns() - start, sizeof(EventHot), scan_hot(hot, n));
+
+    free(hot);
+    free(all);
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Micro-benchmarks for the calendar and clock hot paths, run against the
+ * host SDK stand-in.
+ *
+ *   cc -O2 -Wall -std=gnu99 -Ihost -Isrc host/pebble_host.c host/pebble_ui.c src/calendar.c src/outbox.c src/trace.c src/recorder.c src/bluetooth.c src/power.c src/digits.c host/bench_hot_paths.c -o bench_hot_paths
+ *   ./bench_hot_paths [baseline.csv] > current.csv
+ *
+ * Revolution.c is included whole (with its main renamed) so its static
+ * time slots and layout helpers can be driven directly. Each benchmark
+ * prints one CSV row; given the output of an earlier run, the rows also
+ * carry that run's figure and the change against it, so two commits can be
+ * compared by running both binaries.
+ */
+
+#define main revolution_main
+#include "Revolution.c"
+#undef main
+
+#define BENCH_EPOCH 1402905600 // 2014-06-16 08:00:00 UTC
+#define MAX_BASELINE 64
+
+extern EventText *events;
+extern EventHot *event_hot;
+extern TimerRecord *timer_rec;
+extern int max_entries;
+extern int alerts_issued;
+extern bool calendar_request_outstanding;
+extern uint8_t transfer_session;
+extern uint8_t count;
+extern uint8_t received_rows;
+extern uint16_t received_mask;
+extern uint16_t planned_day_key;
+extern int32_t plan_now_ms;
+void process_events();
+int determine_if_alarm_needed(int num);
+void set_relative_desc(int num, int32_t alert_event);
+uint16_t today_day_key();
+int32_t ms_of_day();
+
+typedef struct {
+  char name[40];
+  double ns_per_op;
+} BaselineRow;
+
+static BaselineRow baseline[MAX_BASELINE];
+static int baseline_rows;
+static volatile int sink;
+
+static void load_baseline(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return;
+  }
+  char line[256];
+  while (baseline_rows < MAX_BASELINE && fgets(line, sizeof(line), f)) {
+    char name[40];
+    long iterations;
+    double ns;
+    if (sscanf(line, "%39[^,],%ld,%lf", name, &iterations, &ns) != 3)
+      continue;
+    strcpy(baseline[baseline_rows].name, name);
+    baseline[baseline_rows].ns_per_op = ns;
+    baseline_rows++;
+  }
+  fclose(f);
+}
+
+static void report(const char *name, long ops, uint64_t ns) {
+  double ns_per_op = ops ? (double)ns / ops : 0;
+  printf("%s,%ld,%.1f,%.0f,", name, ops, ns_per_op, ns_per_op > 0 ? 1e9 / ns_per_op : 0);
+  for (int i = 0; i < baseline_rows; i++) {
+    if (strcmp(baseline[i].name, name) == 0 && baseline[i].ns_per_op > 0) {
+      printf("%.1f,%.1f\n", baseline[i].ns_per_op, (ns_per_op - baseline[i].ns_per_op) * 100 / baseline[i].ns_per_op);
+      return;
+    }
+  }
+  printf(",\n");
+}
+
+/*
+ * Clock
+ */
+static void bench_frame_for_time_slot(void) {
+  long ops = 0;
+  uint64_t start = host_clock_ns();
+  for (int it = 0; it < 1000000; it++) {
+    for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++) {
+      GRect frame = frame_for_time_slot(&time_slots[i]);
+      sink += frame.origin.x + frame.origin.y;
+      ops++;
+    }
+  }
+  report("frame_for_time_slot", ops, host_clock_ns() - start);
+}
+
+// A day of minute ticks; animations run to completion between ticks
+static void bench_display_time_value(void) {
+  long ops = 0;
+  uint64_t ns = 0;
+  for (int minute = 0; minute < 24 * 60; minute++) {
+    uint64_t start = host_clock_ns();
+    display_time_value(minute / 60, 0);
+    display_time_value(minute % 60, 1);
+    ns += host_clock_ns() - start;
+    ops += 2;
+    host_run_until(host_now_ms() + 2 * TIME_SLOT_ANIMATION_DURATION);
+  }
+  report("display_time_value", ops, ns);
+}
+
+/*
+ * Calendar
+ */
+static Event bench_events[MAX_EVENTS];
+static uint8_t messages[MAX_EVENTS][sizeof(Dictionary) + 2 * TUPLE_HEADER_SIZE + 3 + 1 + sizeof(Event)];
+static uint16_t message_sizes[MAX_EVENTS];
+
+static void make_messages(void) {
+  for (int i = 0; i < MAX_EVENTS; i++) {
+    Event *e = &bench_events[i];
+    memset(e, 0, sizeof(Event));
+    e->index = i;
+    snprintf(e->title, sizeof(e->title), "Meeting %d", i);
+    e->has_location = (i % 2) == 0;
+    if (e->has_location)
+      snprintf(e->location, sizeof(e->location), "Room %d", 100 + i);
+    e->all_day = (i % 7) == 6;
+    int minutes = 9 * 60 + i * 25;
+    snprintf(e->start_date, sizeof(e->start_date), "06/16 %02d:%02d", minutes / 60, minutes % 60);
+
+    uint8_t header[3] = { 1, i, i == MAX_EVENTS - 1 };
+    uint8_t payload[1 + sizeof(Event)];
+    payload[0] = MAX_EVENTS;
+    memcpy(&payload[1], e, sizeof(Event));
+
+    DictionaryIterator iter;
+    dict_write_begin(&iter, messages[i], sizeof(messages[i]));
+    dict_write_data(&iter, TRANSFER_KEY, header, sizeof(header));
+    dict_write_data(&iter, CALENDAR_RESPONSE_KEY, payload, sizeof(payload));
+    message_sizes[i] = dict_write_end(&iter);
+  }
+}
+
+static void start_sync(void) {
+  transfer_session = 1;
+  calendar_request_outstanding = true;
+  count = 0;
+  received_rows = 0;
+  received_mask = 0;
+}
+
+// Whole syncs, one event per message as with the 124 byte inbox; the last one commits and plans
+static void bench_received_message(void) {
+  long ops = 0;
+  uint64_t ns = 0;
+  for (int sync = 0; sync < 20000; sync++) {
+    start_sync();
+    uint64_t start = host_clock_ns();
+    for (int i = 0; i < MAX_EVENTS; i++) {
+      DictionaryIterator iter;
+      dict_read_begin_from_buffer(&iter, messages[i], message_sizes[i]);
+      received_message(&iter, NULL);
+    }
+    ns += host_clock_ns() - start;
+    ops += MAX_EVENTS;
+  }
+  report("received_message", ops, ns);
+}
+
+static void bench_determine_if_alarm_needed(void) {
+  long ops = 0;
+  planned_day_key = today_day_key();
+  plan_now_ms = ms_of_day();
+  uint64_t start = host_clock_ns();
+  for (int it = 0; it < 200000; it++) {
+    alerts_issued = 0;
+    for (int i = 0; i < max_entries; i++) {
+      sink += determine_if_alarm_needed(i);
+      ops++;
+    }
+  }
+  report("determine_if_alarm_needed", ops, host_clock_ns() - start);
+}
+
+static void bench_process_events(void) {
+  long ops = 0;
+  uint64_t start = host_clock_ns();
+  for (int it = 0; it < 50000; it++) {
+    process_events();
+    ops++;
+  }
+  report("process_events_unchanged", ops, host_clock_ns() - start);
+
+  ops = 0;
+  start = host_clock_ns();
+  for (int it = 0; it < 50000; it++) {
+    planned_day_key = 0; // Forces a full re-plan
+    process_events();
+    ops++;
+  }
+  report("process_events_full", ops, host_clock_ns() - start);
+}
+
+static void bench_set_relative_desc(void) {
+  long ops = 0;
+  uint64_t start = host_clock_ns();
+  for (int it = 0; it < 20; it++) {
+    for (int32_t minutes = 0; minutes < 24 * 60; minutes++) {
+      set_relative_desc(0, minutes * 60000);
+      sink += timer_rec[0].relative_desc[0];
+      ops++;
+    }
+  }
+  report("set_relative_desc", ops, host_clock_ns() - start);
+}
+
+int main(int argc, char **argv) {
+  setenv("TZ", "UTC", 1);
+  tzset();
+  if (argc > 1)
+    load_baseline(argv[1]);
+
+  host_reset(BENCH_EPOCH);
+  host_ui_reset();
+  init();
+
+  printf("benchmark,iterations,ns_per_op,ops_per_s,baseline_ns_per_op,change_pct\n");
+  bench_frame_for_time_slot();
+  bench_display_time_value();
+
+  make_messages();
+  bench_received_message();
+  bench_determine_if_alarm_needed();
+  bench_process_events();
+  bench_set_relative_desc();
+  return 0;
+}
@@ -0,0 +1,508 @@
+/*
+ * Protocol throughput benchmark - drives the real calendar.c receive path
+ * from a scripted mock phone.
+ *
+ *   cc -O2 -Wall -std=gnu99 -Ihost -Isrc host/pebble_host.c host/pebble_ui.c src/calendar.c src/outbox.c src/trace.c src/recorder.c src/bluetooth.c host/bench_protocol.c -o bench_protocol
+ *   ./bench_protocol [script]
+ *
+ * Each script line is a scenario: a name followed by key=value settings
+ *   events   number of events the phone returns (capped at MAX_EVENTS)
+ *   mtu      watch inbox size in bytes, as passed to app_message_open()
+ *   latency  ms for the phone to get one message across
+ *   jitter   extra random delay per message, 0..jitter ms
+ *   drop     percent of reply messages lost
+ *   reorder  percent of reply messages swapped with the one after
+ *   legacy   1 to answer without transfer sessions, like the iOS app
+ *   compact  1 to answer in compact records, referring to titles the watch
+ *            holds, like calendar_feed.js (needs a session)
+ *   recurring  percent of events with a title shared with others, as for
+ *            standups and 1:1s
+ *   primed   1 to sync the same events cleanly first, so only the second
+ *            sync - the next poll - is measured
+ *   runs     number of syncs to simulate
+ *   seed     PRNG seed, so runs repeat exactly
+ *
+ * Output is one CSV row per scenario. "corrupt" syncs committed the wrong
+ * events, "incomplete" ones were abandoned or never finished within
+ * SYNC_TIMEOUT_MS. payload_bytes_per_sync is the calendar tuples the phone
+ * sent, lost ones and resends included; text_bytes_per_event is the RAM the
+ * committed set's titles take on the watch, ids and interned strings together,
+ * against 21 a title when each event had its own copy.
+ */
+
+#include "common.h"
+
+extern EventText event_sets[2][MAX_EVENTS];
+extern InternedString strings[STRINGS_MAX];
+extern EventHot hot_sets[2][MAX_EVENTS];
+extern TimerRecord timer_sets[2][MAX_EVENTS];
+extern TraceRecord trace_ring[TRACE_CAPACITY];
+extern EventText *events;
+extern EventHot *event_hot;
+extern bool calendar_request_outstanding;
+extern int max_entries;
+extern LinkStats link_stats;
+
+#define SYNC_TIMEOUT_MS 60000
+#define MAX_RUNS 10000
+#define BENCH_EPOCH 1402905600 // 2014-06-16 08:00:00 UTC
+
+typedef struct {
+  char name[32];
+  int events;
+  int mtu;
+  int latency;
+  int jitter;
+  int drop;
+  int reorder;
+  int legacy;
+  int compact;
+  int recurring;
+  int primed;
+  int runs;
+  uint32_t seed;
+} Scenario;
+
+static const char *default_script[] = {
+  "baseline     events=15 mtu=124 latency=40 jitter=0  drop=0 reorder=0 runs=500 seed=1",
+  "jitter       events=15 mtu=124 latency=40 jitter=60 drop=0 reorder=0 runs=500 seed=1",
+  "big_mtu      events=15 mtu=656 latency=40 jitter=20 drop=0 reorder=0 runs=500 seed=1",
+  "lossy        events=15 mtu=124 latency=40 jitter=20 drop=5 reorder=0 runs=500 seed=1",
+  "reordered    events=15 mtu=124 latency=40 jitter=20 drop=0 reorder=5 runs=500 seed=1",
+  "few          events=3  mtu=124 latency=40 jitter=20 drop=0 reorder=0 runs=500 seed=1",
+  "legacy       events=15 mtu=124 latency=40 jitter=20 drop=0 reorder=0 legacy=1 runs=500 seed=1",
+  "legacy_lossy events=15 mtu=124 latency=40 jitter=20 drop=5 reorder=0 legacy=1 runs=500 seed=1",
+  "compact      events=15 mtu=124 latency=40 jitter=20 drop=0 reorder=0 compact=1 runs=500 seed=1",
+  "compact_lossy events=15 mtu=124 latency=40 jitter=20 drop=5 reorder=5 compact=1 runs=500 seed=1",
+  "recurring    events=15 mtu=124 latency=40 jitter=20 drop=0 reorder=0 recurring=60 runs=500 seed=1",
+  "recurring_compact events=15 mtu=124 latency=40 jitter=20 drop=0 reorder=0 recurring=60 compact=1 runs=500 seed=1",
+  "resync       events=15 mtu=124 latency=40 jitter=20 drop=0 reorder=0 recurring=60 primed=1 runs=500 seed=1",
+  "resync_compact events=15 mtu=124 latency=40 jitter=20 drop=0 reorder=0 recurring=60 compact=1 primed=1 runs=500 seed=1",
+  NULL
+};
+
+// Calendar hooks normally provided by Revolution.c
+void set_event_status(int new_status_display) {
+}
+
+void display_event_text(char *text, char *relative) {
+}
+
+/*
+ * Deterministic PRNG (xorshift32)
+ */
+static uint32_t rng_state;
+
+static uint32_t rng_next(void) {
+  uint32_t x = rng_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return rng_state = x;
+}
+
+static int rng_percent(int percent) {
+  return (int)(rng_next() % 100) < percent;
+}
+
+/*
+ * Mock phone
+ */
+static Scenario *scenario;
+static Event phone_events[MAX_EVENTS];
+static int messages_sent;
+static int resumes_received;
+static uint32_t payload_bytes;
+static bool priming;
+
+static const char *recurring_titles[] = { "Standup", "1:1", "Design review", "Lunch" };
+
+// The strings the watch holds once this session commits, by id, and which of them it holds already
+static char phone_strings[STRINGS_MAX + 1][STRING_TEXT_SIZE];
+static bool phone_string_live[STRINGS_MAX + 1];
+static bool phone_string_held[STRINGS_MAX + 1];
+static uint8_t phone_title_ids[MAX_EVENTS];
+
+static void make_phone_events(int n) {
+  memset(phone_events, 0, sizeof(phone_events));
+  for (int i = 0; i < n; i++) {
+    Event *e = &phone_events[i];
+    e->index = i;
+    if (i * 100 < scenario->recurring * n)
+      snprintf(e->title, sizeof(e->title), "%s", recurring_titles[i % 4]);
+    else
+      snprintf(e->title, sizeof(e->title), "Meeting %d", i);
+    e->has_location = (i % 2) == 0;
+    if (e->has_location)
+      snprintf(e->location, sizeof(e->location), "Room %d", 100 + i);
+    e->all_day = (i % 7) == 6;
+    int minutes = 9 * 60 + i * 25;
+    snprintf(e->start_date, sizeof(e->start_date), "06/16 %02d:%02d", minutes / 60, minutes % 60);
+  }
+}
+
+static uint32_t phone_strings_digest(void) {
+  uint32_t hash = 2166136261u;
+  for (int id = 1; id <= STRINGS_MAX; id++) {
+    if (!phone_string_live[id])
+      continue;
+    hash ^= id;
+    hash *= 16777619u;
+    for (const char *c = phone_strings[id]; *c; c++) {
+      hash ^= (uint8_t)*c;
+      hash *= 16777619u;
+    }
+  }
+  return hash;
+}
+
+/*
+ * Give each distinct title of the set an id, as calendar_feed.js does. If the
+ * watch holds what the last session sent, those keep their ids and are only
+ * referred to; new ones take ids the watch isn't using.
+ */
+static void phone_assign_strings(uint32_t watch_mask, uint32_t watch_digest) {
+  bool match = phone_strings_digest() == watch_digest;
+  char old_strings[STRINGS_MAX + 1][STRING_TEXT_SIZE];
+  bool old_live[STRINGS_MAX + 1];
+  memcpy(old_strings, phone_strings, sizeof(old_strings));
+  memcpy(old_live, phone_string_live, sizeof(old_live));
+  memset(phone_string_live, 0, sizeof(phone_string_live));
+  memset(phone_string_held, 0, sizeof(phone_string_held));
+
+  for (int i = 0; i < scenario->events; i++) {
+    const char *title = phone_events[i].title;
+    uint8_t id = STRING_NONE;
+    for (int j = 1; j <= STRINGS_MAX && id == STRING_NONE; j++) {
+      if (phone_string_live[j] && strcmp(phone_strings[j], title) == 0)
+        id = j;
+    }
+    for (int j = 1; j <= STRINGS_MAX && id == STRING_NONE && match; j++) {
+      if (old_live[j] && strcmp(old_strings[j], title) == 0) {
+        id = j;
+        phone_string_held[id] = true;
+      }
+    }
+    for (int j = 1; j <= STRINGS_MAX && id == STRING_NONE; j++) {
+      if (!phone_string_live[j] && !(watch_mask & (1u << j)))
+        id = j;
+    }
+    snprintf(phone_strings[id], STRING_TEXT_SIZE, "%s", title);
+    phone_string_live[id] = true;
+    phone_title_ids[i] = id;
+  }
+}
+
+/*
+ * One event as the phone sends it; defined holds the ids already defined in this message
+ */
+static uint16_t phone_record(uint8_t *out, int e, uint32_t *defined) {
+  if (!scenario->compact) {
+    memcpy(out, &phone_events[e], sizeof(Event));
+    return sizeof(Event);
+  }
+
+  const Event *event = &phone_events[e];
+  uint8_t id = phone_title_ids[e];
+  uint16_t len = COMPACT_HEADER_SIZE;
+  out[0] = e;
+  out[1] = event->all_day ? COMPACT_ALL_DAY : 0;
+  out[2] = id;
+  if (!phone_string_held[id] && !(*defined & (1u << id))) {
+    out[1] |= COMPACT_TITLE_DEFINED;
+    out[len] = strlen(event->title);
+    memcpy(&out[len + 1], event->title, out[len]);
+    len += 1 + out[len];
+    *defined |= 1u << id;
+  }
+  out[len] = strlen(event->start_date);
+  memcpy(&out[len + 1], event->start_date, out[len]);
+  return len + 1 + out[len];
+}
+
+/*
+ * Send events [first, last] the way the companion does: whole events per
+ * message, the count up front, and a transfer header when there is a session
+ */
+static void phone_send(int first, int last, int session) {
+  int header = scenario->legacy ? 0 : TUPLE_HEADER_SIZE + 3;
+  int room = scenario->mtu - (int)sizeof(Dictionary) - TUPLE_HEADER_SIZE - 1 - header;
+
+  uint8_t payloads[MAX_EVENTS + 1][1 + MAX_EVENTS * sizeof(Event)];
+  uint16_t lengths[MAX_EVENTS + 1];
+  uint32_t arrivals[MAX_EVENTS + 1];
+  int n = 0;
+  int e = first;
+  do {
+    uint16_t len = 0;
+    uint32_t defined = 0;
+    if (n == 0 || !scenario->legacy)
+      payloads[n][len++] = scenario->events;
+    uint16_t start = len;
+    for (; e <= last; e++) {
+      uint8_t record[sizeof(Event)];
+      uint32_t was_defined = defined;
+      uint16_t size = phone_record(record, e, &defined);
+      if (len > start && len - start + size > room) {
+        defined = was_defined;
+        break;
+      }
+      memcpy(&payloads[n][len], record, size);
+      len += size;
+    }
+    lengths[n] = len;
+    arrivals[n] = (n + 1) * scenario->latency + (scenario->jitter && !priming ? rng_next() % (scenario->jitter + 1) : 0);
+    n++;
+  } while (e <= last);
+
+  for (int i = 0; i + 1 < n && !priming; i++) {
+    if (rng_percent(scenario->reorder)) {
+      uint32_t t = arrivals[i];
+      arrivals[i] = arrivals[i + 1];
+      arrivals[i + 1] = t;
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    messages_sent++;
+    payload_bytes += lengths[i];
+    if (!priming && rng_percent(scenario->drop))
+      continue;
+    uint8_t buffer[700];
+    DictionaryIterator out;
+    dict_write_begin(&out, buffer, sizeof(buffer));
+    dict_write_data(&out, scenario->compact ? CALENDAR_COMPACT_KEY : CALENDAR_RESPONSE_KEY, payloads[i], lengths[i]);
+    if (!scenario->legacy) {
+      uint8_t transfer[3] = { session, i, i == n - 1 };
+      dict_write_data(&out, TRANSFER_KEY, transfer, sizeof(transfer));
+    }
+    host_deliver_inbox(arrivals[i], buffer, dict_write_end(&out));
+  }
+}
+
+static AppMessageResult phone_outbox(const uint8_t *data, uint16_t size, void *context) {
+  DictionaryIterator iter;
+  if (!dict_read_begin_from_buffer(&iter, data, size))
+    return APP_MSG_OK;
+
+  Tuple *request = dict_find(&iter, REQUEST_CALENDAR_KEY);
+  Tuple *session = dict_find(&iter, TRANSFER_KEY);
+  Tuple *resume = dict_find(&iter, RESUME_CALENDAR_KEY);
+  Tuple *held = dict_find(&iter, STRINGS_KEY);
+
+  if (request && scenario->compact) {
+    uint32_t watch_strings[2] = { 0, 0 };
+    if (held && held->length >= sizeof(watch_strings))
+      memcpy(watch_strings, held->value->data, sizeof(watch_strings));
+    phone_assign_strings(watch_strings[0], watch_strings[1]);
+  }
+
+  if (request) {
+    phone_send(0, scenario->events - 1, session ? session->value->uint8 : 0);
+  } else if (resume && !scenario->legacy && resume->length >= 3) {
+    resumes_received++;
+    const uint8_t *range = resume->value->data;
+    int last = range[2];
+    if (last >= scenario->events)
+      last = scenario->events - 1;
+    phone_send(range[1], last, range[0]);
+  }
+  return APP_MSG_OK;
+}
+
+/*
+ * Scenario runner
+ */
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint32_t percentile(uint32_t *sorted, int n, int pct) {
+  if (n == 0)
+    return 0;
+  int i = (n * pct + 99) / 100 - 1;
+  return sorted[i < 0 ? 0 : i];
+}
+
+static bool calendar_matches(void) {
+  if (max_entries != scenario->events)
+    return false;
+  for (int i = 0; i < scenario->events; i++) {
+    EventView view = { (const uint8_t *)&phone_events[i] };
+    EventHot hot;
+    decode_event_hot(&view, &hot);
+    if (strcmp(string_text(events[i].title), phone_events[i].title) != 0 || event_hot[i].hash != hot.hash ||
+        event_hot[i].start_minute != hot.start_minute || event_hot[i].day_key != hot.day_key)
+      return false;
+  }
+  return true;
+}
+
+// What the committed set's titles take: an id each, and each distinct string once
+static size_t text_bytes(void) {
+  size_t bytes = max_entries * sizeof(EventText);
+  for (int id = 1; id <= STRINGS_MAX; id++) {
+    if (strings[id - 1].refs > 0)
+      bytes += sizeof(InternedString);
+  }
+  return bytes;
+}
+
+static void run_sync(void) {
+  handle_calendar_timer((void *)REQUEST_CALENDAR_KEY);
+  uint32_t start = host_now_ms();
+  while (calendar_request_outstanding && host_now_ms() - start < SYNC_TIMEOUT_MS && host_run_next())
+    ;
+}
+
+static void run_scenario(Scenario *s) {
+  static uint32_t complete_ms[MAX_RUNS];
+  int completed = 0;
+  int corrupt = 0;
+  int resumes = 0;
+  uint64_t handler_ns = 0;
+  size_t heap_peak = 0;
+  int total_messages = 0;
+  uint64_t total_payload = 0;
+  uint64_t total_text = 0;
+
+  scenario = s;
+  rng_state = s->seed ? s->seed : 1;
+  if (s->legacy)
+    s->compact = 0;
+  make_phone_events(s->events);
+
+  for (int run = 0; run < s->runs; run++) {
+    host_reset(BENCH_EPOCH);
+    app_message_register_inbox_received(received_message);
+    app_message_register_inbox_dropped(calendar_inbox_dropped);
+    outbox_init();
+    app_message_open(s->mtu, 256);
+    host_set_outbox_handler(phone_outbox, NULL);
+    memset(event_sets, 0, sizeof(event_sets));
+    memset(strings, 0, sizeof(strings));
+    memset(phone_string_live, 0, sizeof(phone_string_live));
+    memset(&link_stats, 0, sizeof(link_stats));
+    max_entries = 0;
+
+    if (s->primed) {
+      priming = true;
+      run_sync();
+      priming = false;
+    }
+    messages_sent = 0;
+    resumes_received = 0;
+    payload_bytes = 0;
+    uint32_t committed = link_stats.completed;
+    uint32_t start = host_now_ms();
+    uint64_t primed_ns = host_stats.inbox_handler_ns;
+    run_sync();
+
+    total_messages += messages_sent;
+    total_payload += payload_bytes;
+    resumes += resumes_received;
+    handler_ns += host_stats.inbox_handler_ns - primed_ns;
+    if (host_stats.heap_peak > heap_peak)
+      heap_peak = host_stats.heap_peak;
+
+    if (link_stats.completed == committed)
+      continue;
+    if (calendar_matches()) {
+      complete_ms[completed++] = host_now_ms() - start;
+      total_text += text_bytes();
+    } else {
+      corrupt++;
+    }
+  }
+
+  qsort(complete_ms, completed, sizeof(uint32_t), compare_u32);
+  double events_per_s = handler_ns ? (double)completed * s->events * 1e9 / handler_ns : 0;
+  size_t app_static = sizeof(event_sets) + sizeof(strings) + sizeof(hot_sets) + sizeof(timer_sets) + sizeof(trace_ring);
+
+  printf("%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.1f,%.2f,%.2f,%d,%d,%d,%u,%u,%u,%u,%zu,%zu,%.1f,%.1f\n",
+         s->name, s->events, s->mtu, s->latency, s->jitter, s->drop, s->reorder, s->legacy,
+         s->compact, s->recurring, s->primed, s->runs,
+         events_per_s, (double)total_messages / s->runs, (double)resumes / s->runs,
+         completed, corrupt, s->runs - completed - corrupt,
+         percentile(complete_ms, completed, 50), percentile(complete_ms, completed, 90),
+         percentile(complete_ms, completed, 99), completed ? complete_ms[completed - 1] : 0,
+         heap_peak, app_static, (double)total_payload / s->runs,
+         completed && s->events ? (double)total_text / completed / s->events : 0);
+}
+
+static bool parse_scenario(const char *line, Scenario *s) {
+  char buffer[256];
+  strncpy(buffer, line, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+
+  char *token = strtok(buffer, " \t\r\n");
+  if (!token || token[0] == '#')
+    return false;
+
+  *s = (Scenario){ .events = MAX_EVENTS, .mtu = 124, .latency = 40, .runs = 100, .seed = 1 };
+  strncpy(s->name, token, sizeof(s->name) - 1);
+  while ((token = strtok(NULL, " \t\r\n"))) {
+    char *eq = strchr(token, '=');
+    if (!eq)
+      continue;
+    *eq = '\0';
+    long value = strtol(eq + 1, NULL, 10);
+    if (strcmp(token, "events") == 0) s->events = value;
+    else if (strcmp(token, "mtu") == 0) s->mtu = value;
+    else if (strcmp(token, "latency") == 0) s->latency = value;
+    else if (strcmp(token, "jitter") == 0) s->jitter = value;
+    else if (strcmp(token, "drop") == 0) s->drop = value;
+    else if (strcmp(token, "reorder") == 0) s->reorder = value;
+    else if (strcmp(token, "legacy") == 0) s->legacy = value;
+    else if (strcmp(token, "compact") == 0) s->compact = value;
+    else if (strcmp(token, "recurring") == 0) s->recurring = value;
+    else if (strcmp(token, "primed") == 0) s->primed = value;
+    else if (strcmp(token, "runs") == 0) s->runs = value;
+    else if (strcmp(token, "seed") == 0) s->seed = value;
+    else fprintf(stderr, "%s: unknown setting '%s'\n", s->name, token);
+  }
+
+  if (s->events > MAX_EVENTS) {
+    fprintf(stderr, "%s: events capped at MAX_EVENTS (%d)\n", s->name, MAX_EVENTS);
+    s->events = MAX_EVENTS;
+  }
+  if (s->events < 0)
+    s->events = 0;
+  if (s->runs > MAX_RUNS)
+    s->runs = MAX_RUNS;
+  if (s->mtu > 656)
+    s->mtu = 656;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  printf("scenario,events,mtu,latency_ms,jitter_ms,drop_pct,reorder_pct,legacy,compact,recurring_pct,primed,runs,"
+         "events_per_s,messages_per_sync,resumes_per_sync,completed,corrupt,incomplete,"
+         "p50_ms,p90_ms,p99_ms,max_ms,heap_peak_bytes,app_static_bytes,payload_bytes_per_sync,text_bytes_per_event\n");
+
+  Scenario s;
+  if (argc > 1) {
+    FILE *f = fopen(argv[1], "r");
+    if (!f) {
+      perror(argv[1]);
+      return 1;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+      if (parse_scenario(line, &s))
+        run_scenario(&s);
+    }
+    fclose(f);
+  } else {
+    for (int i = 0; default_script[i]; i++) {
+      if (parse_scenario(default_script[i], &s))
+        run_scenario(&s);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Time digit encoder - turns the ten time digit PNGs into the row-wise runs
+ * src/digits.c draws from, and reports what that saves.
+ *
+ *   node host/encode_digits.js [--check] > digits.csv
+ *
+ * Writes resources/data/time_digits.rle (the TIME_DIGITS_RLE resource). It is
+ * run by hand after changing the digit images and the output checked in; the
+ * build only reads the committed file. --check writes nothing and exits 1 if
+ * the committed file is not what the images encode to. Ink is every pixel
+ * that isn't the image's darkest colour. Layout, little endian:
+ *
+ *   uint8  width, height, digit count, version
+ *   uint16 offset of each digit's first row, from the start of the resource
+ *   each row: uint8 run count, then per run uint8 x, uint8 length
+ */
+
+var fs = require('fs');
+var path = require('path');
+var report = require('./resource_report.js');
+
+var ROOT = path.join(__dirname, '..');
+var DIGIT_FILES = path.join(ROOT, 'resources', 'images', 'time_%d.png');
+var OUTPUT = path.join(ROOT, 'resources', 'data', 'time_digits.rle');
+var DIGITS = 10;
+var VERSION = 1;       // DIGITS_VERSION in common.h
+var MAX_BYTES = 2560;  // DIGITS_MAX_BYTES
+
+function encode_rows(png) {
+  var background = report.unique_colours(png.pixels)[0];
+  var bytes = [];
+  var runs = 0;
+  for (var y = 0; y < png.height; y++) {
+    var row = [];
+    for (var x = 0; x < png.width; x++) {
+      if (png.pixels[y * png.width + x] === background)
+        continue;
+      var start = x;
+      while (x < png.width && png.pixels[y * png.width + x] !== background)
+        x++;
+      row.push(start, x - start);
+    }
+    if (row.length / 2 > 255)
+      throw new Error('too many runs in row ' + y);
+    bytes.push(row.length / 2);
+    bytes = bytes.concat(row);
+    runs += row.length / 2;
+  }
+  return { bytes: bytes, runs: runs };
+}
+
+function main(check) {
+  var width = 0;
+  var height = 0;
+  var digits = [];
+  var bitmap_bytes = 0;
+
+  console.log('digit,width,height,runs,rle_bytes,bitmap_bytes');
+  for (var d = 0; d < DIGITS; d++) {
+    var png = report.decode_png(fs.readFileSync(DIGIT_FILES.replace('%d', d)));
+    if (d > 0 && (png.width !== width || png.height !== height))
+      throw new Error('time_' + d + '.png is ' + png.width + 'x' + png.height + ', not ' + width + 'x' + height);
+    if (png.width > 255 || png.height > 255)
+      throw new Error('time_' + d + '.png is too big to encode');
+    width = png.width;
+    height = png.height;
+
+    var encoded = encode_rows(png);
+    digits.push(encoded.bytes);
+    bitmap_bytes += report.mono_bytes(png);
+    console.log([d, width, height, encoded.runs, encoded.bytes.length, report.mono_bytes(png)].join(','));
+  }
+
+  var header = 4 + DIGITS * 2;
+  var size = digits.reduce(function (total, rows) { return total + rows.length; }, header);
+  if (size > MAX_BYTES)
+    throw new Error('encoded digits take ' + size + ' bytes; the watch has room for ' + MAX_BYTES);
+
+  var out = Buffer.alloc(size);
+  out[0] = width;
+  out[1] = height;
+  out[2] = DIGITS;
+  out[3] = VERSION;
+  var pos = header;
+  digits.forEach(function (rows, d) {
+    out.writeUInt16LE(pos, 4 + d * 2);
+    Buffer.from(rows).copy(out, pos);
+    pos += rows.length;
+  });
+
+  console.log(['TOTAL', width, height, '', size, bitmap_bytes].join(','));
+  if (check) {
+    if (!fs.existsSync(OUTPUT) || !fs.readFileSync(OUTPUT).equals(out)) {
+      console.error(path.relative(ROOT, OUTPUT) + ' is out of date - run host/encode_digits.js and commit it');
+      process.exitCode = 1;
+    }
+    return;
+  }
+  fs.mkdirSync(path.dirname(OUTPUT), { recursive: true });
+  fs.writeFileSync(OUTPUT, out);
+}
+
+main(process.argv.indexOf('--check') >= 0);
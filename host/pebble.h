@@ -0,0 +1,488 @@
+#ifndef host_pebble_h
+#define host_pebble_h
+
+/*
+ * Host stand-in for the parts of the Pebble SDK the watchface uses, so the
+ * calendar and clock code can be compiled and driven on a desktop machine.
+ * Time is virtual: timers and inbound messages fire from host_run_until().
+ *
+ * pebble_host.c covers time, timers, dictionaries and AppMessage; the
+ * layers, animations and event services are in pebble_ui.c, which only
+ * tools that build Revolution.c need.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Logging
+#define APP_LOG_LEVEL_ERROR   1
+#define APP_LOG_LEVEL_WARNING 50
+#define APP_LOG_LEVEL_INFO    100
+#define APP_LOG_LEVEL_DEBUG   200
+#define APP_LOG(level, fmt, ...) host_log(level, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+void host_log(int level, const char *file, int line, const char *fmt, ...);
+
+// Time
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms);
+
+// Timers
+typedef struct AppTimer AppTimer;
+typedef void (*AppTimerCallback)(void *data);
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data);
+bool app_timer_reschedule(AppTimer *timer, uint32_t new_timeout_ms);
+void app_timer_cancel(AppTimer *timer);
+
+// Dictionary
+typedef enum {
+  TUPLE_BYTE_ARRAY = 0,
+  TUPLE_CSTRING = 1,
+  TUPLE_UINT = 2,
+  TUPLE_INT = 3,
+} TupleType;
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t key;
+  TupleType type:8;
+  uint16_t length;
+  union {
+    uint8_t data[0];
+    char cstring[0];
+    uint8_t uint8;
+    uint16_t uint16;
+    uint32_t uint32;
+    int8_t int8;
+    int16_t int16;
+    int32_t int32;
+  } value[];
+} Tuple;
+
+typedef struct __attribute__((__packed__)) {
+  uint8_t count;
+  Tuple head[];
+} Dictionary;
+
+typedef struct {
+  Dictionary *dictionary;
+  const void *end;
+  Tuple *cursor;
+} DictionaryIterator;
+
+typedef enum {
+  DICT_OK = 0,
+  DICT_NOT_ENOUGH_STORAGE = 1 << 1,
+  DICT_INVALID_ARGS = 1 << 2,
+} DictionaryResult;
+
+#define TUPLE_HEADER_SIZE 7
+
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...);
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t *const buffer, const uint16_t size);
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t *const data, const uint16_t size);
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char *const cstring);
+DictionaryResult dict_write_int8(DictionaryIterator *iter, const uint32_t key, const int8_t value);
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, const uint32_t key, const uint8_t value);
+DictionaryResult dict_write_int16(DictionaryIterator *iter, const uint32_t key, const int16_t value);
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, const uint32_t key, const uint16_t value);
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value);
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value);
+uint32_t dict_write_end(DictionaryIterator *iter);
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t *const buffer, const uint16_t size);
+Tuple *dict_read_first(DictionaryIterator *iter);
+Tuple *dict_read_next(DictionaryIterator *iter);
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key);
+
+// AppMessage
+typedef enum {
+  APP_MSG_OK = 0,
+  APP_MSG_SEND_TIMEOUT = 1 << 1,
+  APP_MSG_SEND_REJECTED = 1 << 2,
+  APP_MSG_NOT_CONNECTED = 1 << 3,
+  APP_MSG_APP_NOT_RUNNING = 1 << 4,
+  APP_MSG_INVALID_ARGS = 1 << 5,
+  APP_MSG_BUSY = 1 << 6,
+  APP_MSG_BUFFER_OVERFLOW = 1 << 7,
+  APP_MSG_ALREADY_RELEASED = 1 << 9,
+  APP_MSG_CALLBACK_ALREADY_REGISTERED = 1 << 10,
+  APP_MSG_CALLBACK_NOT_REGISTERED = 1 << 11,
+  APP_MSG_OUT_OF_MEMORY = 1 << 12,
+  APP_MSG_CLOSED = 1 << 13,
+  APP_MSG_INTERNAL_ERROR = 1 << 14,
+} AppMessageResult;
+
+typedef void (*AppMessageInboxReceived)(DictionaryIterator *iterator, void *context);
+typedef void (*AppMessageInboxDropped)(AppMessageResult reason, void *context);
+typedef void (*AppMessageOutboxSent)(DictionaryIterator *iterator, void *context);
+typedef void (*AppMessageOutboxFailed)(DictionaryIterator *iterator, AppMessageResult reason, void *context);
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound);
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback);
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback);
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback);
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback);
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator);
+AppMessageResult app_message_outbox_send(void);
+uint32_t app_message_inbox_size_maximum(void);
+uint32_t app_message_outbox_size_maximum(void);
+
+// Persistent storage
+typedef int32_t status_t;
+#define S_SUCCESS 0
+#define E_INVALID_ARGUMENT -4
+#define E_OUT_OF_STORAGE -6
+#define E_DOES_NOT_EXIST -9
+#define PERSIST_DATA_MAX_LENGTH 256
+
+bool persist_exists(const uint32_t key);
+int32_t persist_read_int(const uint32_t key);
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size);
+status_t persist_write_int(const uint32_t key, const int32_t value);
+int persist_write_data(const uint32_t key, const void *data, const size_t size);
+status_t persist_delete(const uint32_t key);
+
+// Vibes and light
+void vibes_short_pulse(void);
+void vibes_long_pulse(void);
+void vibes_double_pulse(void);
+void light_enable_interaction(void);
+
+// Background worker - the app side, and what pebble_worker.h adds for the worker itself
+typedef enum {
+  APP_WORKER_RESULT_SUCCESS = 0,
+  APP_WORKER_RESULT_NO_WORKER = 1,
+  APP_WORKER_RESULT_DIFFERENT_APP = 2,
+  APP_WORKER_RESULT_NOT_RUNNING = 3,
+  APP_WORKER_RESULT_ALREADY_RUNNING = 4,
+  APP_WORKER_RESULT_ASKING_CONFIRMATION = 5,
+} AppWorkerResult;
+
+typedef struct {
+  uint16_t data0;
+  uint16_t data1;
+  uint16_t data2;
+} AppWorkerMessage;
+
+typedef void (*AppWorkerMessageHandler)(uint16_t type, AppWorkerMessage *data);
+
+AppWorkerResult app_worker_launch(void);
+AppWorkerResult app_worker_kill(void);
+bool app_worker_is_running(void);
+bool app_worker_message_subscribe(AppWorkerMessageHandler handler);
+bool app_worker_message_unsubscribe(void);
+void app_worker_send_message(uint8_t type, AppWorkerMessage *data);
+
+// Graphics
+typedef struct GPoint {
+  int16_t x;
+  int16_t y;
+} GPoint;
+
+typedef struct GSize {
+  int16_t w;
+  int16_t h;
+} GSize;
+
+typedef struct GRect {
+  GPoint origin;
+  GSize size;
+} GRect;
+
+#define GPoint(x, y) ((GPoint){(x), (y)})
+#define GSize(w, h) ((GSize){(w), (h)})
+#define GRect(x, y, w, h) ((GRect){{(x), (y)}, {(w), (h)}})
+#define GRectZero GRect(0, 0, 0, 0)
+
+typedef enum GColor {
+  GColorClear = ~0,
+  GColorBlack = 0,
+  GColorWhite = 1,
+} GColor;
+
+typedef enum {
+  GCompOpAssign,
+  GCompOpAssignInverted,
+  GCompOpOr,
+  GCompOpAnd,
+  GCompOpClear,
+  GCompOpSet,
+} GCompOp;
+
+typedef enum {
+  GTextAlignmentLeft,
+  GTextAlignmentCenter,
+  GTextAlignmentRight,
+} GTextAlignment;
+
+// 1 bit per pixel, rows padded to a multiple of 4 bytes
+typedef struct {
+  void *addr;
+  uint16_t row_size_bytes;
+  uint16_t info_flags;
+  GRect bounds;
+} GBitmap;
+
+typedef struct GContext GContext;
+typedef struct GFont *GFont;
+
+#define FONT_KEY_GOTHIC_18 "RESOURCE_ID_GOTHIC_18"
+#define FONT_KEY_ROBOTO_CONDENSED_21 "RESOURCE_ID_ROBOTO_CONDENSED_21"
+#define FONT_KEY_ROBOTO_BOLD_SUBSET_49 "RESOURCE_ID_ROBOTO_BOLD_SUBSET_49"
+
+GFont fonts_get_system_font(const char *font_key);
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id);
+void gbitmap_destroy(GBitmap *bitmap);
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode);
+void graphics_context_set_fill_color(GContext *ctx, GColor color);
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect);
+
+typedef enum {
+  GCornerNone = 0,
+  GCornerTopLeft = 1 << 0,
+  GCornerTopRight = 1 << 1,
+  GCornerBottomLeft = 1 << 2,
+  GCornerBottomRight = 1 << 3,
+  GCornersAll = 0xf,
+} GCornerMask;
+
+// Corners are drawn square whatever the radius
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask);
+
+typedef void *ResHandle;
+ResHandle resource_get_handle(uint32_t resource_id);
+size_t resource_size(ResHandle handle);
+size_t resource_load(ResHandle handle, uint8_t *buffer, size_t max_length);
+
+// Resources, numbered in appinfo.json order like the SDK does
+#include "resource_ids.auto.h"
+
+// Layers
+typedef struct Layer Layer;
+typedef void (*LayerUpdateProc)(Layer *layer, GContext *ctx);
+
+Layer *layer_create(GRect frame);
+void layer_destroy(Layer *layer);
+void layer_mark_dirty(Layer *layer);
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc);
+void layer_set_frame(Layer *layer, GRect frame);
+GRect layer_get_frame(const Layer *layer);
+void layer_set_bounds(Layer *layer, GRect bounds);
+GRect layer_get_bounds(const Layer *layer);
+void layer_add_child(Layer *parent, Layer *child);
+void layer_remove_from_parent(Layer *child);
+void layer_set_hidden(Layer *layer, bool hidden);
+bool layer_get_hidden(const Layer *layer);
+void layer_set_clips(Layer *layer, bool clips);
+bool layer_get_clips(const Layer *layer);
+
+typedef struct Window Window;
+Window *window_create(void);
+void window_destroy(Window *window);
+void window_stack_push(Window *window, bool animated);
+void window_set_background_color(Window *window, GColor background_color);
+Layer *window_get_root_layer(const Window *window);
+
+typedef struct BitmapLayer BitmapLayer;
+BitmapLayer *bitmap_layer_create(GRect frame);
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer);
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer);
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap);
+void bitmap_layer_set_background_color(BitmapLayer *bitmap_layer, GColor color);
+void bitmap_layer_set_compositing_mode(BitmapLayer *bitmap_layer, GCompOp mode);
+
+typedef struct TextLayer TextLayer;
+TextLayer *text_layer_create(GRect frame);
+void text_layer_destroy(TextLayer *text_layer);
+Layer *text_layer_get_layer(TextLayer *text_layer);
+void text_layer_set_text(TextLayer *text_layer, const char *text);
+void text_layer_set_text_color(TextLayer *text_layer, GColor color);
+void text_layer_set_background_color(TextLayer *text_layer, GColor color);
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment);
+void text_layer_set_font(TextLayer *text_layer, GFont font);
+
+// Animation - public structs as in SDK 2, so a PropertyAnimation can be re-aimed and run again
+typedef struct Animation Animation;
+typedef void (*AnimationStartedHandler)(Animation *animation, void *context);
+typedef void (*AnimationStoppedHandler)(Animation *animation, bool finished, void *context);
+
+typedef struct AnimationHandlers {
+  AnimationStartedHandler started;
+  AnimationStoppedHandler stopped;
+} AnimationHandlers;
+
+typedef enum {
+  AnimationCurveLinear,
+  AnimationCurveEaseIn,
+  AnimationCurveEaseOut,
+  AnimationCurveEaseInOut,
+} AnimationCurve;
+
+struct Animation {
+  uint32_t duration_ms;
+  uint32_t delay_ms;
+  AnimationCurve curve;
+  AnimationHandlers handlers;
+  void *context;
+  AppTimer *timer;
+  uint64_t started_ms;
+  bool scheduled;
+};
+
+typedef struct PropertyAnimation {
+  Animation animation;
+  struct {
+    union {
+      GRect grect;
+      GPoint gpoint;
+      int16_t int16;
+    } to;
+    union {
+      GRect grect;
+      GPoint gpoint;
+      int16_t int16;
+    } from;
+  } values;
+  void *subject;
+} PropertyAnimation;
+
+void animation_set_duration(Animation *animation, uint32_t duration_ms);
+void animation_set_delay(Animation *animation, uint32_t delay_ms);
+void animation_set_curve(Animation *animation, AnimationCurve curve);
+void animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context);
+void animation_schedule(Animation *animation);
+void animation_unschedule(Animation *animation);
+bool animation_is_scheduled(Animation *animation);
+PropertyAnimation *property_animation_create_layer_frame(Layer *layer, GRect *from_frame, GRect *to_frame);
+void property_animation_destroy(PropertyAnimation *property_animation);
+
+// Event services
+typedef enum {
+  SECOND_UNIT = 1 << 0,
+  MINUTE_UNIT = 1 << 1,
+  HOUR_UNIT = 1 << 2,
+  DAY_UNIT = 1 << 3,
+  MONTH_UNIT = 1 << 4,
+  YEAR_UNIT = 1 << 5,
+} TimeUnits;
+
+typedef enum {
+  ACCEL_AXIS_X = 0,
+  ACCEL_AXIS_Y = 1,
+  ACCEL_AXIS_Z = 2,
+} AccelAxisType;
+
+typedef struct {
+  uint8_t charge_percent;
+  bool is_charging;
+  bool is_plugged;
+} BatteryChargeState;
+
+typedef void (*TickHandler)(struct tm *tick_time, TimeUnits units_changed);
+typedef void (*AccelTapHandler)(AccelAxisType axis, int32_t direction);
+typedef void (*BluetoothConnectionHandler)(bool connected);
+typedef void (*BatteryStateHandler)(BatteryChargeState charge);
+
+void tick_timer_service_subscribe(TimeUnits tick_units, TickHandler handler);
+void tick_timer_service_unsubscribe(void);
+void accel_tap_service_subscribe(AccelTapHandler handler);
+void accel_tap_service_unsubscribe(void);
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler);
+void bluetooth_connection_service_unsubscribe(void);
+bool bluetooth_connection_service_peek(void);
+void battery_state_service_subscribe(BatteryStateHandler handler);
+void battery_state_service_unsubscribe(void);
+BatteryChargeState battery_state_service_peek(void);
+
+bool clock_is_24h_style(void);
+void app_event_loop(void);
+
+/*
+ * Host-side controls
+ */
+// Called with each outgoing dictionary; the result decides sent vs failed
+typedef AppMessageResult (*HostOutboxHandler)(const uint8_t *data, uint16_t size, void *context);
+
+typedef struct {
+  size_t heap_current;
+  size_t heap_peak;
+  uint32_t heap_allocs;
+  uint32_t timers_fired;
+  uint32_t vibes;
+  uint32_t lights;
+  uint32_t inbox_delivered;
+  uint32_t inbox_dropped;
+  uint32_t outbox_sent;
+  uint32_t persist_writes;
+  uint32_t persist_bytes_written;
+  uint64_t inbox_handler_ns;
+  uint32_t layers_dirtied;
+  uint32_t animations_scheduled;
+  uint32_t animation_frames;
+  uint32_t frames_rendered;
+  uint64_t pixels_written;
+  uint32_t worker_messages;
+  uint32_t app_launches;
+} HostStats;
+
+extern HostStats host_stats;
+
+void host_reset(time_t epoch);
+uint64_t host_now_ms(void);
+bool host_run_until(uint64_t until_ms);
+bool host_run_next(void);
+void host_set_outbox_handler(HostOutboxHandler handler, void *context);
+void host_deliver_inbox(uint32_t delay_ms, const uint8_t *data, uint16_t size);
+void host_set_connected(bool connected);
+void host_set_outbox_ack_ms(uint32_t ack_ms);
+// With this ack time nothing is sent back until the tool says how it went
+#define HOST_OUTBOX_ACK_MANUAL UINT32_MAX
+void host_outbox_result(AppMessageResult result);
+// The firmware dropping an inbound message, for whatever reason
+void host_inbox_dropped(AppMessageResult reason);
+void host_persist_clear(void);
+// A timer for the stand-in's own use, kept off the app heap like the firmware's
+AppTimer *host_system_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data);
+// Called whenever nothing more is due at the current time - the watch draws then
+void host_set_idle_handler(void (*handler)(void));
+uint64_t host_clock_ns(void);
+// Hand a message to whatever subscribed with app_worker_message_subscribe()
+void host_worker_message(uint8_t type);
+
+// Drive the event services (pebble_ui.c)
+void host_ui_reset(void);
+void host_tick(TimeUnits units_changed);
+void host_tap(AccelAxisType axis, int32_t direction);
+void host_set_battery(BatteryChargeState charge);
+void host_set_bluetooth(bool connected);
+void host_set_24h_style(bool is_24h);
+
+// Rendering, for measuring overdraw (pebble_ui.c). Off unless a tool turns it on.
+// Pixel writes are counted, not drawn: text counts its whole frame. What an
+// update proc fills with graphics_fill_rect() is drawn for real, into a 1 bit
+// screen laid out like aplite's, leftmost pixel in the least significant bit.
+#define HOST_SCREEN_WIDTH 144
+#define HOST_SCREEN_HEIGHT 168
+#define HOST_RENDER_OFF 0
+#define HOST_RENDER_FULL 1     // Like the watch: any dirty layer redraws the whole window
+#define HOST_RENDER_DAMAGE 2   // Only the box around what changed, for comparison
+
+void host_render_mode(int mode);
+void host_render_flush(void);
+void host_render_reset(void);
+const uint32_t *host_render_heatmap(void); // writes per pixel, row by row
+void host_layer_set_label(Layer *layer, const char *label);
+const char *host_layer_label(const Layer *layer);
+uint32_t host_layer_pixels(const Layer *layer);
+Layer *host_layer_next(Layer *layer); // Depth first through the window's tree, from NULL
+// A context that draws into a bitmap of the tool's own rather than the screen, uncounted
+GContext *host_bitmap_context(GBitmap *bitmap);
+// As gbitmap_create_with_resource(), for a PNG that isn't a resource; file is under HOST_RESOURCE_DIR
+GBitmap *host_bitmap_create_with_png(const char *file);
+
+void *host_malloc(size_t size);
+void host_free(void *ptr);
+
+#endif
@@ -0,0 +1,691 @@
+/*
+ * Host implementation of the SDK stand-in in pebble.h.
+ *
+ * Everything runs on one thread against a virtual clock. Timers and inbound
+ * messages sit in a single queue ordered by due time (then by insertion, so
+ * runs are repeatable) and are fired by host_run_until()/host_run_next().
+ */
+
+#include <pebble.h>
+#include <pebble_worker.h>
+#include <stdarg.h>
+
+HostStats host_stats;
+
+/*
+ * Heap accounting - every object the stub hands out goes through here
+ */
+typedef union {
+  size_t size;
+  long double align;
+} HeapHeader;
+
+void *host_malloc(size_t size) {
+  HeapHeader *header = malloc(sizeof(HeapHeader) + size);
+  if (!header)
+    return NULL;
+  header->size = size;
+  host_stats.heap_current += size;
+  host_stats.heap_allocs++;
+  if (host_stats.heap_current > host_stats.heap_peak)
+    host_stats.heap_peak = host_stats.heap_current;
+  return header + 1;
+}
+
+void host_free(void *ptr) {
+  if (!ptr)
+    return;
+  HeapHeader *header = (HeapHeader *)ptr - 1;
+  host_stats.heap_current -= header->size;
+  free(header);
+}
+
+/*
+ * Logging
+ */
+static int log_level = APP_LOG_LEVEL_WARNING;
+
+void host_log(int level, const char *file, int line, const char *fmt, ...) {
+  if (level > log_level)
+    return;
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "%s:%d: ", file, line);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+uint64_t host_clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Virtual clock
+ */
+static time_t epoch_s;
+static uint64_t now_ms;
+
+uint64_t host_now_ms(void) {
+  return now_ms;
+}
+
+time_t time(time_t *tloc) {
+  time_t t = epoch_s + (time_t)(now_ms / 1000);
+  if (tloc)
+    *tloc = t;
+  return t;
+}
+
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms) {
+  uint16_t ms = now_ms % 1000;
+  time(tloc);
+  if (out_ms)
+    *out_ms = ms;
+  return ms;
+}
+
+/*
+ * Event queue
+ */
+typedef enum {
+  HOST_EVENT_TIMER,
+  HOST_EVENT_INBOX,
+  HOST_EVENT_OUTBOX_RESULT,
+} HostEventType;
+
+typedef struct HostEvent {
+  struct HostEvent *next;
+  HostEventType type;
+  uint64_t due;
+  uint32_t seq;
+  uint32_t id;
+  AppTimerCallback callback;
+  void *data;
+  AppMessageResult result;
+  bool system;
+  uint16_t size;
+  uint8_t payload[];
+} HostEvent;
+
+static HostEvent *queue;
+static void (*idle_handler)(void);
+static uint32_t next_seq;
+static uint32_t next_timer_id;
+
+/*
+ * App timers come out of the app heap. Messages from the phone, send results and
+ * the firmware's own timers don't, so they stay out of the heap figures.
+ */
+static HostEvent *event_alloc(HostEventType type, uint16_t size, bool system) {
+  HostEvent *event = system ? malloc(sizeof(HostEvent) + size) : host_malloc(sizeof(HostEvent) + size);
+  if (!event)
+    return NULL;
+  memset(event, 0, sizeof(HostEvent));
+  event->type = type;
+  event->system = system;
+  event->size = size;
+  return event;
+}
+
+static void event_free(HostEvent *event) {
+  if (event && event->system)
+    free(event);
+  else
+    host_free(event);
+}
+
+static void queue_insert(HostEvent *event) {
+  event->seq = next_seq++;
+  HostEvent **link = &queue;
+  while (*link && (*link)->due <= event->due)
+    link = &(*link)->next;
+  event->next = *link;
+  *link = event;
+}
+
+static HostEvent *queue_remove_timer(uint32_t id) {
+  for (HostEvent **link = &queue; *link; link = &(*link)->next) {
+    if ((*link)->type == HOST_EVENT_TIMER && (*link)->id == id) {
+      HostEvent *event = *link;
+      *link = event->next;
+      return event;
+    }
+  }
+  return NULL;
+}
+
+static void queue_clear(void) {
+  while (queue) {
+    HostEvent *event = queue;
+    queue = event->next;
+    event_free(event);
+  }
+}
+
+/*
+ * Timers - handles are ids, so a stale handle can never cancel someone else's timer
+ */
+static AppTimer *timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data, bool system) {
+  HostEvent *event = event_alloc(HOST_EVENT_TIMER, 0, system);
+  if (!event)
+    return NULL;
+  event->due = now_ms + timeout_ms;
+  event->id = ++next_timer_id;
+  event->callback = callback;
+  event->data = callback_data;
+  queue_insert(event);
+  return (AppTimer *)(uintptr_t)event->id;
+}
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+  return timer_register(timeout_ms, callback, callback_data, false);
+}
+
+AppTimer *host_system_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+  return timer_register(timeout_ms, callback, callback_data, true);
+}
+
+bool app_timer_reschedule(AppTimer *timer, uint32_t new_timeout_ms) {
+  HostEvent *event = queue_remove_timer((uint32_t)(uintptr_t)timer);
+  if (!event)
+    return false;
+  event->due = now_ms + new_timeout_ms;
+  queue_insert(event);
+  return true;
+}
+
+void app_timer_cancel(AppTimer *timer) {
+  event_free(queue_remove_timer((uint32_t)(uintptr_t)timer));
+}
+
+/*
+ * Dictionary
+ */
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...) {
+  va_list args;
+  uint32_t size = sizeof(Dictionary);
+  va_start(args, tuple_count);
+  for (int i = 0; i < tuple_count; i++)
+    size += TUPLE_HEADER_SIZE + va_arg(args, uint32_t);
+  va_end(args);
+  return size;
+}
+
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t *const buffer, const uint16_t size) {
+  if (!iter || !buffer || size < sizeof(Dictionary))
+    return DICT_INVALID_ARGS;
+  iter->dictionary = (Dictionary *)buffer;
+  iter->dictionary->count = 0;
+  iter->cursor = iter->dictionary->head;
+  iter->end = buffer + size;
+  return DICT_OK;
+}
+
+static DictionaryResult dict_write_tuple(DictionaryIterator *iter, uint32_t key, TupleType type, const void *data, uint16_t size) {
+  if (!iter || !iter->cursor)
+    return DICT_INVALID_ARGS;
+  uint8_t *cursor = (uint8_t *)iter->cursor;
+  if (cursor + TUPLE_HEADER_SIZE + size > (const uint8_t *)iter->end)
+    return DICT_NOT_ENOUGH_STORAGE;
+  Tuple *tuple = iter->cursor;
+  tuple->key = key;
+  tuple->type = type;
+  tuple->length = size;
+  memcpy(tuple->value->data, data, size);
+  iter->cursor = (Tuple *)(cursor + TUPLE_HEADER_SIZE + size);
+  iter->dictionary->count++;
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t *const data, const uint16_t size) {
+  return dict_write_tuple(iter, key, TUPLE_BYTE_ARRAY, data, size);
+}
+
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char *const cstring) {
+  return dict_write_tuple(iter, key, TUPLE_CSTRING, cstring, cstring ? strlen(cstring) + 1 : 0);
+}
+
+DictionaryResult dict_write_int8(DictionaryIterator *iter, const uint32_t key, const int8_t value) {
+  return dict_write_tuple(iter, key, TUPLE_INT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, const uint32_t key, const uint8_t value) {
+  return dict_write_tuple(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_int16(DictionaryIterator *iter, const uint32_t key, const int16_t value) {
+  return dict_write_tuple(iter, key, TUPLE_INT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, const uint32_t key, const uint16_t value) {
+  return dict_write_tuple(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value) {
+  return dict_write_tuple(iter, key, TUPLE_INT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value) {
+  return dict_write_tuple(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+uint32_t dict_write_end(DictionaryIterator *iter) {
+  if (!iter || !iter->cursor)
+    return 0;
+  uint32_t size = (uint8_t *)iter->cursor - (uint8_t *)iter->dictionary;
+  iter->end = iter->cursor;
+  iter->cursor = iter->dictionary->head;
+  return size;
+}
+
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t *const buffer, const uint16_t size) {
+  if (!iter || !buffer || size < sizeof(Dictionary))
+    return NULL;
+  iter->dictionary = (Dictionary *)buffer;
+  iter->end = buffer + size;
+  return dict_read_first(iter);
+}
+
+static bool tuple_fits(const DictionaryIterator *iter, const Tuple *tuple) {
+  const uint8_t *p = (const uint8_t *)tuple;
+  return p + TUPLE_HEADER_SIZE <= (const uint8_t *)iter->end &&
+         p + TUPLE_HEADER_SIZE + tuple->length <= (const uint8_t *)iter->end;
+}
+
+Tuple *dict_read_first(DictionaryIterator *iter) {
+  iter->cursor = iter->dictionary->head;
+  if (iter->dictionary->count == 0 || !tuple_fits(iter, iter->cursor))
+    return NULL;
+  return iter->cursor;
+}
+
+Tuple *dict_read_next(DictionaryIterator *iter) {
+  Tuple *next = (Tuple *)((uint8_t *)iter->cursor + TUPLE_HEADER_SIZE + iter->cursor->length);
+  if (!tuple_fits(iter, next))
+    return NULL;
+  iter->cursor = next;
+  return next;
+}
+
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key) {
+  DictionaryIterator it = *iter;
+  for (Tuple *tuple = dict_read_first(&it); tuple; tuple = dict_read_next(&it)) {
+    if (tuple->key == key)
+      return tuple;
+  }
+  return NULL;
+}
+
+/*
+ * AppMessage
+ */
+static uint32_t inbox_size;
+static uint32_t outbox_size;
+static uint8_t *outbox_buffer;
+static DictionaryIterator outbox_iter;
+static bool outbox_pending;
+static bool outbox_open;
+static bool connected = true;
+static uint32_t outbox_ack_ms;
+
+static AppMessageInboxReceived inbox_received;
+static AppMessageInboxDropped inbox_dropped;
+static AppMessageOutboxSent outbox_sent;
+static AppMessageOutboxFailed outbox_failed;
+static HostOutboxHandler outbox_handler;
+static void *outbox_context;
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound) {
+  host_free(outbox_buffer);
+  inbox_size = size_inbound;
+  outbox_size = size_outbound;
+  outbox_buffer = host_malloc(size_outbound);
+  outbox_pending = false;
+  outbox_open = false;
+  return outbox_buffer ? APP_MSG_OK : APP_MSG_OUT_OF_MEMORY;
+}
+
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback) {
+  AppMessageInboxReceived previous = inbox_received;
+  inbox_received = received_callback;
+  return previous;
+}
+
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback) {
+  AppMessageInboxDropped previous = inbox_dropped;
+  inbox_dropped = dropped_callback;
+  return previous;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback) {
+  AppMessageOutboxSent previous = outbox_sent;
+  outbox_sent = sent_callback;
+  return previous;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback) {
+  AppMessageOutboxFailed previous = outbox_failed;
+  outbox_failed = failed_callback;
+  return previous;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator) {
+  *iterator = NULL;
+  if (!outbox_buffer)
+    return APP_MSG_INVALID_ARGS;
+  if (outbox_pending || outbox_open)
+    return APP_MSG_BUSY;
+  dict_write_begin(&outbox_iter, outbox_buffer, outbox_size);
+  outbox_open = true;
+  *iterator = &outbox_iter;
+  return APP_MSG_OK;
+}
+
+AppMessageResult app_message_outbox_send(void) {
+  if (!outbox_open)
+    return APP_MSG_INVALID_ARGS;
+  uint16_t size = dict_write_end(&outbox_iter);
+  outbox_open = false;
+  outbox_pending = true;
+  host_stats.outbox_sent++;
+
+  AppMessageResult result = APP_MSG_NOT_CONNECTED;
+  if (connected)
+    result = outbox_handler ? outbox_handler(outbox_buffer, size, outbox_context) : APP_MSG_OK;
+
+  if (outbox_ack_ms == HOST_OUTBOX_ACK_MANUAL)
+    return APP_MSG_OK;
+  HostEvent *event = event_alloc(HOST_EVENT_OUTBOX_RESULT, 0, true);
+  event->due = now_ms + outbox_ack_ms;
+  event->result = result;
+  queue_insert(event);
+  return APP_MSG_OK;
+}
+
+uint32_t app_message_inbox_size_maximum(void) {
+  return 656;
+}
+
+uint32_t app_message_outbox_size_maximum(void) {
+  return 656;
+}
+
+static void deliver_inbox(HostEvent *event) {
+  if (!connected || event->size > inbox_size) {
+    host_stats.inbox_dropped++;
+    if (inbox_dropped)
+      inbox_dropped(connected ? APP_MSG_BUFFER_OVERFLOW : APP_MSG_NOT_CONNECTED, NULL);
+    return;
+  }
+  host_stats.inbox_delivered++;
+  if (!inbox_received)
+    return;
+  DictionaryIterator iter;
+  if (!dict_read_begin_from_buffer(&iter, event->payload, event->size))
+    return;
+  uint64_t start = host_clock_ns();
+  inbox_received(&iter, NULL);
+  host_stats.inbox_handler_ns += host_clock_ns() - start;
+}
+
+static void deliver_outbox_result(HostEvent *event) {
+  host_outbox_result(event->result);
+}
+
+void host_outbox_result(AppMessageResult result) {
+  if (!outbox_pending)
+    return;
+  outbox_pending = false;
+  DictionaryIterator iter;
+  dict_read_begin_from_buffer(&iter, outbox_buffer, outbox_size);
+  if (result == APP_MSG_OK) {
+    if (outbox_sent)
+      outbox_sent(&iter, NULL);
+  } else if (outbox_failed) {
+    outbox_failed(&iter, result, NULL);
+  }
+}
+
+void host_inbox_dropped(AppMessageResult reason) {
+  host_stats.inbox_dropped++;
+  if (inbox_dropped)
+    inbox_dropped(reason, NULL);
+}
+
+/*
+ * Persistent storage. Unlike everything else it is kept across host_reset(),
+ * the way the watch keeps it across app launches; host_persist_clear() wipes it.
+ */
+#define HOST_PERSIST_SLOTS 32
+
+typedef struct {
+  bool used;
+  uint32_t key;
+  uint16_t size;
+  uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} PersistSlot;
+
+static PersistSlot persist_slots[HOST_PERSIST_SLOTS];
+
+static PersistSlot *persist_find(uint32_t key) {
+  for (int i = 0; i < HOST_PERSIST_SLOTS; i++) {
+    if (persist_slots[i].used && persist_slots[i].key == key)
+      return &persist_slots[i];
+  }
+  return NULL;
+}
+
+bool persist_exists(const uint32_t key) {
+  return persist_find(key) != NULL;
+}
+
+int32_t persist_read_int(const uint32_t key) {
+  int32_t value = 0;
+  persist_read_data(key, &value, sizeof(value));
+  return value;
+}
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size) {
+  PersistSlot *slot = persist_find(key);
+  if (!slot)
+    return E_DOES_NOT_EXIST;
+  size_t size = slot->size < buffer_size ? slot->size : buffer_size;
+  memcpy(buffer, slot->data, size);
+  return size;
+}
+
+int persist_write_data(const uint32_t key, const void *data, const size_t size) {
+  if (size > PERSIST_DATA_MAX_LENGTH)
+    return E_INVALID_ARGUMENT;
+  PersistSlot *slot = persist_find(key);
+  for (int i = 0; !slot && i < HOST_PERSIST_SLOTS; i++) {
+    if (!persist_slots[i].used)
+      slot = &persist_slots[i];
+  }
+  if (!slot)
+    return E_OUT_OF_STORAGE;
+  slot->used = true;
+  slot->key = key;
+  slot->size = size;
+  memcpy(slot->data, data, size);
+  host_stats.persist_writes++;
+  host_stats.persist_bytes_written += size;
+  return size;
+}
+
+status_t persist_write_int(const uint32_t key, const int32_t value) {
+  int written = persist_write_data(key, &value, sizeof(value));
+  return written < 0 ? written : S_SUCCESS;
+}
+
+status_t persist_delete(const uint32_t key) {
+  PersistSlot *slot = persist_find(key);
+  if (!slot)
+    return E_DOES_NOT_EXIST;
+  slot->used = false;
+  return S_SUCCESS;
+}
+
+void host_persist_clear(void) {
+  memset(persist_slots, 0, sizeof(persist_slots));
+}
+
+/*
+ * Vibes and light
+ */
+void vibes_short_pulse(void) {
+  host_stats.vibes++;
+}
+
+void vibes_long_pulse(void) {
+  host_stats.vibes++;
+}
+
+void vibes_double_pulse(void) {
+  host_stats.vibes++;
+}
+
+void light_enable_interaction(void) {
+  host_stats.lights++;
+}
+
+/*
+ * Background worker. The app and its worker are separate programs on the
+ * watch; here a tool builds one or the other, so messages sent go nowhere
+ * and host_worker_message() plays the other side.
+ */
+static bool worker_running;
+static AppWorkerMessageHandler worker_message_handler;
+
+AppWorkerResult app_worker_launch(void) {
+  if (worker_running)
+    return APP_WORKER_RESULT_ALREADY_RUNNING;
+  worker_running = true;
+  return APP_WORKER_RESULT_SUCCESS;
+}
+
+AppWorkerResult app_worker_kill(void) {
+  if (!worker_running)
+    return APP_WORKER_RESULT_NOT_RUNNING;
+  worker_running = false;
+  return APP_WORKER_RESULT_SUCCESS;
+}
+
+bool app_worker_is_running(void) {
+  return worker_running;
+}
+
+bool app_worker_message_subscribe(AppWorkerMessageHandler handler) {
+  worker_message_handler = handler;
+  return true;
+}
+
+bool app_worker_message_unsubscribe(void) {
+  worker_message_handler = NULL;
+  return true;
+}
+
+void app_worker_send_message(uint8_t type, AppWorkerMessage *data) {
+  host_stats.worker_messages++;
+}
+
+void worker_launch_app(void) {
+  host_stats.app_launches++;
+}
+
+void worker_event_loop(void) {
+}
+
+/*
+ * Host-side controls
+ */
+void host_reset(time_t epoch) {
+  queue_clear();
+  host_free(outbox_buffer);
+  outbox_buffer = NULL;
+  outbox_pending = false;
+  outbox_open = false;
+  connected = true;
+  outbox_ack_ms = 0;
+  inbox_received = NULL;
+  inbox_dropped = NULL;
+  outbox_sent = NULL;
+  outbox_failed = NULL;
+  outbox_handler = NULL;
+  outbox_context = NULL;
+  epoch_s = epoch;
+  now_ms = 0;
+  next_seq = 0;
+  worker_running = false;
+  worker_message_handler = NULL;
+  memset(&host_stats, 0, sizeof(host_stats));
+}
+
+void host_set_outbox_handler(HostOutboxHandler handler, void *context) {
+  outbox_handler = handler;
+  outbox_context = context;
+}
+
+void host_set_outbox_ack_ms(uint32_t ack_ms) {
+  outbox_ack_ms = ack_ms;
+}
+
+void host_set_connected(bool is_connected) {
+  connected = is_connected;
+}
+
+void host_set_idle_handler(void (*handler)(void)) {
+  idle_handler = handler;
+}
+
+void host_worker_message(uint8_t type) {
+  AppWorkerMessage message = { 0 };
+  if (worker_message_handler)
+    worker_message_handler(type, &message);
+}
+
+void host_deliver_inbox(uint32_t delay_ms, const uint8_t *data, uint16_t size) {
+  HostEvent *event = event_alloc(HOST_EVENT_INBOX, size, true);
+  event->due = now_ms + delay_ms;
+  memcpy(event->payload, data, size);
+  queue_insert(event);
+}
+
+bool host_run_next(void) {
+  HostEvent *event = queue;
+  if (!event)
+    return false;
+  queue = event->next;
+  if (event->due > now_ms)
+    now_ms = event->due;
+
+  switch (event->type) {
+    case HOST_EVENT_TIMER:
+      host_stats.timers_fired++;
+      event->callback(event->data);
+      break;
+    case HOST_EVENT_INBOX:
+      deliver_inbox(event);
+      break;
+    case HOST_EVENT_OUTBOX_RESULT:
+      deliver_outbox_result(event);
+      break;
+  }
+  event_free(event);
+
+  if (idle_handler && (!queue || queue->due > now_ms))
+    idle_handler();
+  return true;
+}
+
+// Fire everything due up to until_ms; false once the queue has run dry
+bool host_run_until(uint64_t until_ms) {
+  while (queue && queue->due <= until_ms)
+    host_run_next();
+  if (now_ms < until_ms)
+    now_ms = until_ms;
+  return queue != NULL;
+}
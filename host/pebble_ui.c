@@ -0,0 +1,903 @@
+/*
+ * Host implementation of the layer, graphics, animation and event service
+ * parts of pebble.h.
+ *
+ * Next to nothing is drawn: layers keep their frames, flags and contents so
+ * tools can inspect them, and animations step their layer's frame along on
+ * the virtual clock, one frame every HOST_ANIMATION_FRAME_MS, like the watch.
+ * Only graphics_fill_rect() draws for real, into a 1 bit screen the window
+ * clears to its background.
+ * Bitmaps are sized from the PNG headers under HOST_RESOURCE_DIR and
+ * allocated at the watch's 1 bit per pixel, so heap figures stay realistic.
+ *
+ * With host_render_mode() on, the layer tree is walked whenever the event
+ * loop goes idle with something dirty, as the firmware does, and every
+ * pixel each layer would write is counted in a heatmap and against the
+ * layer.
+ */
+
+#include <pebble.h>
+
+#ifndef HOST_RESOURCE_DIR
+#define HOST_RESOURCE_DIR "resources/"
+#endif
+
+#define HOST_ANIMATION_FRAME_MS 33
+
+/*
+ * Resources
+ */
+#define HOST_RESOURCE_FILE(name, file) file,
+static const char *resource_files[] = {
+  NULL,
+  HOST_RESOURCES(HOST_RESOURCE_FILE)
+};
+#undef HOST_RESOURCE_FILE
+
+// Width and height from the IHDR chunk, which always directly follows the signature
+static bool png_size(const char *path, int *width, int *height) {
+  uint8_t header[24];
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  size_t got = fread(header, 1, sizeof(header), f);
+  fclose(f);
+  if (got != sizeof(header) || memcmp(&header[12], "IHDR", 4) != 0)
+    return false;
+  *width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+  *height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+  return true;
+}
+
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id) {
+  if (resource_id == 0 || resource_id >= sizeof(resource_files) / sizeof(resource_files[0]))
+    return NULL;
+  return host_bitmap_create_with_png(resource_files[resource_id]);
+}
+
+GBitmap *host_bitmap_create_with_png(const char *file) {
+  char path[256];
+  int width = 0;
+  int height = 0;
+  snprintf(path, sizeof(path), "%s%s", HOST_RESOURCE_DIR, file);
+  if (!png_size(path, &width, &height))
+    APP_LOG(APP_LOG_LEVEL_WARNING, "no resource at %s", path);
+
+  GBitmap *bitmap = host_malloc(sizeof(GBitmap));
+  if (!bitmap)
+    return NULL;
+  bitmap->row_size_bytes = ((width + 31) / 32) * 4;
+  bitmap->info_flags = 0;
+  bitmap->bounds = GRect(0, 0, width, height);
+  bitmap->addr = host_malloc(bitmap->row_size_bytes * height);
+  if (bitmap->addr)
+    memset(bitmap->addr, 0, bitmap->row_size_bytes * height);
+  return bitmap;
+}
+
+void gbitmap_destroy(GBitmap *bitmap) {
+  if (!bitmap)
+    return;
+  host_free(bitmap->addr);
+  host_free(bitmap);
+}
+
+// A handle is just the resource id; the file is read again on each load
+ResHandle resource_get_handle(uint32_t resource_id) {
+  if (resource_id == 0 || resource_id >= sizeof(resource_files) / sizeof(resource_files[0]))
+    return NULL;
+  return (ResHandle)(uintptr_t)resource_id;
+}
+
+static FILE *resource_open(ResHandle handle) {
+  if (!handle)
+    return NULL;
+  char path[256];
+  snprintf(path, sizeof(path), "%s%s", HOST_RESOURCE_DIR, resource_files[(uintptr_t)handle]);
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    APP_LOG(APP_LOG_LEVEL_WARNING, "no resource at %s", path);
+  return f;
+}
+
+size_t resource_size(ResHandle handle) {
+  FILE *f = resource_open(handle);
+  if (!f)
+    return 0;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  return size > 0 ? (size_t)size : 0;
+}
+
+size_t resource_load(ResHandle handle, uint8_t *buffer, size_t max_length) {
+  FILE *f = resource_open(handle);
+  if (!f)
+    return 0;
+  size_t got = fread(buffer, 1, max_length, f);
+  fclose(f);
+  return got;
+}
+
+GFont fonts_get_system_font(const char *font_key) {
+  return (GFont)font_key;
+}
+
+struct GContext {
+  GCompOp compositing_mode;
+  GColor fill_color;
+  Layer *layer;      // Being drawn, and charged for what it writes
+  GPoint origin;     // Of its bounds, on screen
+  GRect clip;
+  GBitmap *target;   // NULL for the screen
+};
+
+static void render_touch(Layer *layer, GRect rect, GRect clip);
+
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode) {
+  ctx->compositing_mode = mode;
+}
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color) {
+  ctx->fill_color = color;
+}
+
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect) {
+  if (!bitmap)
+    return;
+  rect.origin.x += ctx->origin.x;
+  rect.origin.y += ctx->origin.y;
+  if (rect.size.w > bitmap->bounds.size.w)
+    rect.size.w = bitmap->bounds.size.w;
+  if (rect.size.h > bitmap->bounds.size.h)
+    rect.size.h = bitmap->bounds.size.h;
+  render_touch(ctx->layer, rect, ctx->clip);
+}
+
+/*
+ * Layers
+ */
+#define LAYER_PLAIN 0
+#define LAYER_WINDOW 1
+#define LAYER_BITMAP 2
+#define LAYER_TEXT 3
+
+struct Layer {
+  GRect frame;
+  GRect bounds;
+  bool hidden;
+  bool clips;
+  uint8_t kind; // Fits in what was padding, so heap figures don't move
+  Layer *parent;
+  Layer *first_child;
+  Layer *next_sibling;
+  LayerUpdateProc update_proc;
+};
+
+static void render_damage(Layer *layer);
+static void render_forget(const Layer *layer);
+
+static void layer_init(Layer *layer, GRect frame) {
+  memset(layer, 0, sizeof(Layer));
+  layer->frame = frame;
+  layer->bounds = GRect(0, 0, frame.size.w, frame.size.h);
+  layer->clips = true;
+}
+
+Layer *layer_create(GRect frame) {
+  Layer *layer = host_malloc(sizeof(Layer));
+  if (layer)
+    layer_init(layer, frame);
+  return layer;
+}
+
+void layer_destroy(Layer *layer) {
+  if (!layer)
+    return;
+  render_forget(layer);
+  layer_remove_from_parent(layer);
+  host_free(layer);
+}
+
+void layer_mark_dirty(Layer *layer) {
+  host_stats.layers_dirtied++;
+  render_damage(layer);
+}
+
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) {
+  layer->update_proc = update_proc;
+}
+
+void layer_set_frame(Layer *layer, GRect frame) {
+  render_damage(layer); // Where it was
+  layer->frame = frame;
+  layer->bounds.size = frame.size;
+  layer_mark_dirty(layer);
+}
+
+GRect layer_get_frame(const Layer *layer) {
+  return layer->frame;
+}
+
+void layer_set_bounds(Layer *layer, GRect bounds) {
+  layer->bounds = bounds;
+  layer_mark_dirty(layer);
+}
+
+GRect layer_get_bounds(const Layer *layer) {
+  return layer->bounds;
+}
+
+void layer_add_child(Layer *parent, Layer *child) {
+  layer_remove_from_parent(child);
+  child->parent = parent;
+  Layer **link = &parent->first_child;
+  while (*link)
+    link = &(*link)->next_sibling;
+  *link = child;
+  layer_mark_dirty(parent);
+}
+
+void layer_remove_from_parent(Layer *child) {
+  if (!child || !child->parent)
+    return;
+  for (Layer **link = &child->parent->first_child; *link; link = &(*link)->next_sibling) {
+    if (*link == child) {
+      *link = child->next_sibling;
+      break;
+    }
+  }
+  layer_mark_dirty(child->parent);
+  child->parent = NULL;
+  child->next_sibling = NULL;
+}
+
+void layer_set_hidden(Layer *layer, bool hidden) {
+  if (layer->hidden == hidden)
+    return;
+  if (hidden)
+    render_damage(layer); // What it covered needs drawing again
+  layer->hidden = hidden;
+  layer_mark_dirty(layer);
+}
+
+bool layer_get_hidden(const Layer *layer) {
+  return layer->hidden;
+}
+
+void layer_set_clips(Layer *layer, bool clips) {
+  layer->clips = clips;
+}
+
+bool layer_get_clips(const Layer *layer) {
+  return layer->clips;
+}
+
+/*
+ * Window - a single one, pushed once
+ */
+struct Window {
+  Layer root;
+  GColor background_color;
+};
+
+static Window *top_window;
+
+Window *window_create(void) {
+  Window *window = host_malloc(sizeof(Window));
+  if (!window)
+    return NULL;
+  layer_init(&window->root, GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT));
+  window->root.kind = LAYER_WINDOW;
+  window->background_color = GColorWhite;
+  return window;
+}
+
+void window_destroy(Window *window) {
+  if (window == top_window)
+    top_window = NULL;
+  host_free(window);
+}
+
+void window_stack_push(Window *window, bool animated) {
+  top_window = window;
+  layer_mark_dirty(&window->root);
+}
+
+void window_set_background_color(Window *window, GColor background_color) {
+  window->background_color = background_color;
+}
+
+Layer *window_get_root_layer(const Window *window) {
+  return (Layer *)&window->root;
+}
+
+/*
+ * Bitmap and text layers
+ */
+struct BitmapLayer {
+  Layer layer;
+  const GBitmap *bitmap;
+  GColor background_color;
+  GCompOp compositing_mode;
+};
+
+BitmapLayer *bitmap_layer_create(GRect frame) {
+  BitmapLayer *bitmap_layer = host_malloc(sizeof(BitmapLayer));
+  if (!bitmap_layer)
+    return NULL;
+  layer_init(&bitmap_layer->layer, frame);
+  bitmap_layer->layer.kind = LAYER_BITMAP;
+  bitmap_layer->bitmap = NULL;
+  bitmap_layer->background_color = GColorClear;
+  bitmap_layer->compositing_mode = GCompOpAssign;
+  return bitmap_layer;
+}
+
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer) {
+  if (!bitmap_layer)
+    return;
+  render_forget(&bitmap_layer->layer);
+  layer_remove_from_parent(&bitmap_layer->layer);
+  host_free(bitmap_layer);
+}
+
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer) {
+  return (Layer *)&bitmap_layer->layer;
+}
+
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap) {
+  bitmap_layer->bitmap = bitmap;
+  layer_mark_dirty(&bitmap_layer->layer);
+}
+
+void bitmap_layer_set_background_color(BitmapLayer *bitmap_layer, GColor color) {
+  bitmap_layer->background_color = color;
+  layer_mark_dirty(&bitmap_layer->layer);
+}
+
+void bitmap_layer_set_compositing_mode(BitmapLayer *bitmap_layer, GCompOp mode) {
+  bitmap_layer->compositing_mode = mode;
+  layer_mark_dirty(&bitmap_layer->layer);
+}
+
+struct TextLayer {
+  Layer layer;
+  const char *text;
+  GColor text_color;
+  GColor background_color;
+  GTextAlignment alignment;
+  GFont font;
+};
+
+TextLayer *text_layer_create(GRect frame) {
+  TextLayer *text_layer = host_malloc(sizeof(TextLayer));
+  if (!text_layer)
+    return NULL;
+  memset(text_layer, 0, sizeof(TextLayer));
+  layer_init(&text_layer->layer, frame);
+  text_layer->layer.kind = LAYER_TEXT;
+  text_layer->text_color = GColorBlack;
+  text_layer->background_color = GColorWhite;
+  return text_layer;
+}
+
+void text_layer_destroy(TextLayer *text_layer) {
+  if (!text_layer)
+    return;
+  render_forget(&text_layer->layer);
+  layer_remove_from_parent(&text_layer->layer);
+  host_free(text_layer);
+}
+
+Layer *text_layer_get_layer(TextLayer *text_layer) {
+  return &text_layer->layer;
+}
+
+void text_layer_set_text(TextLayer *text_layer, const char *text) {
+  text_layer->text = text;
+  layer_mark_dirty(&text_layer->layer);
+}
+
+void text_layer_set_text_color(TextLayer *text_layer, GColor color) {
+  text_layer->text_color = color;
+}
+
+void text_layer_set_background_color(TextLayer *text_layer, GColor color) {
+  text_layer->background_color = color;
+}
+
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment) {
+  text_layer->alignment = text_alignment;
+}
+
+void text_layer_set_font(TextLayer *text_layer, GFont font) {
+  text_layer->font = font;
+}
+
+/*
+ * Rendering - what a redraw would write, counted rather than drawn
+ */
+static int render_mode = HOST_RENDER_OFF;
+static bool render_dirty;
+static GRect render_damaged; // Screen box to redraw in HOST_RENDER_DAMAGE mode
+static uint32_t render_heatmap[HOST_SCREEN_WIDTH * HOST_SCREEN_HEIGHT];
+
+// Labels and write counts, kept beside the layers rather than in them
+#define RENDER_MAX_LAYERS 64
+typedef struct {
+  const Layer *layer;
+  const char *label;
+  uint32_t pixels;
+} RenderLayer;
+static RenderLayer render_layers[RENDER_MAX_LAYERS];
+
+static RenderLayer *render_layer_find(const Layer *layer, bool add) {
+  RenderLayer *free_slot = NULL;
+  for (int i = 0; i < RENDER_MAX_LAYERS; i++) {
+    if (render_layers[i].layer == layer)
+      return &render_layers[i];
+    if (!render_layers[i].layer && !free_slot)
+      free_slot = &render_layers[i];
+  }
+  if (add && free_slot)
+    free_slot->layer = layer;
+  return add ? free_slot : NULL;
+}
+
+static void render_forget(const Layer *layer) {
+  RenderLayer *entry = render_layer_find(layer, false);
+  if (entry)
+    memset(entry, 0, sizeof(RenderLayer));
+}
+
+static bool rect_empty(GRect r) {
+  return r.size.w <= 0 || r.size.h <= 0;
+}
+
+static GRect rect_intersect(GRect a, GRect b) {
+  int16_t x0 = a.origin.x > b.origin.x ? a.origin.x : b.origin.x;
+  int16_t y0 = a.origin.y > b.origin.y ? a.origin.y : b.origin.y;
+  int16_t x1 = a.origin.x + a.size.w < b.origin.x + b.size.w ? a.origin.x + a.size.w : b.origin.x + b.size.w;
+  int16_t y1 = a.origin.y + a.size.h < b.origin.y + b.size.h ? a.origin.y + a.size.h : b.origin.y + b.size.h;
+  if (x1 <= x0 || y1 <= y0)
+    return GRectZero;
+  return GRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+static GRect rect_union(GRect a, GRect b) {
+  if (rect_empty(a))
+    return b;
+  if (rect_empty(b))
+    return a;
+  int16_t x0 = a.origin.x < b.origin.x ? a.origin.x : b.origin.x;
+  int16_t y0 = a.origin.y < b.origin.y ? a.origin.y : b.origin.y;
+  int16_t x1 = a.origin.x + a.size.w > b.origin.x + b.size.w ? a.origin.x + a.size.w : b.origin.x + b.size.w;
+  int16_t y1 = a.origin.y + a.size.h > b.origin.y + b.size.h ? a.origin.y + a.size.h : b.origin.y + b.size.h;
+  return GRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+// Where a layer is on screen, and the part of that its clipping parents let it draw in.
+// False if it, or anything above it, is hidden or off the window.
+static bool layer_on_screen(const Layer *layer, GRect *frame, GRect *visible) {
+  if (layer->hidden)
+    return false;
+  if (!layer->parent) {
+    if (!top_window || layer != &top_window->root)
+      return false;
+    *frame = *visible = layer->frame;
+    return true;
+  }
+
+  GRect parent_frame;
+  GRect parent_visible;
+  if (!layer_on_screen(layer->parent, &parent_frame, &parent_visible))
+    return false;
+  *frame = layer->frame;
+  frame->origin.x += parent_frame.origin.x + layer->parent->bounds.origin.x;
+  frame->origin.y += parent_frame.origin.y + layer->parent->bounds.origin.y;
+  *visible = layer->parent->clips ? rect_intersect(*frame, parent_visible) : *frame;
+  return true;
+}
+
+/*
+ * The screen, laid out like aplite's: 1 bit, leftmost pixel in the least
+ * significant bit. graphics_fill_rect() draws into it a byte at a time where
+ * it can, and charges the layer for the area like any other write.
+ */
+#define FRAME_BUFFER_ROW_BYTES 20
+static uint8_t frame_buffer_data[FRAME_BUFFER_ROW_BYTES * HOST_SCREEN_HEIGHT];
+static GBitmap frame_buffer = {
+  frame_buffer_data, FRAME_BUFFER_ROW_BYTES, 0, { { 0, 0 }, { HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT } }
+};
+
+// rect is already inside the bitmap
+static void bitmap_fill(GBitmap *bitmap, GRect rect, GColor color) {
+  int x0 = rect.origin.x;
+  int x1 = rect.origin.x + rect.size.w;
+  int first = x0 >> 3;
+  int last = (x1 - 1) >> 3;
+  uint8_t head = 0xff << (x0 & 7);
+  uint8_t tail = 0xff >> (7 - ((x1 - 1) & 7));
+  uint8_t fill = color == GColorWhite ? 0xff : 0x00;
+
+  for (int y = rect.origin.y; y < rect.origin.y + rect.size.h; y++) {
+    uint8_t *row = (uint8_t *)bitmap->addr + y * bitmap->row_size_bytes;
+    if (first == last) {
+      uint8_t mask = head & tail;
+      row[first] = (row[first] & ~mask) | (fill & mask);
+      continue;
+    }
+    row[first] = (row[first] & ~head) | (fill & head);
+    memset(&row[first + 1], fill, last - first - 1);
+    row[last] = (row[last] & ~tail) | (fill & tail);
+  }
+}
+
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask) {
+  if (ctx->fill_color == GColorClear)
+    return;
+  rect.origin.x += ctx->origin.x;
+  rect.origin.y += ctx->origin.y;
+  rect = rect_intersect(rect, ctx->clip);
+  if (rect_empty(rect))
+    return;
+  if (!ctx->target)
+    render_touch(ctx->layer, rect, ctx->clip);
+  bitmap_fill(ctx->target ? ctx->target : &frame_buffer, rect, ctx->fill_color);
+}
+
+GContext *host_bitmap_context(GBitmap *bitmap) {
+  static GContext context;
+  context = (GContext){ GCompOpAssign, GColorBlack, NULL, GPoint(0, 0), bitmap->bounds, bitmap };
+  return &context;
+}
+
+static void render_damage(Layer *layer) {
+  if (render_mode == HOST_RENDER_OFF)
+    return;
+  render_dirty = true;
+  GRect frame;
+  GRect visible;
+  if (render_mode == HOST_RENDER_DAMAGE && layer_on_screen(layer, &frame, &visible))
+    render_damaged = rect_union(render_damaged, visible);
+}
+
+static void render_touch(Layer *layer, GRect rect, GRect clip) {
+  rect = rect_intersect(rect, clip);
+  if (rect_empty(rect))
+    return;
+  for (int y = rect.origin.y; y < rect.origin.y + rect.size.h; y++) {
+    uint32_t *row = &render_heatmap[y * HOST_SCREEN_WIDTH];
+    for (int x = rect.origin.x; x < rect.origin.x + rect.size.w; x++)
+      row[x]++;
+  }
+  uint32_t area = rect.size.w * rect.size.h;
+  RenderLayer *entry = render_layer_find(layer, true);
+  if (entry)
+    entry->pixels += area;
+  host_stats.pixels_written += area;
+}
+
+// origin is the parent's bounds on screen; clip is what the parent lets it draw in
+static void render_layer(Layer *layer, GPoint origin, GRect clip) {
+  if (layer->hidden)
+    return;
+
+  GRect frame = layer->frame;
+  frame.origin.x += origin.x;
+  frame.origin.y += origin.y;
+  GRect inside = rect_intersect(frame, clip);
+  GPoint bounds_origin = GPoint(frame.origin.x + layer->bounds.origin.x, frame.origin.y + layer->bounds.origin.y);
+
+  switch (layer->kind) {
+    case LAYER_WINDOW:
+      render_touch(layer, frame, inside);
+      if (!rect_empty(inside) && ((Window *)layer)->background_color != GColorClear)
+        bitmap_fill(&frame_buffer, inside, ((Window *)layer)->background_color);
+      break;
+    case LAYER_BITMAP: {
+      BitmapLayer *bitmap_layer = (BitmapLayer *)layer;
+      if (bitmap_layer->background_color != GColorClear)
+        render_touch(layer, frame, inside);
+      if (bitmap_layer->bitmap)
+        render_touch(layer, (GRect){ bounds_origin, bitmap_layer->bitmap->bounds.size }, inside);
+      break;
+    }
+    case LAYER_TEXT: {
+      TextLayer *text_layer = (TextLayer *)layer;
+      if (text_layer->background_color != GColorClear)
+        render_touch(layer, frame, inside);
+      if (text_layer->text && text_layer->text[0])
+        render_touch(layer, frame, inside); // Glyphs aren't laid out, so the whole frame
+      break;
+    }
+    case LAYER_PLAIN:
+      break;
+  }
+
+  if (layer->update_proc) {
+    GContext ctx = { GCompOpAssign, GColorBlack, layer, bounds_origin, inside, NULL };
+    layer->update_proc(layer, &ctx);
+  }
+
+  GRect child_clip = layer->clips ? inside : clip;
+  for (Layer *child = layer->first_child; child; child = child->next_sibling)
+    render_layer(child, bounds_origin, child_clip);
+}
+
+void host_render_flush(void) {
+  if (render_mode == HOST_RENDER_OFF || !render_dirty || !top_window)
+    return;
+
+  GRect clip = GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT);
+  if (render_mode == HOST_RENDER_DAMAGE)
+    clip = rect_intersect(clip, render_damaged);
+  render_dirty = false;
+  render_damaged = GRectZero;
+  if (rect_empty(clip))
+    return;
+
+  host_stats.frames_rendered++;
+  render_layer(&top_window->root, GPoint(0, 0), clip);
+}
+
+void host_render_mode(int mode) {
+  render_mode = mode;
+  memset(frame_buffer_data, 0, sizeof(frame_buffer_data));
+  host_set_idle_handler(mode == HOST_RENDER_OFF ? NULL : host_render_flush);
+  render_dirty = true;
+  render_damaged = GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT);
+}
+
+void host_render_reset(void) {
+  memset(render_heatmap, 0, sizeof(render_heatmap));
+  for (int i = 0; i < RENDER_MAX_LAYERS; i++)
+    render_layers[i].pixels = 0;
+}
+
+const uint32_t *host_render_heatmap(void) {
+  return render_heatmap;
+}
+
+void host_layer_set_label(Layer *layer, const char *label) {
+  RenderLayer *entry = render_layer_find(layer, true);
+  if (entry)
+    entry->label = label;
+}
+
+const char *host_layer_label(const Layer *layer) {
+  RenderLayer *entry = render_layer_find(layer, false);
+  return entry ? entry->label : NULL;
+}
+
+uint32_t host_layer_pixels(const Layer *layer) {
+  RenderLayer *entry = render_layer_find(layer, false);
+  return entry ? entry->pixels : 0;
+}
+
+Layer *host_layer_next(Layer *layer) {
+  if (!layer)
+    return top_window ? &top_window->root : NULL;
+  if (layer->first_child)
+    return layer->first_child;
+  for (; layer; layer = layer->parent) {
+    if (layer->next_sibling)
+      return layer->next_sibling;
+  }
+  return NULL;
+}
+
+/*
+ * Animations
+ */
+void animation_set_duration(Animation *animation, uint32_t duration_ms) {
+  animation->duration_ms = duration_ms;
+}
+
+void animation_set_delay(Animation *animation, uint32_t delay_ms) {
+  animation->delay_ms = delay_ms;
+}
+
+void animation_set_curve(Animation *animation, AnimationCurve curve) {
+  animation->curve = curve;
+}
+
+void animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context) {
+  animation->handlers = callbacks;
+  animation->context = context;
+}
+
+bool animation_is_scheduled(Animation *animation) {
+  return animation && animation->scheduled;
+}
+
+static int16_t interpolate(int16_t from, int16_t to, uint32_t elapsed, uint32_t duration) {
+  return from + (int32_t)(to - from) * (int32_t)elapsed / (int32_t)duration;
+}
+
+static void animation_frame(void *data) {
+  PropertyAnimation *property_animation = data;
+  Animation *animation = &property_animation->animation;
+  animation->timer = NULL;
+
+  uint64_t elapsed = host_now_ms() - animation->started_ms;
+  bool finished = elapsed >= animation->duration_ms;
+  GRect from = property_animation->values.from.grect;
+  GRect to = property_animation->values.to.grect;
+  GRect frame = to;
+  if (!finished) {
+    frame.origin.x = interpolate(from.origin.x, to.origin.x, elapsed, animation->duration_ms);
+    frame.origin.y = interpolate(from.origin.y, to.origin.y, elapsed, animation->duration_ms);
+    frame.size.w = interpolate(from.size.w, to.size.w, elapsed, animation->duration_ms);
+    frame.size.h = interpolate(from.size.h, to.size.h, elapsed, animation->duration_ms);
+  }
+  layer_set_frame(property_animation->subject, frame);
+  host_stats.animation_frames++;
+
+  if (!finished) {
+    animation->timer = host_system_timer_register(HOST_ANIMATION_FRAME_MS, animation_frame, property_animation);
+    return;
+  }
+
+  // The stopped handler may destroy the animation, so nothing touches it afterwards
+  animation->scheduled = false;
+  if (animation->handlers.stopped)
+    animation->handlers.stopped(animation, true, animation->context);
+}
+
+static void animation_start(void *data) {
+  PropertyAnimation *property_animation = data;
+  Animation *animation = &property_animation->animation;
+  animation->started_ms = host_now_ms();
+  if (animation->handlers.started)
+    animation->handlers.started(animation, animation->context);
+  animation_frame(property_animation);
+}
+
+void animation_schedule(Animation *animation) {
+  if (animation->scheduled)
+    animation_unschedule(animation);
+  animation->scheduled = true;
+  host_stats.animations_scheduled++;
+  animation->timer = host_system_timer_register(animation->delay_ms, animation_start, animation);
+}
+
+void animation_unschedule(Animation *animation) {
+  if (!animation->scheduled)
+    return;
+  if (animation->timer)
+    app_timer_cancel(animation->timer);
+  animation->timer = NULL;
+  animation->scheduled = false;
+  if (animation->handlers.stopped)
+    animation->handlers.stopped(animation, false, animation->context);
+}
+
+PropertyAnimation *property_animation_create_layer_frame(Layer *layer, GRect *from_frame, GRect *to_frame) {
+  PropertyAnimation *property_animation = host_malloc(sizeof(PropertyAnimation));
+  if (!property_animation)
+    return NULL;
+  memset(property_animation, 0, sizeof(PropertyAnimation));
+  property_animation->animation.duration_ms = 250;
+  property_animation->subject = layer;
+  property_animation->values.from.grect = from_frame ? *from_frame : layer->frame;
+  property_animation->values.to.grect = to_frame ? *to_frame : layer->frame;
+  return property_animation;
+}
+
+void property_animation_destroy(PropertyAnimation *property_animation) {
+  if (!property_animation)
+    return;
+  if (property_animation->animation.timer)
+    app_timer_cancel(property_animation->animation.timer);
+  host_free(property_animation);
+}
+
+/*
+ * Event services
+ */
+static TickHandler tick_handler;
+static AccelTapHandler tap_handler;
+static BluetoothConnectionHandler bluetooth_handler;
+static BatteryStateHandler battery_handler;
+static BatteryChargeState battery_state = { 100, false, false };
+static bool bluetooth_connected = true;
+static bool is_24h_style = true;
+
+void tick_timer_service_subscribe(TimeUnits tick_units, TickHandler handler) {
+  tick_handler = handler;
+}
+
+void tick_timer_service_unsubscribe(void) {
+  tick_handler = NULL;
+}
+
+void accel_tap_service_subscribe(AccelTapHandler handler) {
+  tap_handler = handler;
+}
+
+void accel_tap_service_unsubscribe(void) {
+  tap_handler = NULL;
+}
+
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler) {
+  bluetooth_handler = handler;
+}
+
+void bluetooth_connection_service_unsubscribe(void) {
+  bluetooth_handler = NULL;
+}
+
+bool bluetooth_connection_service_peek(void) {
+  return bluetooth_connected;
+}
+
+void battery_state_service_subscribe(BatteryStateHandler handler) {
+  battery_handler = handler;
+}
+
+void battery_state_service_unsubscribe(void) {
+  battery_handler = NULL;
+}
+
+BatteryChargeState battery_state_service_peek(void) {
+  return battery_state;
+}
+
+bool clock_is_24h_style(void) {
+  return is_24h_style;
+}
+
+// Tools drive the virtual clock themselves
+void app_event_loop(void) {
+}
+
+/*
+ * Host-side controls
+ */
+void host_ui_reset(void) {
+  tick_handler = NULL;
+  tap_handler = NULL;
+  bluetooth_handler = NULL;
+  battery_handler = NULL;
+  battery_state = (BatteryChargeState){ 100, false, false };
+  bluetooth_connected = true;
+  is_24h_style = true;
+  top_window = NULL;
+  host_render_mode(HOST_RENDER_OFF);
+  memset(render_layers, 0, sizeof(render_layers));
+}
+
+void host_tick(TimeUnits units_changed) {
+  if (!tick_handler)
+    return;
+  time_t now = time(NULL);
+  tick_handler(localtime(&now), units_changed);
+  host_render_flush();
+}
+
+void host_tap(AccelAxisType axis, int32_t direction) {
+  if (tap_handler)
+    tap_handler(axis, direction);
+  host_render_flush();
+}
+
+void host_set_battery(BatteryChargeState charge) {
+  battery_state = charge;
+  if (battery_handler)
+    battery_handler(charge);
+  host_render_flush();
+}
+
+void host_set_bluetooth(bool connected) {
+  bluetooth_connected = connected;
+  host_set_connected(connected);
+  if (bluetooth_handler)
+    bluetooth_handler(connected);
+  host_render_flush();
+}
+
+void host_set_24h_style(bool is_24h) {
+  is_24h_style = is_24h;
+}
@@ -0,0 +1,14 @@
+#ifndef host_pebble_worker_h
+#define host_pebble_worker_h
+
+/*
+ * Host stand-in for the worker SDK header. A worker sees much the same API
+ * as an app less the UI and AppMessage; here it simply gets all of pebble.h.
+ */
+
+#include "pebble.h"
+
+void worker_event_loop(void);
+void worker_launch_app(void);
+
+#endif
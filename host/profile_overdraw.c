@@ -0,0 +1,271 @@
+/*
+ * Overdraw profiler - how many pixels each kind of screen update costs.
+ *
+ *   cc -O2 -Wall -std=gnu99 -Ihost -Isrc host/pebble_host.c host/pebble_ui.c src/calendar.c src/outbox.c src/trace.c src/recorder.c src/bluetooth.c src/power.c src/digits.c host/profile_overdraw.c -o profile_overdraw
+ *   ./profile_overdraw [-m full|damage] [-o dir]
+ *
+ * Plays a fixed evening through the watchface: startup, an ordinary minute,
+ * the top of the hour (all four digits slide), the status screen opening
+ * and closing, a two digit change, a calendar reply and midnight. Each is
+ * rendered under both of the host renderer's strategies:
+ *
+ *   full    any dirty layer redraws the whole window, as the firmware does
+ *   damage  only the box around the layers that changed
+ *
+ * and printed as one CSV row: frames drawn, pixel writes (overdraw
+ * included), distinct pixels touched and the ratio of the two. With -o,
+ * each row also gets a heatmap, <mode>_<event>.pgm (brightest = most
+ * writes), and dir/layers.csv splits its writes by layer.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define main revolution_main
+#include "Revolution.c"
+#undef main
+
+#define PROFILE_START 1402948710 // 2014-06-16 19:58:30 UTC
+#define REPLY_LATENCY_MS 2000
+#define SETTLE_MS 1000           // Long enough for a slide out and in
+
+static const char *output_dir;
+static FILE *layers_csv;
+static const char *mode_name;
+static time_t last_tick;
+static uint32_t frames_before;
+static uint64_t pixels_before;
+
+static uint64_t at(time_t t) {
+  return (uint64_t)(t - PROFILE_START) * 1000;
+}
+
+static void tick(time_t t) {
+  host_run_until(at(t));
+  struct tm before = *localtime(&last_tick);
+  struct tm now = *localtime(&t);
+  TimeUnits units = MINUTE_UNIT;
+  if (now.tm_hour != before.tm_hour)
+    units |= HOUR_UNIT;
+  if (now.tm_mday != before.tm_mday)
+    units |= DAY_UNIT;
+  host_tick(units);
+  last_tick = t;
+}
+
+// Tick unmeasured through every minute before t, so the watch is where it would be
+static void ticks_before(time_t t) {
+  for (time_t minute = last_tick + 60; minute < t; minute += 60) {
+    tick(minute);
+    host_run_until(at(minute) + SETTLE_MS);
+  }
+}
+
+static void begin(void) {
+  host_render_reset();
+  frames_before = host_stats.frames_rendered;
+  pixels_before = host_stats.pixels_written;
+}
+
+static void write_heatmap(const char *event, const uint32_t *heatmap, uint32_t max) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s_%s.pgm", output_dir, mode_name, event);
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return;
+  }
+  fprintf(f, "P5\n# %s %s, brightest = %u writes\n%d %d\n255\n", mode_name, event, max,
+          HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT);
+  for (int i = 0; i < HOST_SCREEN_WIDTH * HOST_SCREEN_HEIGHT; i++)
+    fputc(max ? (int)((uint64_t)heatmap[i] * 255 / max) : 0, f);
+  fclose(f);
+}
+
+static void end(const char *event) {
+  const uint32_t *heatmap = host_render_heatmap();
+  uint32_t touched = 0;
+  uint32_t max = 0;
+  for (int i = 0; i < HOST_SCREEN_WIDTH * HOST_SCREEN_HEIGHT; i++) {
+    if (heatmap[i])
+      touched++;
+    if (heatmap[i] > max)
+      max = heatmap[i];
+  }
+  uint64_t written = host_stats.pixels_written - pixels_before;
+  printf("%s,%s,%u,%llu,%u,%.2f,%.1f\n", mode_name, event, host_stats.frames_rendered - frames_before,
+         (unsigned long long)written, touched, touched ? (double)written / touched : 0.0,
+         100.0 * touched / (HOST_SCREEN_WIDTH * HOST_SCREEN_HEIGHT));
+
+  if (!output_dir)
+    return;
+  write_heatmap(event, heatmap, max);
+  for (Layer *layer = host_layer_next(NULL); layer; layer = host_layer_next(layer)) {
+    if (host_layer_pixels(layer))
+      fprintf(layers_csv, "%s,%s,%s,%u\n", mode_name, event,
+              host_layer_label(layer) ? host_layer_label(layer) : "unlabelled", host_layer_pixels(layer));
+  }
+}
+
+static void label_layers(void) {
+  static const char *time_labels[NUMBER_OF_TIME_SLOTS] = { "time_digit_0", "time_digit_1", "time_digit_2", "time_digit_3" };
+  static const char *date_labels[NUMBER_OF_DATE_SLOTS] = { "date_digit_0", "date_digit_1", "date_digit_2", "date_digit_3" };
+
+  host_layer_set_label(window_get_root_layer(window), "window");
+  host_layer_set_label(time_layer, "time");
+  for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++)
+    host_layer_set_label(time_slots[i].layer, time_labels[i]);
+  host_layer_set_label(footer_layer, "footer");
+  host_layer_set_label(day_item.layer, "day");
+  host_layer_set_label(date_layer, "date");
+  for (int i = 0; i < NUMBER_OF_DATE_SLOTS; i++)
+    host_layer_set_label(bitmap_layer_get_layer(date_slots[i].image_layer), date_labels[i]);
+  host_layer_set_label(seconds_layer, "seconds");
+  host_layer_set_label(text_layer_get_layer(small_time_layer), "small_time");
+  host_layer_set_label(text_layer_get_layer(week_layer), "week");
+  host_layer_set_label(bitmap_layer_get_layer(bt_layer), "bluetooth");
+  host_layer_set_label(bitmap_layer_get_layer(battery_layer), "battery");
+  host_layer_set_label(event_status_layer, "event_status");
+  host_layer_set_label(text_layer_get_layer(event_layer), "event_title");
+  host_layer_set_label(text_layer_get_layer(event_layer2), "event_relative");
+}
+
+// One event at 20:30 for every request, answered after REPLY_LATENCY_MS
+static AppMessageResult phone_outbox(const uint8_t *data, uint16_t size, void *context) {
+  DictionaryIterator iter;
+  dict_read_begin_from_buffer(&iter, data, size);
+  Tuple *session = dict_find(&iter, TRANSFER_KEY);
+  if (!dict_find(&iter, REQUEST_CALENDAR_KEY) || !session)
+    return APP_MSG_OK;
+
+  uint8_t header[3] = { session->value->uint8, 0, 1 };
+  uint8_t payload[1 + sizeof(Event)];
+  payload[0] = 1;
+  Event *e = (Event *)&payload[1];
+  memset(e, 0, sizeof(Event));
+  strcpy(e->title, "Review");
+  strcpy(e->start_date, "06/16 20:30");
+
+  uint8_t message[128];
+  DictionaryIterator out;
+  dict_write_begin(&out, message, sizeof(message));
+  dict_write_data(&out, TRANSFER_KEY, header, sizeof(header));
+  dict_write_data(&out, CALENDAR_RESPONSE_KEY, payload, sizeof(payload));
+  host_deliver_inbox(REPLY_LATENCY_MS, message, dict_write_end(&out));
+  return APP_MSG_OK;
+}
+
+static void profile(int mode) {
+  setenv("TZ", "UTC", 1);
+  tzset();
+  host_reset(PROFILE_START);
+  host_ui_reset();
+  host_persist_clear();
+  host_render_mode(mode);
+  host_set_outbox_handler(phone_outbox, NULL);
+  last_tick = PROFILE_START;
+
+  time_t hour = PROFILE_START + 90; // 20:00:00
+  begin();
+  init();
+  label_layers();
+  host_render_flush();
+  host_run_until(400); // Before the first calendar request goes out
+  end("startup");
+  host_run_until(at(hour - 60) - 1000);
+
+  begin();
+  tick(hour - 60);
+  host_run_until(at(hour - 60) + SETTLE_MS);
+  end("minute");
+
+  begin();
+  tick(hour);
+  host_run_until(at(hour) + SETTLE_MS);
+  end("top_of_hour");
+
+  host_run_until(at(hour) + 10000);
+  begin();
+  host_tap(ACCEL_AXIS_X, 1);
+  end("show_status");
+
+  begin();
+  host_run_until(at(hour) + 15000 + SETTLE_MS);
+  end("hide_status");
+
+  // 20:08 is the tenth tick since startup, so the watch asks for the calendar
+  ticks_before(hour + 8 * 60);
+  tick(hour + 8 * 60);
+  host_run_until(at(hour + 8 * 60) + SETTLE_MS);
+  begin();
+  host_run_until(at(hour + 8 * 60) + SETTLE_MS + REPLY_LATENCY_MS);
+  end("sync_reply");
+
+  ticks_before(hour + 10 * 60);
+  begin();
+  tick(hour + 10 * 60);
+  host_run_until(at(hour + 10 * 60) + SETTLE_MS);
+  end("ten_minutes");
+
+  time_t midnight = PROFILE_START - 19 * 3600 - 58 * 60 - 30 + 86400;
+  ticks_before(midnight);
+  begin();
+  tick(midnight);
+  host_run_until(at(midnight) + SETTLE_MS);
+  end("midnight");
+}
+
+int main(int argc, char **argv) {
+  int modes[2] = { HOST_RENDER_FULL, HOST_RENDER_DAMAGE };
+  int mode_count = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:o:")) != -1) {
+    switch (opt) {
+      case 'm':
+        modes[0] = strcmp(optarg, "damage") == 0 ? HOST_RENDER_DAMAGE : HOST_RENDER_FULL;
+        mode_count = 1;
+        break;
+      case 'o':
+        output_dir = optarg;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-m full|damage] [-o dir]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  if (output_dir) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/layers.csv", output_dir);
+    layers_csv = fopen(path, "w");
+    if (!layers_csv) {
+      perror(path);
+      return 1;
+    }
+    fprintf(layers_csv, "mode,event,layer,pixels_written\n");
+    fflush(layers_csv);
+  }
+
+  printf("mode,event,frames,pixels_written,pixels_touched,overdraw,screen_pct\n");
+  fflush(stdout);
+
+  // Each mode in its own process, so both start from a fresh watchface
+  for (int i = 0; i < mode_count; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      mode_name = modes[i] == HOST_RENDER_DAMAGE ? "damage" : "full";
+      profile(modes[i]);
+      fflush(NULL);
+      _exit(0);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "profile_overdraw: mode %d failed\n", modes[i]);
+      return 1;
+    }
+  }
+
+  if (layers_csv)
+    fclose(layers_csv);
+  return 0;
+}
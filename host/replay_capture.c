@@ -0,0 +1,434 @@
+/*
+ * Capture replay - plays a watch's input recording (src/recorder.c) back
+ * through the whole watchface, to see a field problem happen again on the
+ * desk and to check it goes the way it went on the wrist.
+ *
+ *   cc -O2 -Wall -std=gnu99 -Ihost -Isrc host/pebble_host.c host/pebble_ui.c src/calendar.c src/outbox.c src/trace.c src/recorder.c src/bluetooth.c src/power.c src/digits.c host/replay_capture.c -o replay_capture
+ *   ./replay_capture [-t] [phone.log ...] > replay.csv
+ *
+ * Reads the "recorder <hex>" lines calendar_feed.js logs with localStorage
+ * recorder set (anything else on a line is skipped) and puts each capture
+ * back together by offset; a capture is replayed as far as it is unbroken
+ * from its start.
+ *
+ * A replay starts the face the way the watch did - the clock to the ms, the
+ * time zone, battery, Bluetooth, 12/24h and the event store from the
+ * capture's opening records - and then hands it every input at the ms it
+ * came: ticks, taps, raw Bluetooth changes, battery, zone changes, messages
+ * from the phone, drops and send results. Timers and animations run off the
+ * virtual clock as they would. The recorder on the host writes its own
+ * capture as it goes, and it has to come out byte for byte the same, ticks'
+ * wakeup counts and decision digests included; the first record that
+ * doesn't is where the replay stopped following the watch.
+ *
+ * One CSV row per capture. Wakeups are timer callbacks, as the watch counted
+ * them; redraws are whole-window renders, which only the host can count.
+ * With -t, the alert decisions instead, one row each, times in ms from the
+ * start of the capture. Each capture runs in a forked child, since the face
+ * keeps its state in globals. Exits 1 if any capture diverged.
+ */
+
+#include <ctype.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define main revolution_main
+#include "Revolution.c"
+#undef main
+
+extern TraceRecord trace_ring[TRACE_CAPACITY];
+extern uint32_t trace_seq;
+extern EventText *events;
+extern uint8_t recorder_ring[RECORDER_BYTES];
+extern uint32_t recorder_total;
+extern uint16_t recorder_wakes;
+
+#define MAX_CAPTURES 64
+#define MAX_LINE 4096
+#define RECORD_KINDS 12
+
+static const char *kind_names[RECORD_KINDS] = {
+  "?", "start", "persist", "tick", "tap", "bluetooth", "battery", "message", "dropped", "sent", "failed", "zone"
+};
+
+typedef struct {
+  uint32_t id;       // Launch time
+  uint32_t total;    // Bytes the watch had written, as last heard
+  uint32_t size;
+  uint8_t *bytes;
+  uint8_t *known;
+} Capture;
+
+static Capture captures[MAX_CAPTURES];
+static int capture_count;
+
+/*
+ * Putting captures back together
+ */
+static Capture *find_capture(uint32_t id) {
+  for (int i = 0; i < capture_count; i++) {
+    if (captures[i].id == id)
+      return &captures[i];
+  }
+  if (capture_count == MAX_CAPTURES)
+    return NULL;
+  Capture *c = &captures[capture_count++];
+  memset(c, 0, sizeof(Capture));
+  c->id = id;
+  return c;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void add_reply(const uint8_t *reply, uint32_t length) {
+  if (length < 3 * sizeof(uint32_t))
+    return;
+  Capture *c = find_capture(read_le32(reply));
+  if (!c)
+    return;
+  uint32_t first = read_le32(reply + 4);
+  uint32_t total = read_le32(reply + 8);
+  uint32_t n = length - 12;
+  if (total > c->total)
+    c->total = total;
+  if (first + n > c->size) {
+    uint32_t size = (first + n) * 2;
+    c->bytes = realloc(c->bytes, size);
+    c->known = realloc(c->known, size);
+    memset(c->known + c->size, 0, size - c->size);
+    c->size = size;
+  }
+  memcpy(c->bytes + first, reply + 12, n);
+  memset(c->known + first, 1, n);
+}
+
+static void read_log(FILE *in) {
+  char line[MAX_LINE];
+  uint8_t reply[MAX_LINE / 2];
+  while (fgets(line, sizeof(line), in)) {
+    char *hex = strstr(line, "recorder ");
+    if (!hex)
+      continue;
+    hex += strlen("recorder ");
+    uint32_t length = 0;
+    unsigned value;
+    while (length < sizeof(reply) && sscanf(hex, "%2x", &value) == 1 && isxdigit((unsigned char)hex[1])) {
+      reply[length++] = value;
+      hex += 2;
+    }
+    add_reply(reply, length);
+  }
+}
+
+// Bytes from the start of a capture with none missing
+static uint32_t unbroken(const Capture *c) {
+  uint32_t n = 0;
+  while (n < c->size && c->known[n])
+    n++;
+  return n;
+}
+
+/*
+ * Records
+ */
+typedef struct {
+  uint8_t kind;
+  uint32_t delta_ms;
+  const uint8_t *body;
+  uint32_t value;       // The varint in the body, where there is one
+  const uint8_t *data;  // and what follows it
+  uint32_t length;      // Of the whole record
+} Record;
+
+static bool read_varint(const uint8_t *p, uint32_t left, uint32_t *value, uint32_t *used) {
+  *value = 0;
+  for (uint32_t i = 0; i < left && i < 5; i++) {
+    *value |= (uint32_t)(p[i] & 0x7f) << (7 * i);
+    if (!(p[i] & 0x80)) {
+      *used = i + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+// False if the record is cut short or not one we know
+static bool next_record(const uint8_t *p, uint32_t left, Record *r) {
+  uint32_t used;
+  if (left < 2 || !read_varint(p + 1, left - 1, &r->delta_ms, &used))
+    return false;
+  r->kind = p[0];
+  r->body = p + 1 + used;
+  left -= 1 + used;
+
+  uint32_t n;
+  switch (r->kind) {
+    case RECORD_START: n = 11; break;
+    case RECORD_TAP: case RECORD_BATTERY: case RECORD_ZONE: n = 2; break;
+    case RECORD_BLUETOOTH: n = 1; break;
+    case RECORD_SENT: n = 0; break;
+    case RECORD_PERSIST: case RECORD_TICK: case RECORD_MESSAGE: case RECORD_DROPPED: case RECORD_FAILED: {
+      uint32_t skip = r->kind == RECORD_PERSIST || r->kind == RECORD_TICK ? 1 : 0;
+      if (left < skip || !read_varint(r->body + skip, left - skip, &r->value, &used))
+        return false;
+      r->data = r->body + skip + used;
+      n = skip + used;
+      if (r->kind == RECORD_PERSIST || r->kind == RECORD_MESSAGE)
+        n += r->value;
+      else if (r->kind == RECORD_TICK)
+        n += sizeof(uint16_t);
+      break;
+    }
+    default:
+      return false;
+  }
+  if (n > left)
+    return false;
+  r->length = (r->body - p) + n;
+  return true;
+}
+
+static int16_t read_int16(const uint8_t *p) {
+  return (int16_t)(p[0] | (p[1] << 8));
+}
+
+static void set_zone(int16_t minutes_east) {
+  char tz[24];
+  int minutes = minutes_east < 0 ? -minutes_east : minutes_east;
+  snprintf(tz, sizeof(tz), "REC%c%02d:%02d", minutes_east < 0 ? '+' : '-', minutes / 60, minutes % 60); // POSIX counts west as positive
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+static BatteryChargeState battery_from(const uint8_t *p) {
+  return (BatteryChargeState){ p[0], (p[1] & RECORD_CHARGING) != 0, (p[1] & RECORD_PLUGGED) != 0 };
+}
+
+/*
+ * One capture, in a child process
+ */
+typedef struct {
+  uint32_t records;
+  uint32_t kinds[RECORD_KINDS];
+  uint32_t wakeups;
+  uint32_t alerts_queued;
+  uint32_t alerts_due;
+  uint32_t alerts_late;
+  uint32_t alerts_capped;
+} ReplayTotals;
+
+static ReplayTotals totals;
+static uint32_t trace_seen;
+static uint64_t start_ms;
+static bool timeline;
+static uint32_t capture_id;
+
+static const char *decision_name(uint8_t id) {
+  switch (id) {
+    case TRACE_ALERT_QUEUED: return "queued";
+    case TRACE_ALERT_CAPPED: return "capped";
+    case TRACE_COUNTDOWN: return "countdown";
+    case TRACE_ALERT_DUE: return "due";
+    case TRACE_ALERT_LATE: return "late";
+    case TRACE_ALERT_DONE: return "done";
+    default: return NULL;
+  }
+}
+
+static void collect_decisions(void) {
+  for (; trace_seen < trace_seq; trace_seen++) {
+    TraceRecord *r = &trace_ring[trace_seen % TRACE_CAPACITY];
+    const char *name = decision_name(r->id);
+    if (!name)
+      continue;
+    totals.alerts_queued += r->id == TRACE_ALERT_QUEUED;
+    totals.alerts_due += r->id == TRACE_ALERT_DUE;
+    totals.alerts_late += r->id == TRACE_ALERT_LATE;
+    totals.alerts_capped += r->id == TRACE_ALERT_CAPPED;
+    if (timeline)
+      printf("%u,%lld,%s,%u,%s,%d\n", capture_id, (long long)(((int64_t)r->time - capture_id) * 1000 + r->ms - (int64_t)start_ms),
+             name, r->a, r->a < MAX_EVENTS ? string_text(events[r->a].title) : "", (int)r->b);
+  }
+}
+
+// Whether what the replay wrote since from matches the capture
+static bool same_bytes(const uint8_t *capture, uint32_t from) {
+  for (uint32_t i = from; i < recorder_total; i++) {
+    if (recorder_ring[i % RECORDER_BYTES] != capture[i])
+      return false;
+  }
+  return true;
+}
+
+static void inject(const Record *r, bool *connected) {
+  switch (r->kind) {
+    case RECORD_TICK:
+      totals.wakeups += recorder_wakes;
+      host_tick(r->body[0]);
+      break;
+    case RECORD_TAP:
+      host_tap(r->body[0], (int8_t)r->body[1]);
+      break;
+    case RECORD_BLUETOOTH:
+      *connected = r->body[0];
+      host_set_bluetooth(*connected);
+      break;
+    case RECORD_BATTERY:
+      host_set_battery(battery_from(r->body));
+      break;
+    case RECORD_ZONE:
+      set_zone(read_int16(r->body));
+      break;
+    case RECORD_MESSAGE:
+      // It got through on the watch, whatever the link looked like
+      host_set_connected(true);
+      host_deliver_inbox(0, r->data, r->value);
+      host_run_until(host_now_ms());
+      host_set_connected(*connected);
+      break;
+    case RECORD_DROPPED:
+      host_inbox_dropped(r->value);
+      host_render_flush();
+      break;
+    case RECORD_SENT:
+      host_outbox_result(APP_MSG_OK);
+      host_render_flush();
+      break;
+    case RECORD_FAILED:
+      host_outbox_result(r->value);
+      host_render_flush();
+      break;
+  }
+}
+
+static int replay(const Capture *c) {
+  capture_id = c->id;
+  uint32_t length = unbroken(c);
+  const uint8_t *bytes = c->bytes;
+  Record r;
+  if (length == 0 || !next_record(bytes, length, &r) || r.kind != RECORD_START || r.body[0] != RECORDER_VERSION) {
+    if (!timeline)
+      printf("%u,,,,%u,%u,,,,,,,,,,,,,,no start\n", c->id, length, c->total);
+    return 1;
+  }
+  uint32_t start_time = read_le32(r.body + 1);
+  start_ms = r.body[5] | (r.body[6] << 8);
+  int16_t zone = read_int16(r.body + 7);
+  BatteryChargeState battery = battery_from(r.body + 9);
+  uint8_t flags = r.body[10];
+  bool connected = (flags & RECORD_CONNECTED) != 0;
+  uint32_t pos = r.length;
+
+  // The face's starting state
+  host_persist_clear();
+  while (next_record(bytes + pos, length - pos, &r) && r.kind == RECORD_PERSIST) {
+    persist_write_data(r.body[0], r.data, r.value);
+    pos += r.length;
+  }
+  set_zone(zone);
+  host_reset(start_time);
+  host_ui_reset();
+  host_run_until(start_ms);
+  host_set_battery(battery);
+  host_set_bluetooth(connected);
+  host_set_24h_style((flags & RECORD_24H) != 0);
+  host_set_outbox_ack_ms(HOST_OUTBOX_ACK_MANUAL);
+  host_render_mode(HOST_RENDER_FULL);
+  init();
+  trace_seen = 0;
+  collect_decisions();
+
+  // Then every input at its time
+  uint64_t now = start_ms;
+  int32_t diverged = recorder_total == pos && same_bytes(bytes, 0) ? -1 : 0;
+  uint8_t diverged_kind = RECORD_START;
+  uint32_t checked = pos;
+  while (diverged < 0 && next_record(bytes + pos, length - pos, &r)) {
+    now += r.delta_ms;
+    host_run_until(now);
+    collect_decisions();
+    inject(&r, &connected);
+    collect_decisions();
+    totals.records++;
+    if (r.kind < RECORD_KINDS)
+      totals.kinds[r.kind]++;
+    pos += r.length;
+    if (r.kind == RECORD_ZONE)
+      continue; // The face writes it with the tick that follows
+    if (recorder_total != pos || !same_bytes(bytes, checked)) {
+      diverged = checked;
+      diverged_kind = bytes[checked];
+    }
+    checked = pos;
+  }
+  totals.wakeups += recorder_wakes;
+
+  if (!timeline) {
+    char status[48];
+    if (diverged >= 0)
+      snprintf(status, sizeof(status), "diverged at %s %lld ms", kind_names[diverged_kind], (long long)(now - start_ms));
+    else
+      snprintf(status, sizeof(status), pos < c->total ? "matched, %u bytes missing" : "matched", c->total - pos);
+    printf("%u,%d,%.1f,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%s\n", c->id, zone, (now - start_ms) / 60000.0,
+           pos, c->total, totals.records, totals.kinds[RECORD_TICK], totals.kinds[RECORD_TAP],
+           totals.kinds[RECORD_BLUETOOTH], totals.kinds[RECORD_BATTERY], totals.kinds[RECORD_MESSAGE],
+           totals.kinds[RECORD_DROPPED] + totals.kinds[RECORD_FAILED], totals.wakeups, host_stats.frames_rendered,
+           totals.alerts_queued, totals.alerts_due, totals.alerts_late, totals.alerts_capped,
+           diverged >= 0 ? diverged : (int32_t)pos, status);
+  }
+  return diverged >= 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "t")) != -1) {
+    switch (opt) {
+      case 't': timeline = true; break;
+      default:
+        fprintf(stderr, "usage: %s [-t] [phone.log ...]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (optind == argc)
+    read_log(stdin);
+  for (int i = optind; i < argc; i++) {
+    FILE *in = fopen(argv[i], "r");
+    if (!in) {
+      perror(argv[i]);
+      return 2;
+    }
+    read_log(in);
+    fclose(in);
+  }
+  if (capture_count == 0) {
+    fprintf(stderr, "replay_capture: no recorder lines\n");
+    return 2;
+  }
+
+  if (timeline)
+    printf("capture,ms,decision,event,title,b\n");
+  else
+    printf("capture,zone_minutes,minutes,bytes,captured_bytes,records,ticks,taps,bluetooth,battery,messages,"
+           "drops_and_failures,wakeups,redraws,alerts_queued,alerts_due,alerts_late,alerts_capped,matched_bytes,result\n");
+  fflush(stdout);
+
+  int status = 0;
+  for (int i = 0; i < capture_count; i++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      return 2;
+    }
+    if (pid == 0) {
+      int result = replay(&captures[i]);
+      fflush(stdout);
+      _exit(result);
+    }
+    int child;
+    if (waitpid(pid, &child, 0) < 0 || !WIFEXITED(child) || WEXITSTATUS(child) != 0)
+      status = 1;
+  }
+  return status;
+}
@@ -0,0 +1,485 @@
+/*
+ * Fleet replay - many watches, each with its own calendar, run side by side
+ * to see how alerts hold up across the kinds of day people actually have.
+ *
+ *   cc -O2 -Wall -std=gnu99 -Ihost -Isrc host/pebble_host.c host/pebble_ui.c src/calendar.c src/outbox.c src/trace.c src/recorder.c src/bluetooth.c src/power.c src/digits.c host/replay_fleet.c -o replay_fleet
+ *   ./replay_fleet [-n instances] [-j jobs] [-d days] [-s seed] [-l p99_ms]
+ *
+ * Each instance is a whole watchface (calendar.c and Revolution.c) with its
+ * own virtual clock, time zone and scripted phone, and runs minute by minute
+ * for a few days. The watchface keeps its state in globals, so instances run
+ * in forked processes rather than threads: -j of them at once (one per core
+ * by default), each starting from a clean copy of the never-initialised
+ * program. Results come back over a pipe as one fixed size record each.
+ *
+ * Calendars come in four profiles, by instance number: dense meeting days,
+ * days with several all-day events, events either side of midnight, and a
+ * flight that moves the watch several time zones. Every timed event that
+ * starts after the first sync should get its alert; one that comes more
+ * than ALERT_LATE_MS after the start is late, and one that never comes
+ * (or is only traced as TRACE_ALERT_LATE) is missed. Wakeups are timer
+ * callbacks, inbox messages and minute ticks, per simulated hour.
+ *
+ * Minute ticks don't land on the minute: each comes up to TICK_JITTER_MS
+ * late, and one in TICK_STALL_PER_MILLE later still, as when the watch is
+ * busy. delivery_p99_ms is the 99th percentile delay with missed alerts
+ * counted as never arriving (-1 when they decide it); with -l the run fails
+ * if any profile's reaches that many ms.
+ *
+ * Prints one CSV row per profile and one for the fleet, and the wall time
+ * on stderr; compare -j1 with the default to see how it scales.
+ */
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define main revolution_main
+#include "Revolution.c"
+#undef main
+
+extern TraceRecord trace_ring[TRACE_CAPACITY];
+extern uint32_t trace_seq;
+extern EventText *events;
+
+#define FLEET_EPOCH 1402876800 // 2014-06-16 00:00:00 UTC
+#define FLEET_INSTANCES 1000
+#define FLEET_DAYS 2
+#define MAX_JOBS 128
+#define MAX_CALENDAR 64
+#define MAX_SAMPLES 64
+#define WARMUP_MS 60000       // The first sync has landed by then
+#define ALERT_LATE_MS 1000
+#define PHONE_LATENCY_MS 30
+#define PHONE_JITTER_MS 50
+#define PHONE_DROP_PCT 2
+#define PHONE_HORIZON_S (24 * 3600)
+#define TICK_JITTER_MS 200
+#define TICK_STALL_PER_MILLE 2
+#define TICK_STALL_MS 2500
+
+#define PROFILE_DENSE 0
+#define PROFILE_ALL_DAY 1
+#define PROFILE_MIDNIGHT 2
+#define PROFILE_TRAVEL 3
+#define PROFILES 4
+
+static const char *profile_names[PROFILES] = { "dense", "all_day", "midnight", "travel" };
+
+typedef struct {
+  time_t start;
+  bool all_day;
+  char title[21];
+  int32_t due_ms;       // When the alert went off, relative to start; -1 until it does
+} FleetEvent;
+
+// What a child sends back; small enough for one atomic pipe write
+typedef struct {
+  uint32_t instance;
+  uint8_t profile;
+  bool ok;
+  uint16_t events;
+  uint16_t expected;
+  uint16_t on_time;
+  uint16_t late;
+  uint16_t missed;
+  uint16_t samples;
+  uint32_t wakeups;
+  uint32_t hours;
+  uint32_t heap_peak;
+  int32_t lateness_ms[MAX_SAMPLES];
+} InstanceResult;
+
+/*
+ * One instance. Everything here lives in the child process.
+ */
+static uint32_t rng_state;
+static FleetEvent calendar[MAX_CALENDAR];
+static int calendar_size;
+static uint8_t sent[MAX_EVENTS]; // calendar index behind each event in the last reply
+static int sent_count;
+static uint8_t sent_session;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static int rng_range(int low, int high) {
+  return low + (int)(rng() % (uint32_t)(high - low + 1));
+}
+
+static void set_zone(int offset_hours) {
+  char tz[16];
+  snprintf(tz, sizeof(tz), "UTC%+d", -offset_hours); // POSIX counts west as positive
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+static void add_event(time_t start, bool all_day) {
+  if (calendar_size >= MAX_CALENDAR)
+    return;
+  FleetEvent *e = &calendar[calendar_size];
+  e->start = start;
+  e->all_day = all_day;
+  e->due_ms = -1;
+  snprintf(e->title, sizeof(e->title), "%s %d", all_day ? "Day" : "Event", calendar_size);
+  calendar_size++;
+}
+
+static int by_start(const void *a, const void *b) {
+  const FleetEvent *x = a, *y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// Events are laid out in home time; travel only changes how the watch shows them
+static void make_calendar(int profile, time_t home_midnight, int days) {
+  calendar_size = 0;
+  for (int day = 0; day <= days; day++) {
+    time_t midnight = home_midnight + day * 86400;
+    switch (profile) {
+      case PROFILE_DENSE:
+        for (int minute = rng_range(7 * 60, 9 * 60); minute < 19 * 60; minute += rng_range(20, 50))
+          add_event(midnight + minute * 60, false);
+        break;
+      case PROFILE_ALL_DAY:
+        for (int i = rng_range(2, 4); i > 0; i--)
+          add_event(midnight, true);
+        for (int i = rng_range(3, 5); i > 0; i--)
+          add_event(midnight + rng_range(8 * 60, 20 * 60) * 60, false);
+        break;
+      case PROFILE_MIDNIGHT:
+        for (int i = rng_range(2, 3); i > 0; i--)
+          add_event(midnight + rng_range(23 * 60 + 15, 23 * 60 + 59) * 60, false);
+        for (int i = rng_range(2, 3); i > 0; i--)
+          add_event(midnight + 86400 + rng_range(0, 45) * 60, false);
+        add_event(midnight + rng_range(10 * 60, 16 * 60) * 60, false);
+        break;
+      case PROFILE_TRAVEL:
+        for (int i = rng_range(5, 8); i > 0; i--)
+          add_event(midnight + rng_range(6 * 60, 22 * 60) * 60, false);
+        break;
+    }
+  }
+  qsort(calendar, calendar_size, sizeof(FleetEvent), by_start);
+}
+
+static void phone_send(int first, int last, uint8_t session) {
+  for (int i = first; i <= last && i < sent_count; i++) {
+    if ((int)(rng() % 100) < PHONE_DROP_PCT)
+      continue;
+
+    FleetEvent *source = &calendar[sent[i]];
+    uint8_t header[3] = { session, i, i == last };
+    uint8_t payload[1 + sizeof(Event)];
+    payload[0] = sent_count;
+    Event *e = (Event *)&payload[1];
+    memset(e, 0, sizeof(Event));
+    e->index = i;
+    e->all_day = source->all_day;
+    strncpy(e->title, source->title, sizeof(e->title) - 1);
+    strftime(e->start_date, sizeof(e->start_date), source->all_day ? "%m/%d" : "%m/%d %H:%M",
+             localtime(&source->start));
+
+    uint8_t message[128];
+    DictionaryIterator iter;
+    dict_write_begin(&iter, message, sizeof(message));
+    dict_write_data(&iter, TRANSFER_KEY, header, sizeof(header));
+    dict_write_data(&iter, CALENDAR_RESPONSE_KEY, payload, sizeof(payload));
+    host_deliver_inbox(PHONE_LATENCY_MS + rng_range(0, PHONE_JITTER_MS), message, dict_write_end(&iter));
+  }
+}
+
+// Like the feed: the next day's events in start order, all-day ones from today on
+static AppMessageResult phone_outbox(const uint8_t *data, uint16_t size, void *context) {
+  DictionaryIterator iter;
+  if (!dict_read_begin_from_buffer(&iter, data, size))
+    return APP_MSG_OK;
+
+  Tuple *session = dict_find(&iter, TRANSFER_KEY);
+  Tuple *resume = dict_find(&iter, RESUME_CALENDAR_KEY);
+  if (dict_find(&iter, REQUEST_CALENDAR_KEY) && session) {
+    time_t now = time(NULL);
+    sent_session = session->value->uint8;
+    sent_count = 0;
+    for (int i = 0; i < calendar_size && sent_count < MAX_EVENTS; i++) {
+      time_t start = calendar[i].start;
+      if (calendar[i].all_day ? start + 86400 > now && start < now + PHONE_HORIZON_S
+                              : start >= now && start < now + PHONE_HORIZON_S)
+        sent[sent_count++] = i;
+    }
+    phone_send(0, sent_count - 1, sent_session);
+  } else if (resume && resume->length >= 3) {
+    const uint8_t *range = resume->value->data;
+    int last = range[2];
+    if (range[0] == sent_session)
+      phone_send(range[1], last >= sent_count ? sent_count - 1 : last, sent_session);
+  }
+  return APP_MSG_OK;
+}
+
+// Match alerts traced since the last look to the events they were for
+static uint32_t trace_seen;
+
+static void collect_alerts(void) {
+  for (; trace_seen < trace_seq; trace_seen++) {
+    TraceRecord *r = &trace_ring[trace_seen % TRACE_CAPACITY];
+    if (r->id != TRACE_ALERT_DUE)
+      continue;
+    for (int i = 0; i < calendar_size; i++) {
+      FleetEvent *e = &calendar[i];
+      if (e->due_ms < 0 && strcmp(e->title, string_text(events[r->a].title)) == 0) {
+        e->due_ms = (int32_t)(((int64_t)r->time - e->start) * 1000 + r->ms);
+        break;
+      }
+    }
+  }
+}
+
+static void run_instance(uint32_t instance, uint32_t seed, int days, InstanceResult *result) {
+  memset(result, 0, sizeof(InstanceResult));
+  result->instance = instance;
+  result->profile = instance % PROFILES;
+  rng_state = (seed ^ (instance * 2654435761u)) | 1;
+
+  int home_zone = rng_range(-8, 9);
+  set_zone(home_zone);
+  time_t home_midnight = FLEET_EPOCH - home_zone * 3600;
+  time_t run_start = home_midnight + rng_range(0, 24 * 60 - 1) * 60;
+  make_calendar(result->profile, home_midnight, days);
+
+  int travel_minute = result->profile == PROFILE_TRAVEL ? rng_range(60, days * 24 * 60 - 60) : -1;
+  int travel_zone = home_zone + (rng() % 2 ? 1 : -1) * rng_range(3, 9);
+
+  host_reset(run_start);
+  host_ui_reset();
+  host_persist_clear();
+  init();
+  host_set_outbox_handler(phone_outbox, NULL);
+  trace_seen = trace_seq;
+
+  struct tm last = *localtime(&run_start);
+  int minutes = days * 24 * 60;
+  for (int minute = 1; minute <= minutes; minute++) {
+    uint32_t tick_delay = rng_range(0, TICK_JITTER_MS);
+    if ((int)(rng() % 1000) < TICK_STALL_PER_MILLE)
+      tick_delay = rng_range(TICK_JITTER_MS, TICK_STALL_MS);
+    host_run_until((uint64_t)minute * 60000 + tick_delay);
+    if (minute == travel_minute)
+      set_zone(travel_zone);
+
+    time_t now = time(NULL);
+    struct tm local = *localtime(&now);
+    TimeUnits units = MINUTE_UNIT;
+    if (local.tm_hour != last.tm_hour)
+      units |= HOUR_UNIT;
+    if (local.tm_mday != last.tm_mday)
+      units |= DAY_UNIT;
+    last = local;
+    host_tick(units);
+    collect_alerts();
+  }
+
+  time_t run_end = run_start + minutes * 60;
+  for (int i = 0; i < calendar_size; i++) {
+    FleetEvent *e = &calendar[i];
+    result->events++;
+    if (e->all_day || e->start < run_start + WARMUP_MS / 1000 || e->start >= run_end)
+      continue;
+    result->expected++;
+    if (e->due_ms < 0) {
+      result->missed++;
+      continue;
+    }
+    if (e->due_ms > ALERT_LATE_MS)
+      result->late++;
+    else
+      result->on_time++;
+    if (result->samples < MAX_SAMPLES)
+      result->lateness_ms[result->samples++] = e->due_ms;
+  }
+  result->wakeups = host_stats.timers_fired + host_stats.inbox_delivered + minutes;
+  result->hours = minutes / 60;
+  result->heap_peak = host_stats.heap_peak;
+  result->ok = true;
+}
+
+/*
+ * The pool, in the parent
+ */
+typedef struct {
+  uint32_t instances;
+  uint32_t crashed;
+  uint32_t events;
+  uint32_t expected;
+  uint32_t on_time;
+  uint32_t late;
+  uint32_t missed;
+  uint64_t wakeups;
+  uint64_t hours;
+  uint32_t heap_peak;
+  int32_t *lateness;
+  uint32_t samples;
+} ProfileTotals;
+
+static int compare_int32(const void *a, const void *b) {
+  int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static int32_t percentile(int32_t *sorted, uint32_t n, int pct) {
+  if (n == 0)
+    return 0;
+  int i = (int)((n * pct + 99) / 100) - 1;
+  return sorted[i < 0 ? 0 : i];
+}
+
+static void add_result(ProfileTotals *t, InstanceResult *r) {
+  t->instances++;
+  if (!r->ok) {
+    t->crashed++;
+    return;
+  }
+  t->events += r->events;
+  t->expected += r->expected;
+  t->on_time += r->on_time;
+  t->late += r->late;
+  t->missed += r->missed;
+  t->wakeups += r->wakeups;
+  t->hours += r->hours;
+  if (r->heap_peak > t->heap_peak)
+    t->heap_peak = r->heap_peak;
+  memcpy(&t->lateness[t->samples], r->lateness_ms, r->samples * sizeof(int32_t));
+  t->samples += r->samples;
+}
+
+// Over every expected alert, the missed ones sorting last as never arriving; -1 if one of those is it
+static int32_t delivery_percentile(ProfileTotals *t, int pct) {
+  uint32_t n = t->samples + t->missed;
+  if (n == 0)
+    return 0;
+  uint32_t i = (n * pct + 99) / 100 - 1;
+  return i < t->samples ? t->lateness[i] : -1;
+}
+
+static int32_t print_totals(const char *name, ProfileTotals *t) {
+  qsort(t->lateness, t->samples, sizeof(int32_t), compare_int32);
+  int32_t delivery_p99 = delivery_percentile(t, 99);
+  printf("%s,%u,%u,%u,%u,%u,%u,%u,%.2f,%d,%d,%d,%d,%.1f,%u\n", name, t->instances, t->crashed, t->events,
+         t->expected, t->on_time, t->late, t->missed, t->expected ? 100.0 * t->missed / t->expected : 0.0,
+         percentile(t->lateness, t->samples, 50), percentile(t->lateness, t->samples, 99),
+         t->samples ? t->lateness[t->samples - 1] : 0, delivery_p99,
+         t->hours ? (double)t->wakeups / t->hours : 0.0, t->heap_peak);
+  return delivery_p99;
+}
+
+static bool read_result(int fd, InstanceResult *results, uint32_t instances) {
+  InstanceResult r;
+  if (read(fd, &r, sizeof(r)) != sizeof(r) || r.instance >= instances)
+    return false;
+  results[r.instance] = r;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint32_t instances = FLEET_INSTANCES;
+  int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int days = FLEET_DAYS;
+  uint32_t seed = 1;
+  int32_t p99_limit_ms = -1;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:j:d:s:l:")) != -1) {
+    switch (opt) {
+      case 'n': instances = strtoul(optarg, NULL, 10); break;
+      case 'j': jobs = atoi(optarg); break;
+      case 'd': days = atoi(optarg); break;
+      case 's': seed = strtoul(optarg, NULL, 10); break;
+      case 'l': p99_limit_ms = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-n instances] [-j jobs] [-d days] [-s seed] [-l p99_ms]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (jobs < 1)
+    jobs = 1;
+  if (jobs > MAX_JOBS)
+    jobs = MAX_JOBS;
+  if (days < 1)
+    days = 1;
+
+  // Records are read as children exit, so at most MAX_JOBS of them ever sit in the pipe
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) {
+    perror("pipe");
+    return 1;
+  }
+  fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+  fflush(stdout);
+
+  InstanceResult *results = calloc(instances, sizeof(InstanceResult));
+  for (uint32_t i = 0; i < instances; i++) {
+    results[i].instance = i;
+    results[i].profile = i % PROFILES;
+  }
+
+  uint64_t start_ns = host_clock_ns();
+  uint32_t next = 0;
+  int running = 0;
+  while (next < instances || running > 0) {
+    while (running < jobs && next < instances) {
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        break;
+      }
+      if (pid == 0) {
+        close(pipe_fds[0]);
+        InstanceResult result;
+        run_instance(next, seed, days, &result);
+        if (write(pipe_fds[1], &result, sizeof(result)) != sizeof(result))
+          _exit(1);
+        _exit(0);
+      }
+      next++;
+      running++;
+    }
+
+    int status;
+    if (wait(&status) > 0)
+      running--;
+    else if (running == 0)
+      break;
+    while (read_result(pipe_fds[0], results, instances))
+      ;
+  }
+  while (read_result(pipe_fds[0], results, instances))
+    ;
+  double wall_s = (host_clock_ns() - start_ns) / 1e9;
+
+  ProfileTotals totals[PROFILES + 1];
+  memset(totals, 0, sizeof(totals));
+  for (int p = 0; p <= PROFILES; p++)
+    totals[p].lateness = malloc(instances * MAX_SAMPLES * sizeof(int32_t));
+  for (uint32_t i = 0; i < instances; i++) {
+    add_result(&totals[results[i].profile], &results[i]);
+    add_result(&totals[PROFILES], &results[i]);
+  }
+
+  printf("profile,instances,crashed,events,alerts_expected,alerts_on_time,alerts_late,alerts_missed,missed_pct,"
+         "late_p50_ms,late_p99_ms,late_max_ms,delivery_p99_ms,wakeups_per_hour,heap_peak_bytes\n");
+  bool over_limit = false;
+  for (int p = 0; p <= PROFILES; p++) {
+    int32_t delivery_p99 = print_totals(p < PROFILES ? profile_names[p] : "all", &totals[p]);
+    if (p99_limit_ms >= 0 && (delivery_p99 < 0 || delivery_p99 >= p99_limit_ms)) {
+      fprintf(stderr, "replay_fleet: %s alerts p99 %s, limit %d ms\n", p < PROFILES ? profile_names[p] : "all",
+              delivery_p99 < 0 ? "missed" : "too late", p99_limit_ms);
+      over_limit = true;
+    }
+  }
+  fprintf(stderr, "%u instances x %d days on %d jobs in %.2f s (%.1f instances/s)\n",
+          instances, days, jobs, wall_s, instances / wall_s);
+
+  return totals[PROFILES].crashed || over_limit ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef host_resource_ids_auto_h
+#define host_resource_ids_auto_h
+
+/*
+ * Resource ids for the host build, in appinfo.json order. Keep in step with
+ * appinfo.json when resources are added.
+ */
+
+#define HOST_RESOURCES(R) \
+  R(IMAGE_MENU_ICON, "images/RevolutionCal_icon.png") \
+  R(IMAGE_STATUS_3, "images/status3.png") \
+  R(IMAGE_STATUS_2, "images/status2.png") \
+  R(IMAGE_STATUS_1, "images/status1.png") \
+  R(ICON_BATTERY_CHARGING, "images/Icon Battery Charging.png") \
+  R(BLUETOOTH_DISCONNECTED, "images/Icon Bluetooth disconnected.png") \
+  R(BLUETOOTH_CONNECTED, "images/bluetooth.png") \
+  R(ICON_BATTERY_100, "images/Icon Battery 100.png") \
+  R(ICON_BATTERY_90, "images/Icon Battery 90.png") \
+  R(ICON_BATTERY_80, "images/Icon Battery 80.png") \
+  R(ICON_BATTERY_70, "images/Icon Battery 70.png") \
+  R(ICON_BATTERY_60, "images/Icon Battery 60.png") \
+  R(ICON_BATTERY_50, "images/Icon Battery 50.png") \
+  R(ICON_BATTERY_40, "images/Icon Battery 40.png") \
+  R(ICON_BATTERY_30, "images/Icon Battery 30.png") \
+  R(ICON_BATTERY_20, "images/Icon Battery 20.png") \
+  R(ICON_BATTERY_10, "images/Icon Battery 10.png") \
+  R(IMAGE_DATE_9, "images/date_9.png") \
+  R(IMAGE_DATE_8, "images/date_8.png") \
+  R(IMAGE_DATE_7, "images/date_7.png") \
+  R(IMAGE_DATE_6, "images/date_6.png") \
+  R(IMAGE_DATE_5, "images/date_5.png") \
+  R(IMAGE_DATE_4, "images/date_4.png") \
+  R(IMAGE_DATE_3, "images/date_3.png") \
+  R(IMAGE_DATE_2, "images/date_2.png") \
+  R(IMAGE_DATE_1, "images/date_1.png") \
+  R(IMAGE_DATE_0, "images/date_0.png") \
+  R(TIME_DIGITS_RLE, "data/time_digits.rle")
+
+#define HOST_RESOURCE_ID(name, file) RESOURCE_ID_##name,
+typedef enum {
+  RESOURCE_ID_INVALID = 0,
+  HOST_RESOURCES(HOST_RESOURCE_ID)
+} ResourceId;
+#undef HOST_RESOURCE_ID
+
+#endif
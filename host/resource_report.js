@@ -0,0 +1,308 @@
+/*
+ * Bitmap memory report - what each image resource costs in RAM as a
+ * monochrome 1 bit bitmap, as an 8 bit colour bitmap, and as the smallest
+ * palettized bitmap its colours fit in.
+ *
+ *   node host/resource_report.js [--repack] [--against dir] > report.csv
+ *
+ * Colour platforms decode a PNG resource into a palettized bitmap only when
+ * the PNG itself is palette-indexed at that depth; RGB PNGs come out at 8
+ * bits per pixel. --repack rewrites each image that fits in 16 colours as an
+ * indexed PNG with the palette sorted dark to light, so index 0 is always
+ * the darkest colour. The rewritten file is decoded again and only written
+ * if every pixel comes back the same.
+ *
+ * --against compares each image's pixels with the file of the same name
+ * under dir (say, the resources of an earlier commit, from git archive) and
+ * exits 1 if any differ - the check that a repack left the images alone.
+ */
+
+var fs = require('fs');
+var path = require('path');
+var zlib = require('zlib');
+
+var ROOT = path.join(__dirname, '..');
+var RESOURCE_DIR = path.join(ROOT, 'resources');
+var PNG_SIGNATURE = Buffer.from([0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a]);
+var CHANNELS = { 0: 1, 2: 3, 3: 1, 4: 2, 6: 4 };
+
+function read_chunks(data) {
+  var chunks = [];
+  var pos = PNG_SIGNATURE.length;
+  while (pos < data.length) {
+    var length = data.readUInt32BE(pos);
+    chunks.push({ type: data.toString('ascii', pos + 4, pos + 8), data: data.slice(pos + 8, pos + 8 + length) });
+    pos += 12 + length;
+  }
+  return chunks;
+}
+
+function paeth(a, b, c) {
+  var p = a + b - c;
+  var pa = Math.abs(p - a);
+  var pb = Math.abs(p - b);
+  var pc = Math.abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+/*
+ * Decode to an array of RGBA pixels (as 32 bit numbers)
+ */
+function decode_png(data) {
+  if (data.slice(0, 8).compare(PNG_SIGNATURE) !== 0)
+    throw new Error('not a PNG');
+
+  var chunks = read_chunks(data);
+  var header = chunks[0].data;
+  var png = {
+    width: header.readUInt32BE(0),
+    height: header.readUInt32BE(4),
+    depth: header[8],
+    colour_type: header[9]
+  };
+  if (header[12] !== 0)
+    throw new Error('interlaced PNGs are not supported');
+
+  var palette = [];
+  var alpha = [];
+  var idat = [];
+  chunks.forEach(function (chunk) {
+    if (chunk.type === 'PLTE') {
+      for (var i = 0; i < chunk.data.length; i += 3)
+        palette.push([chunk.data[i], chunk.data[i + 1], chunk.data[i + 2]]);
+    } else if (chunk.type === 'tRNS') {
+      alpha = Array.prototype.slice.call(chunk.data);
+    } else if (chunk.type === 'IDAT') {
+      idat.push(chunk.data);
+    }
+  });
+
+  var raw = zlib.inflateSync(Buffer.concat(idat));
+  var bits_per_pixel = CHANNELS[png.colour_type] * png.depth;
+  var bpp = Math.max(1, bits_per_pixel >> 3);
+  var stride = Math.ceil(png.width * bits_per_pixel / 8);
+  var previous = Buffer.alloc(stride);
+  var pixels = [];
+
+  for (var y = 0, pos = 0; y < png.height; y++) {
+    var filter = raw[pos++];
+    var line = Buffer.from(raw.slice(pos, pos + stride));
+    pos += stride;
+    for (var x = 0; x < stride; x++) {
+      var a = x >= bpp ? line[x - bpp] : 0;
+      var b = previous[x];
+      var c = x >= bpp ? previous[x - bpp] : 0;
+      if (filter === 1) line[x] = (line[x] + a) & 255;
+      else if (filter === 2) line[x] = (line[x] + b) & 255;
+      else if (filter === 3) line[x] = (line[x] + ((a + b) >> 1)) & 255;
+      else if (filter === 4) line[x] = (line[x] + paeth(a, b, c)) & 255;
+    }
+    previous = line;
+
+    for (x = 0; x < png.width; x++) {
+      var rgba;
+      if (png.depth < 8) {
+        var bit = x * png.depth;
+        var value = (line[bit >> 3] >> (8 - png.depth - (bit & 7))) & ((1 << png.depth) - 1);
+        if (png.colour_type === 3) {
+          rgba = palette[value].concat([value < alpha.length ? alpha[value] : 255]);
+        } else {
+          var grey = value * 255 / ((1 << png.depth) - 1);
+          rgba = [grey, grey, grey, 255];
+        }
+      } else {
+        var p = line.slice(x * bpp, x * bpp + bpp);
+        switch (png.colour_type) {
+          case 0: rgba = [p[0], p[0], p[0], 255]; break;
+          case 2: rgba = [p[0], p[1], p[2], 255]; break;
+          case 3: rgba = palette[p[0]].concat([p[0] < alpha.length ? alpha[p[0]] : 255]); break;
+          case 4: rgba = [p[0], p[0], p[0], p[1]]; break;
+          case 6: rgba = [p[0], p[1], p[2], p[3]]; break;
+        }
+      }
+      pixels.push(((rgba[0] << 24) | (rgba[1] << 16) | (rgba[2] << 8) | rgba[3]) >>> 0);
+    }
+  }
+
+  png.pixels = pixels;
+  return png;
+}
+
+function luminance(rgba) {
+  return ((rgba >>> 24) & 255) * 299 + ((rgba >>> 16) & 255) * 587 + ((rgba >>> 8) & 255) * 114;
+}
+
+function unique_colours(pixels) {
+  var seen = {};
+  var colours = [];
+  pixels.forEach(function (p) {
+    if (!seen[p]) {
+      seen[p] = true;
+      colours.push(p);
+    }
+  });
+  return colours.sort(function (a, b) { return luminance(a) - luminance(b) || a - b; });
+}
+
+function palette_depth(colours) {
+  if (colours <= 2) return 1;
+  if (colours <= 4) return 2;
+  if (colours <= 16) return 4;
+  return 8;
+}
+
+/*
+ * Bytes of pixel data (plus palette) for each in-memory format
+ */
+function mono_bytes(png) {
+  return Math.ceil(png.width / 32) * 4 * png.height;
+}
+
+function colour_bytes(png) {
+  return png.width * png.height;
+}
+
+function palette_bytes(png, depth) {
+  if (depth === 8)
+    return colour_bytes(png);
+  return Math.ceil(png.width * depth / 8) * png.height + (1 << depth);
+}
+
+/*
+ * Indexed PNG writer for --repack
+ */
+var CRC_TABLE = (function () {
+  var table = [];
+  for (var n = 0; n < 256; n++) {
+    var c = n;
+    for (var k = 0; k < 8; k++)
+      c = c & 1 ? 0xedb88320 ^ (c >>> 1) : c >>> 1;
+    table.push(c >>> 0);
+  }
+  return table;
+})();
+
+function crc32(buffer) {
+  var crc = 0xffffffff;
+  for (var i = 0; i < buffer.length; i++)
+    crc = CRC_TABLE[(crc ^ buffer[i]) & 255] ^ (crc >>> 8);
+  return (crc ^ 0xffffffff) >>> 0;
+}
+
+function chunk(type, data) {
+  var out = Buffer.alloc(12 + data.length);
+  out.writeUInt32BE(data.length, 0);
+  out.write(type, 4, 'ascii');
+  data.copy(out, 8);
+  out.writeUInt32BE(crc32(out.slice(4, 8 + data.length)), 8 + data.length);
+  return out;
+}
+
+function encode_indexed_png(png, colours, depth) {
+  var index = {};
+  colours.forEach(function (c, i) { index[c] = i; });
+
+  var stride = Math.ceil(png.width * depth / 8);
+  var raw = Buffer.alloc((stride + 1) * png.height);
+  for (var y = 0; y < png.height; y++) {
+    var row = y * (stride + 1) + 1;
+    for (var x = 0; x < png.width; x++) {
+      var bit = x * depth;
+      raw[row + (bit >> 3)] |= index[png.pixels[y * png.width + x]] << (8 - depth - (bit & 7));
+    }
+  }
+
+  var header = Buffer.alloc(13);
+  header.writeUInt32BE(png.width, 0);
+  header.writeUInt32BE(png.height, 4);
+  header[8] = depth;
+  header[9] = 3;
+
+  var plte = Buffer.alloc(colours.length * 3);
+  var trns = Buffer.alloc(colours.length);
+  var translucent = false;
+  colours.forEach(function (c, i) {
+    plte[i * 3] = (c >>> 24) & 255;
+    plte[i * 3 + 1] = (c >>> 16) & 255;
+    plte[i * 3 + 2] = (c >>> 8) & 255;
+    trns[i] = c & 255;
+    if (trns[i] !== 255)
+      translucent = true;
+  });
+
+  var parts = [PNG_SIGNATURE, chunk('IHDR', header), chunk('PLTE', plte)];
+  if (translucent)
+    parts.push(chunk('tRNS', trns));
+  parts.push(chunk('IDAT', zlib.deflateSync(raw, { level: 9 })), chunk('IEND', Buffer.alloc(0)));
+  return Buffer.concat(parts);
+}
+
+function same_pixels(a, b) {
+  if (a.width !== b.width || a.height !== b.height)
+    return false;
+  for (var i = 0; i < a.pixels.length; i++) {
+    if (a.pixels[i] !== b.pixels[i])
+      return false;
+  }
+  return true;
+}
+
+function main(argv) {
+  var repack = argv.indexOf('--repack') >= 0;
+  var against = argv.indexOf('--against') >= 0 ? argv[argv.indexOf('--against') + 1] : null;
+  var differ = 0;
+  var appinfo = JSON.parse(fs.readFileSync(path.join(ROOT, 'appinfo.json'), 'utf8'));
+  var totals = { png: 0, mono: 0, colour: 0, palette: 0 };
+
+  console.log('resource,width,height,colours,png_bytes,mono_bytes,colour_8bit_bytes,palette_format,palette_bytes,saving_vs_8bit_pct');
+  appinfo.resources.media.forEach(function (media) {
+    if (media.type !== 'png' && media.type !== 'png-trans')
+      return;
+
+    var file = path.join(RESOURCE_DIR, media.file);
+    var data = fs.readFileSync(file);
+    var png = decode_png(data);
+    var colours = unique_colours(png.pixels);
+    var depth = palette_depth(colours.length);
+
+    if (repack && depth < 8 && !(png.colour_type === 3 && png.depth === depth)) {
+      var packed = encode_indexed_png(png, colours, depth);
+      if (!same_pixels(png, decode_png(packed)))
+        throw new Error(media.file + ': repacked pixels differ, left as it was');
+      data = packed;
+      fs.writeFileSync(file, data);
+    }
+    if (against) {
+      var before = path.join(against, media.file);
+      if (!fs.existsSync(before) || !same_pixels(png, decode_png(fs.readFileSync(before)))) {
+        console.error(media.file + ': pixels differ from ' + before);
+        differ++;
+      }
+    }
+
+    var mono = mono_bytes(png);
+    var colour = colour_bytes(png);
+    var palettized = palette_bytes(png, depth);
+    totals.png += data.length;
+    totals.mono += mono;
+    totals.colour += colour;
+    totals.palette += palettized;
+
+    console.log([media.name, png.width, png.height, colours.length, data.length, mono, colour,
+                 depth === 8 ? '8Bit' : depth + 'BitPalette', palettized,
+                 (100 * (colour - palettized) / colour).toFixed(1)].join(','));
+  });
+
+  console.log(['TOTAL', '', '', '', totals.png, totals.mono, totals.colour, '', totals.palette,
+               (100 * (totals.colour - totals.palette) / totals.colour).toFixed(1)].join(','));
+  if (differ)
+    process.exitCode = 1;
+}
+
+// host/encode_digits.js reads the same PNGs
+if (require.main === module)
+  main(process.argv.slice(2));
+else
+  module.exports = { decode_png: decode_png, unique_colours: unique_colours, mono_bytes: mono_bytes };
@@ -0,0 +1,197 @@
+/*
+ * Heap soak - a week of minute ticks and calendar syncs against the host
+ * SDK stand-in, checking that the watchface allocates nothing once it is up.
+ *
+ *   cc -O2 -Wall -std=gnu99 -Ihost -Isrc host/pebble_host.c host/pebble_ui.c src/calendar.c src/outbox.c src/trace.c src/recorder.c src/bluetooth.c src/power.c src/digits.c host/soak_heap.c -o soak_heap
+ *   ./soak_heap [-r phone.log] [days]
+ *
+ * A scripted phone answers every calendar request with the day's events, so
+ * alerts are planned, re-planned, counted down and finished as on the watch.
+ * Everything allocated during the first hour (startup and the first sync)
+ * is warm-up; after that the app heap must see no allocations at all. Prints
+ * one CSV row and exits non-zero if any were made.
+ *
+ * With -r the phone also reads the input recording out the way
+ * calendar_feed.js does - from the start, again after each calendar request
+ * and on every reply until caught up - and writes it to phone.log as
+ * "recorder <hex>" lines. It fails if the phone didn't get every byte the
+ * watch had written by its last reply (the send result of that reply is
+ * recorded after it, so no reply can carry it).
+ * Playing the log back checks the recorder and replay_capture together:
+ *
+ *   ./soak_heap -r soak.log 2 && ./replay_capture soak.log
+ */
+
+#include <unistd.h>
+
+#define main revolution_main
+#include "Revolution.c"
+#undef main
+
+#define SOAK_EPOCH 1402876800 // 2014-06-16 00:00:00 UTC
+#define SOAK_DAYS 7
+#define WARMUP_MINUTES 60
+#define PHONE_LATENCY_MS 40
+#define RECORDER_PULL_DELAY_MS 5000  // As calendar_feed.js waits, for the reply to go out first
+
+typedef struct {
+  const char *title;
+  int minute; // Minutes after midnight, -1 for all day
+} SoakEvent;
+
+static const SoakEvent day_events[] = {
+  { "Standup", 9 * 60 + 5 },
+  { "Design review", 11 * 60 + 30 },
+  { "Lunch", -1 },
+  { "1:1", 14 * 60 },
+  { "Dentist", 16 * 60 + 45 },
+  { "Dinner", 20 * 60 + 10 },
+  { "Late call", 23 * 60 + 55 },
+};
+#define SOAK_EVENTS (int)(sizeof(day_events) / sizeof(day_events[0]))
+
+static uint32_t syncs;
+static FILE *recorder_log;      // With -r
+static uint32_t recorder_next;  // The phone's next offset to read from
+static uint32_t recorder_told;  // Bytes the watch had written, as its last reply said
+
+// Today's events, with one title changing every other day so re-planning has work to do
+static void make_event(Event *e, int index, struct tm *today) {
+  const SoakEvent *source = &day_events[index];
+  memset(e, 0, sizeof(Event));
+  e->index = index;
+  if (index == 1 && today->tm_yday % 2)
+    snprintf(e->title, sizeof(e->title), "%.12s (moved)", source->title);
+  else
+    snprintf(e->title, sizeof(e->title), "%s", source->title);
+  e->all_day = source->minute < 0;
+  int minute = e->all_day ? 0 : source->minute;
+  snprintf(e->start_date, sizeof(e->start_date), "%02u/%02u %02u:%02u",
+           (uint8_t)(today->tm_mon + 1), (uint8_t)today->tm_mday, (uint8_t)(minute / 60), (uint8_t)(minute % 60));
+}
+
+static void recorder_pull(uint32_t first) {
+  uint8_t message[32];
+  DictionaryIterator out;
+  dict_write_begin(&out, message, sizeof(message));
+  dict_write_uint32(&out, RECORDER_KEY, first);
+  host_deliver_inbox(PHONE_LATENCY_MS, message, dict_write_end(&out));
+}
+
+static void recorder_pull_later(void *data) {
+  recorder_pull(recorder_next);
+}
+
+// A dump reply, logged as the phone would; ask for more while the watch has it
+static void recorder_reply(const Tuple *dump) {
+  const uint8_t *bytes = dump->value->data;
+  fprintf(recorder_log, "recorder ");
+  for (int i = 0; i < dump->length; i++)
+    fprintf(recorder_log, "%02x", bytes[i]);
+  fprintf(recorder_log, "\n");
+
+  uint32_t first;
+  memcpy(&first, &bytes[sizeof(uint32_t)], sizeof(uint32_t));
+  memcpy(&recorder_told, &bytes[2 * sizeof(uint32_t)], sizeof(uint32_t));
+  recorder_next = first + dump->length - 3 * sizeof(uint32_t);
+  if (recorder_next < recorder_told)
+    recorder_pull(recorder_next);
+}
+
+static AppMessageResult phone_outbox(const uint8_t *data, uint16_t size, void *context) {
+  DictionaryIterator iter;
+  dict_read_begin_from_buffer(&iter, data, size);
+  Tuple *dump = dict_find(&iter, RECORDER_KEY);
+  if (dump && recorder_log && dump->length >= 3 * sizeof(uint32_t))
+    recorder_reply(dump);
+  Tuple *session = dict_find(&iter, TRANSFER_KEY);
+  if (!dict_find(&iter, REQUEST_CALENDAR_KEY) || !session)
+    return APP_MSG_OK;
+  if (recorder_log)
+    host_system_timer_register(RECORDER_PULL_DELAY_MS, recorder_pull_later, NULL);
+
+  syncs++;
+  time_t now = time(NULL);
+  struct tm today = *localtime(&now);
+  for (int i = 0; i < SOAK_EVENTS; i++) {
+    uint8_t header[3] = { session->value->uint8, i, i == SOAK_EVENTS - 1 };
+    uint8_t payload[1 + sizeof(Event)];
+    payload[0] = SOAK_EVENTS;
+    make_event((Event *)&payload[1], i, &today);
+
+    uint8_t message[128];
+    DictionaryIterator out;
+    dict_write_begin(&out, message, sizeof(message));
+    dict_write_data(&out, TRANSFER_KEY, header, sizeof(header));
+    dict_write_data(&out, CALENDAR_RESPONSE_KEY, payload, sizeof(payload));
+    host_deliver_inbox(PHONE_LATENCY_MS, message, dict_write_end(&out));
+  }
+  return APP_MSG_OK;
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "r:")) != -1) {
+    switch (opt) {
+      case 'r':
+        recorder_log = fopen(optarg, "w");
+        if (!recorder_log) {
+          perror(optarg);
+          return 2;
+        }
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-r phone.log] [days]\n", argv[0]);
+        return 2;
+    }
+  }
+  int days = optind < argc ? atoi(argv[optind]) : SOAK_DAYS;
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  host_reset(SOAK_EPOCH);
+  host_ui_reset();
+  host_persist_clear();
+  init();
+  host_set_outbox_handler(phone_outbox, NULL);
+  if (recorder_log)
+    recorder_pull(0);
+
+  uint32_t warmup_allocs = 0;
+  int minutes = days * 24 * 60;
+  for (int minute = 1; minute <= minutes; minute++) {
+    host_run_until((uint64_t)minute * 60000);
+
+    TimeUnits units = MINUTE_UNIT;
+    if (minute % 60 == 0)
+      units |= HOUR_UNIT;
+    if (minute % (24 * 60) == 0)
+      units |= DAY_UNIT;
+    host_tick(units);
+
+    if (minute == WARMUP_MINUTES)
+      warmup_allocs = host_stats.heap_allocs;
+  }
+  if (recorder_log)
+    recorder_pull(recorder_next);
+  host_run_until((uint64_t)minutes * 60000 + 1000);
+
+  uint32_t steady_allocs = host_stats.heap_allocs - warmup_allocs;
+  printf("days,minutes,syncs,alerts,warmup_allocs,steady_allocs,heap_peak_bytes,heap_end_bytes\n");
+  printf("%d,%d,%u,%u,%u,%u,%zu,%zu\n", days, minutes, syncs, host_stats.vibes, warmup_allocs, steady_allocs,
+         host_stats.heap_peak, host_stats.heap_current);
+
+  int status = 0;
+  if (steady_allocs != 0) {
+    fprintf(stderr, "soak_heap: %u allocations after warm-up\n", steady_allocs);
+    status = 1;
+  }
+  if (recorder_log) {
+    fclose(recorder_log);
+    if (recorder_next != recorder_told) {
+      fprintf(stderr, "soak_heap: the phone read %u of %u recorded bytes\n", recorder_next, recorder_told);
+      status = 1;
+    }
+  }
+  return status;
+}
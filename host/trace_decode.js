@@ -0,0 +1,127 @@
+/*
+ * Trace log decoder - turns the watch's trace dump into a timeline.
+ *
+ *   pebble logs | node host/trace_decode.js
+ *   node host/trace_decode.js phone.log
+ *
+ * Reads any text with "trace <hex>" lines in it, as logged by the trace dump
+ * in src/calendar_feed.js. Each line is one TRACE_DUMP_KEY reply: [first,
+ * total] as little-endian uint32s, then 12 byte TraceRecords (see common.h).
+ * Records are keyed by sequence number, so repeated or overlapping dumps
+ * merge; records the ring had already overwritten show up as a gap.
+ */
+
+var fs = require('fs');
+
+var HEADER_SIZE = 8;
+var RECORD_SIZE = 12;
+
+// Keep in step with the TRACE_* ids in common.h
+var EVENTS = {
+  1: ['boot', function (r) { return r.b + ' records before'; }],
+  2: ['transfer start', function (r) { return 'session ' + r.a; }],
+  3: ['transfer stale', function (r) { return 'session ' + r.a + (r.b < 0 ? ', none outstanding' : ', expecting ' + r.b); }],
+  4: ['transfer resume', function (r) { return 'resume ' + r.a + ', received ' + mask(r.b); }],
+  5: ['transfer abandon', function (r) { return r.a + ' events, received ' + mask(r.b); }],
+  6: ['inbox dropped', function (r) { return 'reason ' + r.b; }],
+  7: ['outbox failed', function (r) { return 'kind ' + r.a + ', reason ' + r.b; }],
+  8: ['plan', function (r) {
+    return r.a + ' events: ' + (r.b & 255) + ' reused, ' + ((r.b >>> 8) & 255) + ' moved, ' +
+           ((r.b >>> 16) & 255) + ' added, ' + ((r.b >>> 24) & 255) + ' cancelled';
+  }],
+  9: ['alert queued', function (r) { return 'event ' + r.a + ', starts in ' + duration(r.b); }],
+  10: ['alert capped', function (r) { return 'event ' + r.a + ', alert ' + r.b + ' of 10'; }],
+  11: ['countdown', function (r) { return 'event ' + r.a + ', starts in ' + duration(r.b); }],
+  12: ['alert due', function (r) { return 'event ' + r.a + (r.b ? ', ' + Math.abs(r.b) + ' ms ' + (r.b > 0 ? 'late' : 'early') : ''); }],
+  13: ['alert late', function (r) { return 'event ' + r.a + ', started ' + duration(-r.b) + ' ago'; }],
+  14: ['alert done', function (r) { return 'event ' + r.a; }],
+  15: ['timer stale', function (r) { return 'event ' + r.a + ', cookie ' + r.b; }],
+  16: ['timer unknown', function (r) { return 'cookie ' + r.b; }],
+  17: ['bluetooth', function (r) { return (r.a ? 'connected' : 'disconnected') + (r.b ? ', ' + r.b + ' flaps before' : ''); }],
+  18: ['event rejected', function (r) { return (r.a === 255 ? 'cut short' : 'index ' + r.a) + ', ' + r.b + ' bytes'; }],
+  19: ['transfer done', function (r) { return 'session ' + r.a + ' in ' + r.b + ' ms'; }],
+  20: ['power', function (r) {
+    var names = ['full', 'reduced', 'critical'];
+    return names[(r.b >>> 16) & 255] + ' -> ' + names[r.a] + ' at ' + (r.b & 255) + '%' + ((r.b >>> 8) & 1 ? ', charging' : '');
+  }]
+};
+
+function pad(n, width) {
+  var s = '' + n;
+  while (s.length < width)
+    s = '0' + s;
+  return s;
+}
+
+function mask(bits) {
+  var rows = [];
+  for (var i = 0; i < 16; i++) {
+    if (bits & (1 << i))
+      rows.push(i);
+  }
+  return '{' + rows.join(',') + '}';
+}
+
+function duration(ms) {
+  var s = Math.round(ms / 1000);
+  return Math.floor(s / 60) + 'm' + pad(s % 60, 2) + 's';
+}
+
+// Watch time is local wall-clock time, so it is printed as is
+function timestamp(r) {
+  var d = new Date(r.time * 1000);
+  return d.getUTCFullYear() + '-' + pad(d.getUTCMonth() + 1, 2) + '-' + pad(d.getUTCDate(), 2) + ' ' +
+         pad(d.getUTCHours(), 2) + ':' + pad(d.getUTCMinutes(), 2) + ':' + pad(d.getUTCSeconds(), 2) +
+         '.' + pad(r.ms, 3);
+}
+
+function parse_reply(bytes, records) {
+  var first = bytes.readUInt32LE(0);
+  for (var off = HEADER_SIZE, seq = first; off + RECORD_SIZE <= bytes.length; off += RECORD_SIZE, seq++) {
+    records[seq] = {
+      seq: seq,
+      time: bytes.readUInt32LE(off),
+      ms: bytes.readUInt16LE(off + 4),
+      id: bytes[off + 6],
+      a: bytes[off + 7],
+      b: bytes.readInt32LE(off + 8)
+    };
+  }
+  return bytes.readUInt32LE(4);
+}
+
+function decode(text) {
+  var records = {};
+  var total = 0;
+  var pattern = /trace ([0-9a-f]+)/gi;
+  var match;
+  while ((match = pattern.exec(text)) !== null) {
+    var bytes = Buffer.from(match[1], 'hex');
+    if (bytes.length >= HEADER_SIZE)
+      total = Math.max(total, parse_reply(bytes, records));
+  }
+
+  var seqs = Object.keys(records).map(Number).sort(function (a, b) { return a - b; });
+  var lines = [];
+  var expected = seqs.length ? seqs[0] : 0;
+  seqs.forEach(function (seq) {
+    var r = records[seq];
+    if (seq > expected)
+      lines.push('          ... ' + (seq - expected) + ' records missing');
+    expected = seq + 1;
+
+    var known = EVENTS[r.id];
+    lines.push(pad(seq, 8) + '  ' + timestamp(r) + '  ' +
+               (known ? known[0] + ': ' + known[1](r) : 'id ' + r.id + ': a ' + r.a + ', b ' + r.b));
+  });
+  if (expected < total)
+    lines.push('          ... ' + (total - expected) + ' records not dumped');
+  return lines;
+}
+
+if (require.main === module) {
+  var input = process.argv[2] ? fs.readFileSync(process.argv[2], 'utf8') : fs.readFileSync(0, 'utf8');
+  decode(input).forEach(function (line) { console.log(line); });
+}
+
+module.exports = { decode: decode };
@@ -6,6 +6,7 @@
 
 #include <pebble.h>
 #include "common.h"
+#include "layout.h"
 
 
 // Settings
@@ -13,38 +14,10 @@
 #define VIBE_ON_HOUR                  false
 #define TIME_SLOT_ANIMATION_DURATION  500
 
-// Magic numbers
-#define SCREEN_WIDTH        144
-#define SCREEN_HEIGHT       168
-
-#define TIME_IMAGE_WIDTH    70
-#define TIME_IMAGE_HEIGHT   70
-
-#define DATE_IMAGE_WIDTH    20
-#define DATE_IMAGE_HEIGHT   20
-
-#define SECOND_IMAGE_WIDTH  10
-#define SECOND_IMAGE_HEIGHT 10
-
-#define DAY_IMAGE_WIDTH     20
-#define DAY_IMAGE_HEIGHT    10
-
-#define MARGIN              1
-#define TIME_SLOT_SPACE     2
-#define DATE_PART_SPACE     4
-
-#define SMALL_TEXT_WIDTH    140
-#define SMALL_TEXT_HEIGHT   55
-
-// Images
-#define NUMBER_OF_TIME_IMAGES 10
-const int TIME_IMAGE_RESOURCE_IDS[NUMBER_OF_TIME_IMAGES] = {
-  RESOURCE_ID_IMAGE_TIME_0, 
-  RESOURCE_ID_IMAGE_TIME_1, RESOURCE_ID_IMAGE_TIME_2, RESOURCE_ID_IMAGE_TIME_3, 
-  RESOURCE_ID_IMAGE_TIME_4, RESOURCE_ID_IMAGE_TIME_5, RESOURCE_ID_IMAGE_TIME_6, 
-  RESOURCE_ID_IMAGE_TIME_7, RESOURCE_ID_IMAGE_TIME_8, RESOURCE_ID_IMAGE_TIME_9
-};
+// Geometry for this display, expanded from layout.h at compile time
+static const Layout layout = LAYOUT_TABLE;
 
+// Images - the time digits are runs drawn by digits.c, not bitmaps
 #define NUMBER_OF_DATE_IMAGES 10
 const int DATE_IMAGE_RESOURCE_IDS[NUMBER_OF_DATE_IMAGES] = {
   RESOURCE_ID_IMAGE_DATE_0, 
@@ -73,6 +46,8 @@ const int DAY_IMAGE_RESOURCE_IDS[NUMBER_OF_DAY_IMAGES] = {
 // General
 static Window *window;
 
+// Every digit is loaded once at startup and shared by the slots showing it
+static GBitmap *date_digit_images[NUMBER_OF_DATE_IMAGES];
 
 #define EMPTY_SLOT -1
 typedef struct Slot {
@@ -82,9 +57,13 @@ typedef struct Slot {
   int         state;
 } Slot;
 
-// Time
+// Time. Each slot is a plain layer that fills its digit's runs of ink; the
+// slides move the layer as before.
 typedef struct TimeSlot {
-  Slot              slot;
+  int               number;
+  Layer             *layer;
+  int               state; // The digit on screen
+  int               digit; // What the slot should show, kept up to date while the clock is hidden
   int               new_state;
   PropertyAnimation *slide_out_animation;
   PropertyAnimation *slide_in_animation;
@@ -94,6 +73,8 @@ typedef struct TimeSlot {
 #define NUMBER_OF_TIME_SLOTS 4
 static Layer *time_layer;
 static TimeSlot time_slots[NUMBER_OF_TIME_SLOTS];
+static bool time_suspended = false;
+static bool time_animated = true; // The power governor's call - see time_power_changed()
 static struct tm *current_time;
 
 // Footer
@@ -121,14 +102,29 @@ static Slot second_slots[NUMBER_OF_SECOND_SLOTS];
 
 // General
 void destroy_property_animation(PropertyAnimation **prop_animation);
-BitmapLayer *load_digit_image_into_slot(Slot *slot, int digit_value, Layer *parent_layer, GRect frame, const int *digit_resource_ids);
+void load_digit_images(GBitmap **digit_images, const int *digit_resource_ids, int number_of_images);
+void unload_digit_images(GBitmap **digit_images, int number_of_images);
+void create_slot_layer(Slot *slot, Layer *parent_layer, GRect frame);
+void destroy_slot_layer(Slot *slot);
+BitmapLayer *load_digit_image_into_slot(Slot *slot, int digit_value, GRect frame, GBitmap **digit_images);
 void unload_digit_image_from_slot(Slot *slot);
 
 // Time
+void create_time_slot_layer(TimeSlot *time_slot, Layer *parent_layer);
+void destroy_time_slot_layer(TimeSlot *time_slot);
+void load_digit_into_time_slot(TimeSlot *time_slot, int digit_value, GRect frame);
+void unload_digit_from_time_slot(TimeSlot *time_slot);
+void time_slot_update_proc(Layer *layer, GContext *ctx);
 void display_time(struct tm *tick_time);
 void display_time_value(int value, int row_number);
 void update_time_slot(TimeSlot *time_slot, int digit_value);
+void snap_time_slot(TimeSlot *time_slot);
+void suspend_time();
+void resume_time();
+void time_power_changed(const PowerProfile *profile);
 GRect frame_for_time_slot(TimeSlot *time_slot);
+PropertyAnimation *create_time_slot_animation(TimeSlot *time_slot, AnimationStoppedHandler stopped);
+void run_time_slot_animation(PropertyAnimation *animation, GRect from_frame, GRect to_frame);
 void slide_in_digit_image_into_time_slot(TimeSlot *time_slot, int digit_value);
 void time_slot_slide_in_animation_stopped(Animation *slide_in_animation, bool finished, void *context);
 void slide_out_digit_image_from_time_slot(TimeSlot *time_slot);
@@ -166,7 +162,6 @@ static BitmapLayer *bt_layer;
 static GBitmap *icon_bt_connected;
 static GBitmap *icon_bt_disconnected;
 static bool bt_status = false;
-static bool already_vibrated = false;
 
 // Pebble Battery Icon - ShaBP
 static BitmapLayer *battery_layer;
@@ -200,9 +195,12 @@ static int event_status_display = 0; // from ModernCalendar
 
 // timers - ShaBP
 static AppTimer *display_timer;
-static AppTimer *vibrate_timer;
 
-// General
+/*
+ * General. Bitmaps, layers and animations are all made in init() and only
+ * pointed at different digits and frames afterwards, so the heap is left
+ * alone from one minute to the next.
+ */
 void destroy_property_animation(PropertyAnimation **animation) {
   if (*animation == NULL)
     return;
@@ -215,7 +213,34 @@ void destroy_property_animation(PropertyAnimation **animation) {
   *animation = NULL;
 }
 
-BitmapLayer *load_digit_image_into_slot(Slot *slot, int digit_value, Layer *parent_layer, GRect frame, const int *digit_resource_ids) {
+void load_digit_images(GBitmap **digit_images, const int *digit_resource_ids, int number_of_images) {
+  for (int i = 0; i < number_of_images; i++)
+    digit_images[i] = gbitmap_create_with_resource(digit_resource_ids[i]);
+}
+
+void unload_digit_images(GBitmap **digit_images, int number_of_images) {
+  for (int i = 0; i < number_of_images; i++) {
+    gbitmap_destroy(digit_images[i]);
+    digit_images[i] = NULL;
+  }
+}
+
+void create_slot_layer(Slot *slot, Layer *parent_layer, GRect frame) {
+  slot->image_layer = bitmap_layer_create(frame);
+  layer_set_hidden(bitmap_layer_get_layer(slot->image_layer), true);
+  layer_add_child(parent_layer, bitmap_layer_get_layer(slot->image_layer));
+}
+
+void destroy_slot_layer(Slot *slot) {
+  if (slot->image_layer == NULL)
+    return;
+
+  layer_remove_from_parent(bitmap_layer_get_layer(slot->image_layer));
+  bitmap_layer_destroy(slot->image_layer);
+  slot->image_layer = NULL;
+}
+
+BitmapLayer *load_digit_image_into_slot(Slot *slot, int digit_value, GRect frame, GBitmap **digit_images) {
   if (digit_value < 0 || digit_value > 9)
     return NULL;
 
@@ -224,11 +249,12 @@ BitmapLayer *load_digit_image_into_slot(Slot *slot, int digit_value, Layer *pare
 
   slot->state = digit_value;
 
-  slot->image = gbitmap_create_with_resource(digit_resource_ids[digit_value]);
+  slot->image = digit_images[digit_value];
 
-  slot->image_layer = bitmap_layer_create(frame);
+  Layer *layer = bitmap_layer_get_layer(slot->image_layer);
+  layer_set_frame(layer, frame);
   bitmap_layer_set_bitmap(slot->image_layer, slot->image);
-  layer_add_child(parent_layer, bitmap_layer_get_layer(slot->image_layer));
+  layer_set_hidden(layer, false);
 
   return slot->image_layer;
 }
@@ -237,15 +263,64 @@ void unload_digit_image_from_slot(Slot *slot) {
   if (slot->state == EMPTY_SLOT)
     return;
 
-  layer_remove_from_parent(bitmap_layer_get_layer(slot->image_layer));
-  bitmap_layer_destroy(slot->image_layer);
-
-  gbitmap_destroy(slot->image);
+  layer_set_hidden(bitmap_layer_get_layer(slot->image_layer), true);
+  slot->image = NULL;
 
   slot->state = EMPTY_SLOT;
 }
 
 // Time
+void create_time_slot_layer(TimeSlot *time_slot, Layer *parent_layer) {
+  time_slot->layer = layer_create(frame_for_time_slot(time_slot));
+  layer_set_update_proc(time_slot->layer, time_slot_update_proc);
+  layer_set_hidden(time_slot->layer, true);
+  layer_add_child(parent_layer, time_slot->layer);
+}
+
+void destroy_time_slot_layer(TimeSlot *time_slot) {
+  if (time_slot->layer == NULL)
+    return;
+
+  layer_remove_from_parent(time_slot->layer);
+  layer_destroy(time_slot->layer);
+  time_slot->layer = NULL;
+}
+
+void load_digit_into_time_slot(TimeSlot *time_slot, int digit_value, GRect frame) {
+  if (digit_value < 0 || digit_value > 9 || time_slot->state != EMPTY_SLOT)
+    return;
+
+  time_slot->state = digit_value;
+  layer_set_frame(time_slot->layer, frame);
+  layer_set_hidden(time_slot->layer, false);
+  layer_mark_dirty(time_slot->layer);
+}
+
+void unload_digit_from_time_slot(TimeSlot *time_slot) {
+  if (time_slot->state == EMPTY_SLOT)
+    return;
+
+  layer_set_hidden(time_slot->layer, true);
+  time_slot->state = EMPTY_SLOT;
+}
+
+// Wherever a slide has the layer, the digit is cut off at the edge of the time area
+void time_slot_update_proc(Layer *layer, GContext *ctx) {
+  TimeSlot *time_slot = NULL;
+  for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++) {
+    if (time_slots[i].layer == layer)
+      time_slot = &time_slots[i];
+  }
+  if (time_slot == NULL || time_slot->state == EMPTY_SLOT)
+    return;
+
+  // The time area, seen from the slot's own bounds
+  GRect frame = layer_get_frame(layer);
+  GRect clip = GRect(-frame.origin.x, -frame.origin.y, layout.time_layer.size.w, layout.time_layer.size.h);
+  graphics_context_set_fill_color(ctx, GColorWhite);
+  digits_draw(ctx, time_slot->state, GPoint(0, 0), clip);
+}
+
 void display_time(struct tm *tick_time) {
   int hour = tick_time->tm_hour;
 
@@ -268,14 +343,16 @@ void display_time_value(int value, int row_number) {
 
     TimeSlot *time_slot = &time_slots[time_slot_number];
 
-    update_time_slot(time_slot, value % 10);
+    time_slot->digit = value % 10;
+    if (!time_suspended)
+      update_time_slot(time_slot, time_slot->digit);
 
     value = value / 10;
   }
 }
 
 void update_time_slot(TimeSlot *time_slot, int digit_value) {
-  if (time_slot->slot.state == digit_value)
+  if (time_slot->state == digit_value)
     return;
 
   if (time_slot->updating) {
@@ -283,9 +360,13 @@ void update_time_slot(TimeSlot *time_slot, int digit_value) {
     return;
   }
 
-  if (time_slot->slot.state == EMPTY_SLOT) {
+  if (time_slot->state == EMPTY_SLOT) {
     GRect frame = frame_for_time_slot(time_slot);
-    load_digit_image_into_slot(&time_slot->slot, digit_value, time_layer, frame, TIME_IMAGE_RESOURCE_IDS);
+    load_digit_into_time_slot(time_slot, digit_value, frame);
+  }
+  else if (!time_animated) {
+    time_slot->digit = digit_value;
+    snap_time_slot(time_slot);
   }
   else {
     time_slot->updating = true;
@@ -294,105 +375,121 @@ void update_time_slot(TimeSlot *time_slot, int digit_value) {
   }
 }
 
-GRect frame_for_time_slot(TimeSlot *time_slot) {
-  int x = MARGIN + (time_slot->slot.number % 2) * (TIME_IMAGE_WIDTH + TIME_SLOT_SPACE);
-  int y = MARGIN + (time_slot->slot.number / 2) * (TIME_IMAGE_HEIGHT + TIME_SLOT_SPACE);
-
-  return GRect(x, y, TIME_IMAGE_WIDTH, TIME_IMAGE_HEIGHT);
+// Show the slot's digit in place straight away, without animating
+void snap_time_slot(TimeSlot *time_slot) {
+  unload_digit_from_time_slot(time_slot);
+  load_digit_into_time_slot(time_slot, time_slot->digit, frame_for_time_slot(time_slot));
+  time_slot->new_state = EMPTY_SLOT;
+  time_slot->updating = false;
 }
 
-void slide_in_digit_image_into_time_slot(TimeSlot *time_slot, int digit_value) {
-  destroy_property_animation(&time_slot->slide_in_animation);
+/*
+ * While the status screen covers the clock, minute ticks only update each
+ * slot's digit. Nothing is animated or redrawn until the clock is shown
+ * again, and then it goes straight to the current time.
+ */
+void suspend_time() {
+  if (time_suspended)
+    return;
 
-  GRect to_frame = frame_for_time_slot(time_slot);
+  time_suspended = true;
+  layer_set_hidden(time_layer, true);
 
-  int from_x = to_frame.origin.x;
-  int from_y = to_frame.origin.y;
-  switch (time_slot->slot.number) {
-    case 0:
-      from_x -= TIME_IMAGE_WIDTH + MARGIN;
-      break;
-    case 1:
-      from_y -= TIME_IMAGE_HEIGHT + MARGIN;
-      break;
-    case 2:
-      from_y += TIME_IMAGE_HEIGHT + MARGIN;
-      break;
-    case 3:
-      from_x += TIME_IMAGE_WIDTH + MARGIN;
-      break;
+  // Slides stopped part way are left where they are; resume snaps every slot
+  for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++) {
+    animation_unschedule((Animation *)time_slots[i].slide_out_animation);
+    animation_unschedule((Animation *)time_slots[i].slide_in_animation);
   }
-  GRect from_frame = GRect(from_x, from_y, TIME_IMAGE_WIDTH, TIME_IMAGE_HEIGHT);
+}
+
+void resume_time() {
+  if (!time_suspended)
+    return;
+
+  time_suspended = false;
+  for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++)
+    snap_time_slot(&time_slots[i]);
+  layer_set_hidden(time_layer, false);
+}
+
+// Below the full power profile digits change in place; a slide already running finishes
+void time_power_changed(const PowerProfile *profile) {
+  time_animated = profile->animate;
+}
+
+GRect frame_for_time_slot(TimeSlot *time_slot) {
+  return layout.time_slots[time_slot->number];
+}
+
+/*
+ * One slide in and one slide out per slot, made at startup and re-aimed each
+ * time. That relies on SDK 2, which keeps a PropertyAnimation once it stops
+ * until property_animation_destroy(); SDK 3 frees it on stopping, so the
+ * pool would be scheduling freed memory there.
+ */
+#ifdef PBL_SDK_3
+#error "The time slot animations are kept and run again, which only SDK 2 allows"
+#endif
+
+// SDK 2 has no setters for the values - these stand in for SDK 3's
+static void property_animation_set_from_grect(PropertyAnimation *property_animation, GRect *from) {
+  property_animation->values.from.grect = *from;
+}
 
-  BitmapLayer *image_layer = load_digit_image_into_slot(&time_slot->slot, digit_value, time_layer, from_frame, TIME_IMAGE_RESOURCE_IDS);
+static void property_animation_set_to_grect(PropertyAnimation *property_animation, GRect *to) {
+  property_animation->values.to.grect = *to;
+}
 
-  time_slot->slide_in_animation = property_animation_create_layer_frame(bitmap_layer_get_layer(image_layer), &from_frame, &to_frame);
+PropertyAnimation *create_time_slot_animation(TimeSlot *time_slot, AnimationStoppedHandler stopped) {
+  GRect frame = frame_for_time_slot(time_slot);
+  PropertyAnimation *property_animation = property_animation_create_layer_frame(time_slot->layer, &frame, &frame);
 
-  Animation *animation = (Animation *)time_slot->slide_in_animation;
+  Animation *animation = (Animation *)property_animation;
   animation_set_duration( animation,  TIME_SLOT_ANIMATION_DURATION);
   animation_set_curve(    animation,  AnimationCurveLinear);
   animation_set_handlers( animation,  (AnimationHandlers){
-    .stopped = (AnimationStoppedHandler)time_slot_slide_in_animation_stopped
+    .stopped = stopped
   }, (void *)time_slot);
 
-  animation_schedule(animation);
+  return property_animation;
+}
+
+void run_time_slot_animation(PropertyAnimation *animation, GRect from_frame, GRect to_frame) {
+  property_animation_set_from_grect(animation, &from_frame);
+  property_animation_set_to_grect(animation, &to_frame);
+  animation_schedule((Animation *)animation);
+}
+
+void slide_in_digit_image_into_time_slot(TimeSlot *time_slot, int digit_value) {
+  GRect to_frame = frame_for_time_slot(time_slot);
+  GRect from_frame = layout.slide_in_from[time_slot->number];
+
+  load_digit_into_time_slot(time_slot, digit_value, from_frame);
+
+  run_time_slot_animation(time_slot->slide_in_animation, from_frame, to_frame);
 }
 
 void time_slot_slide_in_animation_stopped(Animation *slide_in_animation, bool finished, void *context) {
   TimeSlot *time_slot = (TimeSlot *)context;
 
-  destroy_property_animation(&time_slot->slide_in_animation);
-
   time_slot->updating = false;
 }
 
 void slide_out_digit_image_from_time_slot(TimeSlot *time_slot) {
-  destroy_property_animation(&time_slot->slide_out_animation);
-
   GRect from_frame = frame_for_time_slot(time_slot);
+  GRect to_frame = layout.slide_out_to[time_slot->number];
 
-  int to_x = from_frame.origin.x;
-  int to_y = from_frame.origin.y;
-  switch (time_slot->slot.number) {
-    case 0:
-      to_y -= TIME_IMAGE_HEIGHT + MARGIN;
-      break;
-    case 1:
-      to_x += TIME_IMAGE_WIDTH + MARGIN;
-      break;
-    case 2:
-      to_x -= TIME_IMAGE_WIDTH + MARGIN;
-      break;
-    case 3:
-      to_y += TIME_IMAGE_HEIGHT + MARGIN;
-      break;
-  }
-  GRect to_frame = GRect(to_x, to_y, TIME_IMAGE_WIDTH, TIME_IMAGE_HEIGHT);
-
-  BitmapLayer *image_layer = time_slot->slot.image_layer;
-
-  time_slot->slide_out_animation = property_animation_create_layer_frame(bitmap_layer_get_layer(image_layer), &from_frame, &to_frame);
-
-  Animation *animation = (Animation *)time_slot->slide_out_animation;
-  animation_set_duration( animation,  TIME_SLOT_ANIMATION_DURATION);
-  animation_set_curve(    animation,  AnimationCurveLinear);
-  animation_set_handlers(animation, (AnimationHandlers){
-    .stopped = (AnimationStoppedHandler)time_slot_slide_out_animation_stopped
-  }, (void *)time_slot);
-
-  animation_schedule(animation);
+  run_time_slot_animation(time_slot->slide_out_animation, from_frame, to_frame);
 }
 
 void time_slot_slide_out_animation_stopped(Animation *slide_out_animation, bool finished, void *context) {
   TimeSlot *time_slot = (TimeSlot *)context;
 
-  destroy_property_animation(&time_slot->slide_out_animation);
-
-  if (time_slot->new_state == EMPTY_SLOT) {
+  if (time_slot->new_state == EMPTY_SLOT || time_suspended) {
     time_slot->updating = false;
   }
   else {
-    unload_digit_image_from_slot(&time_slot->slot);
+    unload_digit_from_time_slot(time_slot);
 
     slide_in_digit_image_into_time_slot(time_slot, time_slot->new_state);
 
@@ -457,14 +554,8 @@ void update_date_slot(Slot *date_slot, int digit_value) {
   if (date_slot->state == digit_value)
     return;
 
-  int x = date_slot->number * (DATE_IMAGE_WIDTH + MARGIN);
-  if (date_slot->number >= 2) {
-    x += 3; // 3 extra pixels of space between the day and month
-  }
-  GRect frame =  GRect(x, 0, DATE_IMAGE_WIDTH, DATE_IMAGE_HEIGHT);
-
   unload_digit_image_from_slot(date_slot);
-  load_digit_image_into_slot(date_slot, digit_value, date_layer, frame, DATE_IMAGE_RESOURCE_IDS);
+  load_digit_image_into_slot(date_slot, digit_value, layout.date_slots[date_slot->number], date_digit_images);
 }
 
 // Seconds
@@ -566,14 +657,17 @@ void draw_event_text(){
 }
 
 void display_event_text(char *text, char *relative) {
-  strncpy(event_text2, relative, sizeof(event_text2));
+  strncpy(event_text2, relative, sizeof(event_text2) - 1);
+  event_text2[sizeof(event_text2) - 1] = '\0';
   text_layer_set_text(event_layer2, event_text2);
-  strncpy(event_text, text, sizeof(event_text));
+  strncpy(event_text, text, sizeof(event_text) - 1);
+  event_text[sizeof(event_text) - 1] = '\0';
   text_layer_set_text(event_layer, event_text);
 }
 
 // Hides status icons. Call draw of default battery/bluetooth icons (which will show or hide icon based on set logic). Hides date/window if selected
 void hide_status() {
+  recorder_wake();
   status_showing = false;
   draw_battery_icon();
   draw_bt_icon();
@@ -582,15 +676,15 @@ void hide_status() {
   draw_small_time();
   draw_event_status();
   draw_event_text();
-  layer_set_hidden(time_layer, false);
+  resume_time();
 //layer_set_hidden(bitmap_layer_get_layer(date_window_layer), hide_date);
 }
 
 // Shows status icons. Call draw of default battery/bluetooth icons (which will show or hide icon based on set logic). Shows date/window.
 void show_status() {
   status_showing = true;
-// Hide main (big) time layer
-  layer_set_hidden(time_layer, true);
+// Hide main (big) time layer, and stop animating it
+  suspend_time();
 // Redraws battery icon
   draw_battery_icon();
 // Shows current bluetooth status icon
@@ -614,48 +708,45 @@ void show_status() {
 
 // Shake/Tap Handler. On shake/tap... call "show_status" - ShaBP
 void tap_handler(AccelAxisType axis, int32_t direction) {
+  recorder_tap(axis, direction);
+  power_tap();
   show_status();
 }
 
 // Battery state handler. Updates battery level, plugged, charging states. Calls "draw_battery_icon".
 void battery_state_handler(BatteryChargeState c) {
+  recorder_battery(c);
   battery_level = c.charge_percent;
   battery_plugged = c.is_plugged;
   battery_charging = c.is_charging;
   draw_battery_icon();
+  power_battery(c);
 }
 
 void short_pulse(){
+  recorder_wake();
   vibes_short_pulse();
 }
 
-// If bluetooth is still not connected after 5 sec delay, vibrate. (double vibe was too easily confused with a signle short vibe.  Two short vibes was easier to distinguish from a notification)
-void bt_vibrate(){
-  if (!bt_status && !already_vibrated) {
-    already_vibrated = true;
+// Bluetooth connection status handler, called once per settled change (bluetooth.c waits out flaps, and a disconnect has to last 5 sec). Updates bluetooth status. Calls "draw_bt_icon". On disconnect, vibrate. (double vibe was too easily confused with a signle short vibe.  Two short vibes was easier to distinguish from a notification)
+void bt_connection_handler(bool bt, uint16_t flaps) {
+  bt_status = bt;
+  draw_bt_icon();
+  if (!bt_status) {
     app_timer_register(0, short_pulse, NULL);
     app_timer_register(350, short_pulse, NULL);
   }
 }
 
-// Bluetooth connection status handler.  Updates bluetooth status. Calls "draw_bt_icon". If bluetooth not connected, wait 5 seconds then call "bt_vibrate". Cancel any vibrate timer if status change in 5 seconds (minimizes repeat vibration alerts)
-void bt_connection_handler(bool bt) {
-  bt_status = bt;
-  draw_bt_icon();
-  app_timer_cancel(vibrate_timer);
-  if (!bt_status) vibrate_timer = app_timer_register(5000, bt_vibrate, NULL);
-  else if (bt_status && already_vibrated) already_vibrated = false;
-}
-
 // Status icon callback handler - from ModernCalendar
 void event_status_layer_update_callback(Layer *layer, GContext *ctx) { 
   graphics_context_set_compositing_mode(ctx, GCompOpAssign);
   if (event_status_display == STATUS_REQUEST) {
-     graphics_draw_bitmap_in_rect(ctx, icon_status_1, GRect(0, 0, 38, 9));
+     graphics_draw_bitmap_in_rect(ctx, icon_status_1, layout.status_icon);
   } else if (event_status_display == STATUS_REPLY) {
-     graphics_draw_bitmap_in_rect(ctx, icon_status_2, GRect(0, 0, 38, 9));
+     graphics_draw_bitmap_in_rect(ctx, icon_status_2, layout.status_icon);
   } else if (event_status_display == STATUS_ALERT_SET) {
-     graphics_draw_bitmap_in_rect(ctx, icon_status_3, GRect(0, 0, 38, 9));
+     graphics_draw_bitmap_in_rect(ctx, icon_status_3, layout.status_icon);
   }
 }
 
@@ -669,6 +760,7 @@ int main(void) {
   init();
   app_event_loop();
   deinit();
+  return 0;
 }
 
 void init() {
@@ -678,35 +770,39 @@ void init() {
 
   Layer *root_layer = window_get_root_layer(window);
 
+  trace_init();
+  recorder_init();
+
   // Time
   for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++) {
     TimeSlot *time_slot = &time_slots[i];
-    time_slot->slot.number  = i;
-    time_slot->slot.state   = EMPTY_SLOT;
+    time_slot->number       = i;
+    time_slot->state        = EMPTY_SLOT;
+    time_slot->digit        = EMPTY_SLOT;
     time_slot->new_state    = EMPTY_SLOT;
     time_slot->updating     = false;
   }
 
-  time_layer = layer_create(GRect(0, 0, SCREEN_WIDTH, SCREEN_WIDTH));
+  time_layer = layer_create(layout.time_layer);
   layer_set_clips(time_layer, true);
   layer_add_child(root_layer, time_layer);
 
-  // Footer
-  int footer_height = SCREEN_HEIGHT - SCREEN_WIDTH;
+  digits_load(RESOURCE_ID_TIME_DIGITS_RLE);
+  for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++) {
+    TimeSlot *time_slot = &time_slots[i];
+    create_time_slot_layer(time_slot, time_layer);
+    time_slot->slide_out_animation = create_time_slot_animation(time_slot, time_slot_slide_out_animation_stopped);
+    time_slot->slide_in_animation = create_time_slot_animation(time_slot, time_slot_slide_in_animation_stopped);
+  }
 
-  footer_layer = layer_create(GRect(0, SCREEN_WIDTH, SCREEN_WIDTH, footer_height));
+  // Footer
+  footer_layer = layer_create(layout.footer_layer);
   layer_add_child(root_layer, footer_layer);
 
   // Day
   day_item.loaded = false;
 
-  GRect day_layer_frame = GRect(
-    MARGIN, 
-    footer_height - DAY_IMAGE_HEIGHT - MARGIN, 
-    DAY_IMAGE_WIDTH, 
-    DAY_IMAGE_HEIGHT
-  );
-  day_item.layer = layer_create(day_layer_frame);
+  day_item.layer = layer_create(layout.day_layer);
   layer_add_child(footer_layer, day_item.layer);
 
   // Date
@@ -716,15 +812,13 @@ void init() {
     date_slot->state  = EMPTY_SLOT;
   }
 
-  GRect date_layer_frame = GRectZero;
-  date_layer_frame.size.w   = DATE_IMAGE_WIDTH + MARGIN + DATE_IMAGE_WIDTH + DATE_PART_SPACE + DATE_IMAGE_WIDTH + MARGIN + DATE_IMAGE_WIDTH;
-  date_layer_frame.size.h   = DATE_IMAGE_HEIGHT;
-  date_layer_frame.origin.x = (SCREEN_WIDTH - date_layer_frame.size.w) / 2;
-  date_layer_frame.origin.y = footer_height - DATE_IMAGE_HEIGHT - MARGIN;
-
-  date_layer = layer_create(date_layer_frame);
+  date_layer = layer_create(layout.date_layer);
   layer_add_child(footer_layer, date_layer);
 
+  load_digit_images(date_digit_images, DATE_IMAGE_RESOURCE_IDS, NUMBER_OF_DATE_IMAGES);
+  for (int i = 0; i < NUMBER_OF_DATE_SLOTS; i++)
+    create_slot_layer(&date_slots[i], date_layer, layout.date_slots[i]);
+
   // Seconds
   for (int i = 0; i < NUMBER_OF_SECOND_SLOTS; i++) {
     Slot *second_slot = &second_slots[i];
@@ -732,17 +826,11 @@ void init() {
     second_slot->state  = EMPTY_SLOT;
   }
 
-  GRect seconds_layer_frame = GRect(
-    SCREEN_WIDTH - SECOND_IMAGE_WIDTH - MARGIN - SECOND_IMAGE_WIDTH - MARGIN, 
-    footer_height - SECOND_IMAGE_HEIGHT - MARGIN, 
-    SECOND_IMAGE_WIDTH + MARGIN + SECOND_IMAGE_WIDTH, 
-    SECOND_IMAGE_HEIGHT
-  );
-  seconds_layer = layer_create(seconds_layer_frame);
+  seconds_layer = layer_create(layout.seconds_layer);
   layer_add_child(footer_layer, seconds_layer);
 
   // Small time text init (for status upon shake) - ShaBP
-  small_time_layer = text_layer_create(GRect(2, 24, SMALL_TEXT_WIDTH, SMALL_TEXT_HEIGHT));
+  small_time_layer = text_layer_create(layout.small_time);
   text_layer_set_text_color(small_time_layer, GColorWhite);
   text_layer_set_text_alignment(small_time_layer, GTextAlignmentCenter);
   text_layer_set_background_color(small_time_layer, GColorClear);
@@ -753,10 +841,12 @@ void init() {
 	// Bluetooth icon init, then call "draw_bt_icon" (doesn't call bt_connection_handler to avoid vibrate at init if bluetooth not connected)
 	icon_bt_connected = gbitmap_create_with_resource(RESOURCE_ID_BLUETOOTH_CONNECTED);
 	icon_bt_disconnected = gbitmap_create_with_resource(RESOURCE_ID_BLUETOOTH_DISCONNECTED);
-	bt_layer = bitmap_layer_create(GRect(2,2,28,24));
+	bt_layer = bitmap_layer_create(layout.bt_icon);
 	layer_add_child(root_layer, bitmap_layer_get_layer(bt_layer));
-	bt_status = bluetooth_connection_service_peek();
+	bluetooth_init();
+	bt_status = bluetooth_is_connected();
 	draw_bt_icon();
+	bluetooth_subscribe(bt_connection_handler);
 	
 	// Pebble battery icon init, then call "battery_state_handler" with current battery state
 	icon_battery_charging = gbitmap_create_with_resource(RESOURCE_ID_ICON_BATTERY_CHARGING);
@@ -770,13 +860,14 @@ void init() {
 	icon_battery_30 = gbitmap_create_with_resource(RESOURCE_ID_ICON_BATTERY_30);
 	icon_battery_20 = gbitmap_create_with_resource(RESOURCE_ID_ICON_BATTERY_20);
 	icon_battery_10 = gbitmap_create_with_resource(RESOURCE_ID_ICON_BATTERY_10);
-	battery_layer = bitmap_layer_create(GRect(SCREEN_WIDTH-41,2,41,24));
+	battery_layer = bitmap_layer_create(layout.battery_icon);
 	bitmap_layer_set_background_color(battery_layer, GColorClear);
 	layer_add_child(root_layer, bitmap_layer_get_layer(battery_layer));
+	power_init(battery_state_service_peek());
 	battery_state_handler(battery_state_service_peek());
 	
   //week status layer (ShaBP)
-  week_layer = text_layer_create(GRect(SCREEN_WIDTH/2-40, SMALL_TEXT_HEIGHT+22, 80, 30));
+  week_layer = text_layer_create(layout.week_text);
   text_layer_set_text_color(week_layer, GColorWhite);
   text_layer_set_text_alignment(week_layer, GTextAlignmentCenter);
   text_layer_set_background_color(week_layer, GColorClear);
@@ -790,7 +881,7 @@ void init() {
   icon_status_2 = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_STATUS_2);
   icon_status_3 = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_STATUS_3);
  
-  event_layer = text_layer_create(GRect(1, SMALL_TEXT_HEIGHT+44, SCREEN_WIDTH, 21));
+  event_layer = text_layer_create(layout.event_text);
   text_layer_set_text_color(event_layer, GColorWhite);
   text_layer_set_text_alignment(event_layer, GTextAlignmentCenter);
   text_layer_set_background_color(event_layer, GColorClear);
@@ -798,7 +889,7 @@ void init() {
   layer_add_child(root_layer, text_layer_get_layer(event_layer));
 	layer_set_hidden(text_layer_get_layer(event_layer), true);
 
-  event_layer2 = text_layer_create(GRect(1, SMALL_TEXT_HEIGHT+62, SCREEN_WIDTH, 21));
+  event_layer2 = text_layer_create(layout.event_relative_text);
   text_layer_set_text_color(event_layer2, GColorWhite);
   text_layer_set_text_alignment(event_layer2, GTextAlignmentCenter);
   text_layer_set_background_color(event_layer2, GColorClear);
@@ -808,26 +899,26 @@ void init() {
   //draw_event_text();
   
   // Event status layer creation - from ModernCalendar
-  GRect sframe;
-  sframe.origin.x = 54;
-  sframe.origin.y = 1;
-  sframe.size.w = 38;
-  sframe.size.h = 9;
-
-  event_status_layer = layer_create(sframe);
+  event_status_layer = layer_create(layout.event_status);
   layer_set_update_proc(event_status_layer, event_status_layer_update_callback);
   layer_add_child(root_layer, event_status_layer);
 	layer_set_hidden(event_status_layer, true);
 
   // Message inbox and Calendar init - from ModernCalendar
   app_message_register_inbox_received(received_message);
+  app_message_register_inbox_dropped(calendar_inbox_dropped);
+  outbox_init();
   app_message_open(124, 256);
 
   calendar_init();
+  bluetooth_subscribe(calendar_bluetooth_changed);
+  power_subscribe(time_power_changed);
+  power_subscribe(calendar_power_changed);
 
   // Display
   time_t now = time(NULL);
   struct tm *tick_time = localtime(&now);
+  current_time = tick_time; // A tap before the first tick draws from this
   display_time(tick_time);
 //  display_day(tick_time);
   display_date(tick_time);
@@ -835,11 +926,12 @@ void init() {
 
   tick_timer_service_subscribe(MINUTE_UNIT, handle_minute_tick);
   accel_tap_service_subscribe(tap_handler);
-  bluetooth_connection_service_subscribe(bt_connection_handler);
 	battery_state_service_subscribe(battery_state_handler);
+  recorder_start();
 }
 
 void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed) {
+  recorder_tick(tick_time, units_changed);
 //  display_seconds(tick_time);
 
 //  if ((units_changed & MINUTE_UNIT) == MINUTE_UNIT) {
@@ -847,6 +939,10 @@ void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed) {
   display_time(tick_time);
 //  }
 
+  power_minute_tick();
+  calendar_minute_tick();
+  trace_minute_tick();
+
 #if VIBE_ON_HOUR
   if ((units_changed & HOUR_UNIT) == HOUR_UNIT) {
     vibes_double_pulse();
@@ -860,13 +956,19 @@ void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed) {
 }
 
 void deinit() {
+  calendar_deinit();
+  trace_flush();
+
   // Time
   for (int i = 0; i < NUMBER_OF_TIME_SLOTS; i++) {
-    unload_digit_image_from_slot(&time_slots[i].slot);
+    unload_digit_from_time_slot(&time_slots[i]);
 
+    time_slots[i].new_state = EMPTY_SLOT; // So stopping a slide out doesn't start a slide in
     destroy_property_animation(&time_slots[i].slide_in_animation);
     destroy_property_animation(&time_slots[i].slide_out_animation);
+    destroy_time_slot_layer(&time_slots[i]);
   }
+  digits_unload();
   layer_destroy(time_layer);
 
   // Day
@@ -876,7 +978,9 @@ void deinit() {
   // Date
   for (int i = 0; i < NUMBER_OF_DATE_SLOTS; i++) {
     unload_digit_image_from_slot(&date_slots[i]);
+    destroy_slot_layer(&date_slots[i]);
   }
+  unload_digit_images(date_digit_images, NUMBER_OF_DATE_IMAGES);
   layer_destroy(date_layer);
 
   // Seconds
@@ -886,7 +990,7 @@ void deinit() {
   layer_destroy(seconds_layer);
 
   // ShaBP:
-	bluetooth_connection_service_unsubscribe();
+	bluetooth_deinit();
 	battery_state_service_unsubscribe();
 	accel_tap_service_unsubscribe();
 	bitmap_layer_destroy(battery_layer);
@@ -0,0 +1,82 @@
+#include "common.h"
+
+/*
+ * Bluetooth link state with hysteresis. The firmware reports every connect
+ * and disconnect; in lifts and on trains they come in bursts. A change only
+ * counts once it has held for BLUETOOTH_DOWN_SETTLE_MS (disconnects) or
+ * BLUETOOTH_UP_SETTLE_MS (connects), and only then are the subscribers told,
+ * once each. A change that goes back before it settles is a flap: it costs
+ * no redraw and no timer beyond the one settle timer, and is counted and
+ * passed on with the next real change.
+ */
+
+BluetoothHandler bluetooth_handlers[BLUETOOTH_MAX_HANDLERS];
+uint8_t bluetooth_handler_count = 0;
+bool bluetooth_state = true;    // Debounced - what the subscribers were last told
+bool bluetooth_pending = true;  // As last reported by the firmware
+uint16_t bluetooth_flaps = 0;   // Since the last settled change
+AppTimer *bluetooth_settle_timer = NULL;
+
+void handle_bluetooth_settled(void *data) {
+  recorder_wake();
+  bluetooth_settle_timer = NULL;
+  if (bluetooth_pending == bluetooth_state)
+    return;
+
+  bluetooth_state = bluetooth_pending;
+  trace_event(TRACE_BLUETOOTH, bluetooth_state, bluetooth_flaps);
+  for (int i = 0; i < bluetooth_handler_count; i++)
+    bluetooth_handlers[i](bluetooth_state, bluetooth_flaps);
+  bluetooth_flaps = 0;
+}
+
+void handle_bluetooth_raw(bool connected) {
+  recorder_bluetooth(connected);
+  if (connected == bluetooth_pending)
+    return;
+  bluetooth_pending = connected;
+
+  // Back where it settled - drop the change that was on its way
+  if (connected == bluetooth_state) {
+    bluetooth_flaps++;
+    if (bluetooth_settle_timer != NULL) {
+      app_timer_cancel(bluetooth_settle_timer);
+      bluetooth_settle_timer = NULL;
+    }
+    return;
+  }
+
+  uint32_t settle_ms = connected ? BLUETOOTH_UP_SETTLE_MS : BLUETOOTH_DOWN_SETTLE_MS;
+  if (bluetooth_settle_timer == NULL || !app_timer_reschedule(bluetooth_settle_timer, settle_ms))
+    bluetooth_settle_timer = app_timer_register(settle_ms, handle_bluetooth_settled, NULL);
+}
+
+/*
+ * Handlers are called in the order they subscribed, with the new state and
+ * the flaps absorbed since the last change
+ */
+void bluetooth_subscribe(BluetoothHandler handler) {
+  if (bluetooth_handler_count < BLUETOOTH_MAX_HANDLERS)
+    bluetooth_handlers[bluetooth_handler_count++] = handler;
+}
+
+bool bluetooth_is_connected() {
+  return bluetooth_state;
+}
+
+void bluetooth_init() {
+  bluetooth_handler_count = 0;
+  bluetooth_state = bluetooth_connection_service_peek();
+  bluetooth_pending = bluetooth_state;
+  bluetooth_flaps = 0;
+  bluetooth_settle_timer = NULL;
+  bluetooth_connection_service_subscribe(handle_bluetooth_raw);
+}
+
+void bluetooth_deinit() {
+  bluetooth_connection_service_unsubscribe();
+  if (bluetooth_settle_timer != NULL)
+    app_timer_cancel(bluetooth_settle_timer);
+  bluetooth_settle_timer = NULL;
+  bluetooth_handler_count = 0;
+}
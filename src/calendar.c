@@ -1,10 +1,20 @@
 #include "common.h"
 
-Event events[MAX_EVENTS];
+// The active set stays in use until a transfer into the incoming set commits
+EventText event_sets[2][MAX_EVENTS];
+EventText *events = event_sets[0];
+EventText *incoming_events = event_sets[1];
 uint8_t count;
 uint8_t received_rows;
-Event event;
-Event temp_event;
+uint16_t received_mask;
+
+// The titles both sets refer to, one copy each - slot n is id n + 1
+InternedString strings[STRINGS_MAX];
+
+// What planning reads, decoded once at receipt and kept apart from the strings
+EventHot hot_sets[2][MAX_EVENTS];
+EventHot *event_hot = hot_sets[0];
+EventHot *incoming_hot = hot_sets[1];
 char event_date[50];
 bool bt_ok = false;
 int entry_no = 0;
@@ -12,33 +22,151 @@ int max_entries = 0;
 int alerts_issued = 0;
 
 bool calendar_request_outstanding = false;
+AppTimer *calendar_timer = NULL;
+uint8_t request_ticks = 0;
+
+// What the power governor allows (see power.c) - everything, until it says otherwise
+uint8_t poll_minutes = REQUEST_CALENDAR_INTERVAL_MINUTES;
+uint8_t countdown_minutes = 1;
+bool alert_backlight = true;
+
+// Transfer session - lets a lost reply be asked for again instead of starting over
+uint8_t transfer_session = 0;
+bool transfer_resumable = false;
+uint8_t transfer_resumes = 0;
+AppTimer *transfer_timer = NULL;
+
+// Alert plan for the active set; the other one holds the previous plan while re-planning
+TimerRecord timer_sets[2][MAX_EVENTS];
+TimerRecord *timer_rec = timer_sets[0];
+TimerRecord *previous_timer_rec = timer_sets[1];
+EventHot *planned_hot = NULL;
+int previous_entries = 0;
+uint16_t planned_day_key = 0;
+int32_t plan_now_ms = 0;
+bool plan_capped = false;
+AlertPlanStats alert_plan_stats;
 
-TimerRecord timer_rec[MAX_EVENTS];
+// Link health. The times are wall clock ms, which wrap - only differences are kept.
+LinkStats link_stats;
+uint32_t link_request_ms = 0;
+uint32_t link_first_ms = 0;
+bool link_replied = false;
+uint32_t link_sync_bytes = 0;
+
+// Digest of the events last written to the store, so an unchanged set isn't written again
+uint32_t stored_digest = 0;
+
+/*
+ * Now in wall clock ms, for the link timings
+ */
+uint32_t link_now_ms() {
+  time_t seconds;
+  uint16_t ms = time_ms(&seconds, NULL);
+  return (uint32_t)seconds * 1000 + ms;
+}
 
 /*
- * Make a calendar request
+ * Make a calendar request - written by the outbox when it is this message's turn
  */
 void calendar_request(DictionaryIterator *iter) {
+  if (calendar_request_outstanding)
+    link_stats.retries++;
+  link_stats.requests++;
+  link_request_ms = link_now_ms();
+  link_replied = false;
+  link_sync_bytes = 0;
+
+  // Whatever an unfinished transfer left behind goes, so the phone sees just the active set's strings
+  for (int i = 0; i < MAX_EVENTS; i++)
+    string_release(&incoming_events[i].title);
+  uint32_t held[2] = { strings_live_mask(), strings_digest() };
+
+  transfer_session++;
   dict_write_int8(iter, REQUEST_CALENDAR_KEY, -1);
   dict_write_uint8(iter, CLOCK_STYLE_KEY, CLOCK_STYLE_24H);
+  dict_write_uint8(iter, TRANSFER_KEY, transfer_session);
+  dict_write_data(iter, STRINGS_KEY, (const uint8_t *)held, sizeof(held));
   count = 0;
   received_rows = 0;
+  received_mask = 0;
+  transfer_resumable = false;
+  transfer_resumes = 0;
   calendar_request_outstanding = true;
-  app_message_outbox_send();
+  outbox_cancel(OUTBOX_CALENDAR_RESUME);
+  restart_transfer_timer(TRANSFER_TIMEOUT_MS);
   set_event_status(STATUS_REQUEST);
+  trace_event(TRACE_TRANSFER_START, transfer_session, 0);
+}
+
+/*
+ * Ask for just the events still missing from this session
+ */
+void calendar_resume_request(DictionaryIterator *iter) {
+  uint8_t range[3] = { transfer_session, 0, TRANSFER_ALL_EVENTS };
+
+  if (count > 0) {
+    int first = 0;
+    while (first < count && (received_mask & (1 << first)))
+      first++;
+    int last = count - 1;
+    while (last > first && (received_mask & (1 << last)))
+      last--;
+    range[1] = first;
+    range[2] = last;
+  }
+
+  dict_write_data(iter, RESUME_CALENDAR_KEY, range, sizeof(range));
 }
 
+int32_t event_store_load();
+
 /*
- * Get the calendar running
+ * Link stats reply - written by the outbox when it is this message's turn
+ */
+void link_stats_write(DictionaryIterator *iter) {
+  dict_write_data(iter, LINK_STATS_KEY, (const uint8_t *)&link_stats, sizeof(link_stats));
+}
+
+/*
+ * Get the calendar running. The last sync is planned from straight away; the
+ * phone is only asked now if the next request is due anyway.
  */
 void calendar_init() {
-  app_timer_register(500, handle_calendar_timer, (void *)REQUEST_CALENDAR_KEY);
+  if (persist_read_data(LINK_STATS_PERSIST_KEY, &link_stats, sizeof(link_stats)) != sizeof(link_stats))
+    memset(&link_stats, 0, sizeof(link_stats));
+
+  // Started off the phone, polls wait for it rather than going out into a dead link
+  bt_ok = bluetooth_is_connected();
+  int32_t age = event_store_load();
+  if (age >= 0 && age < REQUEST_CALENDAR_INTERVAL_MINUTES * 60)
+    request_ticks = age / 60;
+  else if (bt_ok)
+    calendar_timer = app_timer_register(500, handle_calendar_timer, (void *)REQUEST_CALENDAR_KEY);
+  else
+    request_ticks = POWER_POLL_MINUTES_MAX; // Due under any power profile - asked for once the phone is back
+
+  // The worker keeps alerts going while another app is in front
+  AppWorkerMessage message = { 0 };
+  if (!app_worker_is_running())
+    app_worker_launch();
+  app_worker_send_message(WORKER_FACE_UP, &message);
+}
+
+/*
+ * On the way out - the store is already up to date, so the worker takes over from it
+ */
+void calendar_deinit() {
+  persist_write_data(LINK_STATS_PERSIST_KEY, &link_stats, sizeof(link_stats));
+
+  AppWorkerMessage message = { 0 };
+  app_worker_send_message(WORKER_FACE_DOWN, &message);
 }
 
 /*
  * Crude conversion of character strings to integer
  */
-int a_to_i(char *val, int len) {
+int a_to_i(const char *val, int len) {
 	int result = 0;
 	for (int i=0; i < len; i++) {
 		if (val[i] < '0' || val[i] > '9')
@@ -50,59 +178,334 @@ int a_to_i(char *val, int len) {
 }
 
 /*
- * is the date provided today?
+ * Fingerprint of the parts of an event its alert depends on
+ */
+#define EVENT_FIELD_SIZE(field) sizeof(((Event *)0)->field)
+
+uint32_t hash_bytes(uint32_t hash, const char *data, int len) {
+  for (int i = 0; i < len && data[i] != '\0'; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+uint32_t event_hash(const char *title, const char *start_date, bool all_day) {
+  uint32_t hash = 2166136261u;
+  hash = hash_bytes(hash, title, EVENT_FIELD_SIZE(title));
+  hash = hash_bytes(hash, start_date, EVENT_FIELD_SIZE(start_date));
+  hash ^= all_day;
+  hash *= 16777619u;
+  return hash;
+}
+
+/*
+ * Interned strings. A string lives while any event in either set refers to it.
+ */
+const char *string_text(uint8_t id) {
+  if (id == STRING_NONE || id > STRINGS_MAX || strings[id - 1].refs == 0)
+    return "";
+  return strings[id - 1].text;
+}
+
+bool string_equals(const InternedString *string, const char *text, int len) {
+  return strncmp(string->text, text, len) == 0 && string->text[len] == '\0';
+}
+
+/*
+ * Take a reference on id for text - free, or already holding the same text.
+ * false if it holds something else, or id or text is out of range.
+ */
+bool string_define(uint8_t id, const char *text, int len) {
+  if (id == STRING_NONE || id > STRINGS_MAX || len >= STRING_TEXT_SIZE)
+    return false;
+
+  InternedString *string = &strings[id - 1];
+  if (string->refs == 0) {
+    memcpy(string->text, text, len);
+    string->text[len] = '\0';
+  } else if (!string_equals(string, text, len)) {
+    return false;
+  }
+  string->refs++;
+  return true;
+}
+
+// Another reference to a live string
+bool string_refer(uint8_t id) {
+  if (id == STRING_NONE || id > STRINGS_MAX || strings[id - 1].refs == 0)
+    return false;
+  strings[id - 1].refs++;
+  return true;
+}
+
+/*
+ * A reference to text under whatever id holds it, or the first free one. Both
+ * sets' titles always fit, so this only comes back STRING_NONE for a bad caller.
+ */
+uint8_t string_intern(const char *text) {
+  int len = 0;
+  while (len < STRING_TEXT_SIZE - 1 && text[len] != '\0')
+    len++;
+
+  uint8_t free_id = STRING_NONE;
+  for (uint8_t id = 1; id <= STRINGS_MAX; id++) {
+    if (strings[id - 1].refs == 0) {
+      if (free_id == STRING_NONE)
+        free_id = id;
+    } else if (string_equals(&strings[id - 1], text, len)) {
+      strings[id - 1].refs++;
+      return id;
+    }
+  }
+  if (free_id != STRING_NONE)
+    string_define(free_id, text, len);
+  return free_id;
+}
+
+void string_release(uint8_t *id) {
+  if (*id != STRING_NONE && *id <= STRINGS_MAX && strings[*id - 1].refs > 0)
+    strings[*id - 1].refs--;
+  *id = STRING_NONE;
+}
+
+uint32_t strings_live_mask() {
+  uint32_t mask = 0;
+  for (int id = 1; id <= STRINGS_MAX; id++) {
+    if (strings[id - 1].refs > 0)
+      mask |= 1u << id;
+  }
+  return mask;
+}
+
+uint32_t strings_digest() {
+  uint32_t hash = 2166136261u;
+  for (int id = 1; id <= STRINGS_MAX; id++) {
+    if (strings[id - 1].refs == 0)
+      continue;
+    hash ^= id;
+    hash *= 16777619u;
+    hash = hash_bytes(hash, strings[id - 1].text, STRING_TEXT_SIZE);
+  }
+  return hash;
+}
+
+/*
+ * Day key for a "MM/DD..." date: month * 32 + day. 0 if it doesn't look like one.
+ */
+uint16_t date_day_key(const char *date) {
+  if (date[2] != '/')
+    return 0;
+  return a_to_i(&date[0], 2) * 32 + a_to_i(&date[3], 2);
+}
+
+uint16_t today_day_key() {
+  time_t rawtime;
+  time(&rawtime);
+  struct tm *time = localtime(&rawtime);
+  return (time->tm_mon + 1) * 32 + time->tm_mday;
+}
+
+/*
+ * Start time as minutes after midnight
+ */
+int16_t start_minute(const char *start_date) {
+  int time_position = 9;
+  if (start_date[5] != '/')
+		time_position = 6;
+
+  int hour = a_to_i(&start_date[time_position],2);
+  int minute_position = time_position + 3;
+  if (start_date[time_position + 1] == ':')
+	  minute_position = time_position + 2;
+  int minute = a_to_i(&start_date[minute_position],2);
+
+  return hour * 60 + minute;
+}
+
+/*
+ * Events are read in place from the message, field by field, so nothing is
+ * copied until it goes into the store
+ */
+bool event_view_init(EventView *view, const uint8_t *data, uint16_t length) {
+  if (length < sizeof(Event) || data[offsetof(Event, index)] >= MAX_EVENTS)
+    return false;
+  view->data = data;
+  return true;
+}
+
+uint8_t event_view_index(const EventView *view) {
+  return view->data[offsetof(Event, index)];
+}
+
+const char *event_view_title(const EventView *view) {
+  return (const char *)&view->data[offsetof(Event, title)];
+}
+
+const char *event_view_start_date(const EventView *view) {
+  return (const char *)&view->data[offsetof(Event, start_date)];
+}
+
+bool event_view_all_day(const EventView *view) {
+  return view->data[offsetof(Event, all_day)] != 0;
+}
+
+/*
+ * Fill in the hot record for an event as it arrives
  */
-bool is_date_today(char *date) {
-	char temp[6];
-	time_t rawtime;
-	  time(&rawtime);
-	  struct tm *time = localtime(&rawtime);
-	  strftime(temp, sizeof(temp), "%m/%d", time);
-	if (strncmp(date, temp, 5) == 0)
-		return true;
-	else
-		return false;
+void decode_hot(const char *title, const char *start_date, bool all_day, EventHot *hot) {
+  hot->hash = event_hash(title, start_date, all_day);
+  hot->day_key = date_day_key(start_date);
+  hot->start_minute = start_minute(start_date);
+  hot->flags = all_day ? EVENT_ALL_DAY : 0;
+}
+
+void decode_event_hot(const EventView *view, EventHot *hot) {
+  decode_hot(event_view_title(view), event_view_start_date(view), event_view_all_day(view), hot);
 }
 
 void set_relative_desc(int num, int32_t alert_event) {
-  // work out relative time
+  // work out relative time, in minutes rounded up - a tick a little late still says "In 2 mins"
   char relative_temp[21];
-  if (alert_event == 0)
+  int32_t minutes = alert_event > 0 ? (alert_event + 59999) / 60000 : 0;
+  if (minutes == 0)
        strncpy(relative_temp, "Now", sizeof(relative_temp));
-  else if (alert_event < 120000)
+  else if (minutes < 2)
        snprintf(relative_temp, sizeof(relative_temp), "In 1 min");
-  else if (alert_event < 3600000)
-       snprintf(relative_temp, sizeof(relative_temp), "In %ld mins", alert_event / 60000);
-  else if (alert_event < 7200000)
+  else if (minutes < 60)
+       snprintf(relative_temp, sizeof(relative_temp), "In %d mins", (int)minutes);
+  else if (minutes < 120)
        snprintf(relative_temp, sizeof(relative_temp), "In 1 hour");
   else
-       snprintf(relative_temp, sizeof(relative_temp), "In %ld hours", alert_event / 3600000);
+       snprintf(relative_temp, sizeof(relative_temp), "In %d hours", (int)(minutes / 60));
 
   strncpy(timer_rec[num].relative_desc, relative_temp, sizeof(relative_temp));
 }
 
 /*
- * Queue an alert
+ * Now as ms after midnight, to the ms - every alert decision is made against this
+ */
+int32_t ms_of_day() {
+  time_t rawtime;
+  uint16_t ms = time_ms(&rawtime, NULL);
+  struct tm *time = localtime(&rawtime);
+  return (time->tm_hour * 3600 + time->tm_min * 60 + time->tm_sec) * 1000 + ms;
+}
+
+/*
+ * Work out how long until an event starts today, in ms. Negative once it has started.
+ */
+int32_t ms_until_start(EventHot *hot) {
+  return hot->start_minute * 60000 - ms_of_day();
+}
+
+/*
+ * Queue an alert. Only the first one counts down - see start_alert_countdown().
+ */
+void queue_alert(int num, const char *title, int32_t alert_event) {
+  strncpy(timer_rec[num].event_desc, title, sizeof(timer_rec[num].event_desc) - 1);
+  timer_rec[num].event_desc[sizeof(timer_rec[num].event_desc) - 1] = '\0';
+  event_hot[num].flags |= EVENT_ALERT_ACTIVE;
+  timer_rec[num].step = ALERT_WAITING;
+  trace_event(TRACE_ALERT_QUEUED, num, alert_event);
+}
+
+/*
+ * An alert is due from ALERT_EARLY_MS before its start until ALERT_DUE_WINDOW_MS
+ * after it. Decided from the wall clock at each wake, so a late tick makes a late
+ * alert rather than a missed one.
+ */
+bool alert_is_due(int32_t alert_event) {
+  return alert_event <= ALERT_EARLY_MS && alert_event > -ALERT_DUE_WINDOW_MS;
+}
+
+/*
+ * Buzz for the lead alert, and for any others starting the same minute - they
+ * would otherwise only get their turn once the due window has passed
+ */
+void fire_alert(int num, int32_t alert_event) {
+  timer_rec[num].step = ALERT_FINISH;
+  set_relative_desc(num, 0);
+  display_event_text(timer_rec[num].event_desc, timer_rec[num].relative_desc);
+  trace_event(TRACE_ALERT_DUE, num, -alert_event);
+  vibes_double_pulse();
+  if (alert_backlight)
+    light_enable_interaction();
+
+  for (int i = num + 1; i < max_entries; i++) {
+    if (!(event_hot[i].flags & EVENT_ALERT_ACTIVE) || timer_rec[i].step == ALERT_FINISH)
+      continue;
+    int32_t also = ms_until_start(&event_hot[i]);
+    if (!alert_is_due(also))
+      break;
+    timer_rec[i].step = ALERT_FINISH;
+    trace_event(TRACE_ALERT_DUE, i, -also);
+  }
+}
+
+/*
+ * Show the next alert and start its minute countdown. The minute tick moves it on,
+ * so no timer is needed; one that is already due goes off now.
+ */
+void start_alert_countdown(int num) {
+  int32_t alert_event = ms_until_start(&event_hot[num]);
+  if (alert_is_due(alert_event)) {
+    fire_alert(num, alert_event);
+    return;
+  }
+  set_relative_desc(num, alert_event);
+  display_event_text(timer_rec[num].event_desc, timer_rec[num].relative_desc);
+  trace_event(TRACE_COUNTDOWN, num, alert_event);
+
+  timer_rec[num].step = alert_event > 0 ? ALERT_COUNTDOWN : ALERT_FINISH;
+}
+
+/*
+ * A minute on for the lead alert: update the countdown, and buzz when it's due
  */
-void queue_alert(int num, char *title, int32_t alert_event) {
-  // Create an alert
-  //timer_rec[num].handle = app_timer_register(alert_event + 30000, handle_calendar_timer, (void *)ALERT_EVENT + num);
-  strncpy(timer_rec[num].event_desc, event.title, sizeof(event.title)); 
-  timer_rec[num].active = true;
+void step_alert_countdown(int num) {
+  int32_t alert_event = ms_until_start(&event_hot[num]);
+  if (alert_is_due(alert_event)) {
+    fire_alert(num, alert_event);
+    return;
+  }
 
-  if (alerts_issued == 1) {
-       set_relative_desc(num, alert_event);
-       display_event_text(timer_rec[num].event_desc, timer_rec[num].relative_desc);
+  // Past the due window - nothing woke us in time
+  if (alert_event < 0) {
+    trace_event(TRACE_ALERT_LATE, num, alert_event);
+    timer_rec[num].step = ALERT_FINISH;
+    return;
+  }
 
-       time_t rawtime;
-       time(&rawtime);
-       struct tm *time = localtime(&rawtime);
+  // The governor may thin out the countdown
+  set_relative_desc(num, alert_event);
+  if (countdown_minutes && ((alert_event + 59999) / 60000) % countdown_minutes == 0)
+    display_event_text(timer_rec[num].event_desc, timer_rec[num].relative_desc);
+}
 
-       if (alert_event == 0) {
-            timer_rec[num].handle = app_timer_register(30000, handle_calendar_timer, (void *)ALERT_EVENT + num);
-       } else if (alert_event > 0) {
-            timer_rec[num].handle = app_timer_register(60000 - time->tm_sec * 1000, handle_calendar_timer, (void *)100 + num);
-       }
+/*
+ * The lead alert has been shown - hand over to the next one
+ */
+void finish_alert(int num) {
+  event_hot[num].flags &= ~EVENT_ALERT_ACTIVE;
+  timer_rec[num].step = ALERT_WAITING;
+  trace_event(TRACE_ALERT_DONE, num, 0);
+  for (int i = num + 1; i < max_entries; i++) {
+    if ((event_hot[i].flags & EVENT_ALERT_ACTIVE) && timer_rec[i].step == ALERT_FINISH) {
+      // Went off together with this one
+      event_hot[i].flags &= ~EVENT_ALERT_ACTIVE;
+      timer_rec[i].step = ALERT_WAITING;
+      trace_event(TRACE_ALERT_DONE, i, 0);
+      continue;
+    }
+    if (event_hot[i].flags & EVENT_ALERT_ACTIVE) {
+      timer_rec[i].step = ALERT_COUNTDOWN;
+      step_alert_countdown(i);
+      vibes_short_pulse();
+      if (alert_backlight)
+        light_enable_interaction();
+      return;
+    }
   }
 }
 
@@ -110,54 +513,37 @@ void queue_alert(int num, char *title, int32_t alert_event) {
  * Do we need an alert? if so schedule one. 
  */
 int determine_if_alarm_needed(int num) {
-  // Copy the right event across
-  memcpy(&event, &events[num], sizeof(Event));
+  EventHot *hot = &event_hot[num];
 	
   // Alarms set
   int alarms_set = 0;
 	
   // Ignore all day events
-	if (event.all_day) {
+	if (hot->flags & EVENT_ALL_DAY) {
 	  return alarms_set; 
 	}
 
   // Is the event today
-  if (is_date_today(event.start_date) == false) {
+  if (hot->day_key != planned_day_key) {
 	  return alarms_set;
   }
 
-  // Compute the event start time as a figure in ms
-  int time_position = 9;
-  if (event.start_date[5] != '/')
-		time_position = 6;
-
-  int hour = a_to_i(&event.start_date[time_position],2);
-  int minute_position = time_position + 3;
-  if (event.start_date[time_position + 1] == ':')
-	  minute_position = time_position + 2;
-  int minute = a_to_i(&event.start_date[minute_position],2);
-	
-  uint32_t event_in_ms = (hour * 3600 + minute * 60) * 1000;
-	
-  // Get now as ms
-  time_t rawtime;
-  time(&rawtime);
-  struct tm *time = localtime(&rawtime);
-  uint32_t now_in_ms = (time->tm_hour * 3600 + time->tm_min * 60 + time->tm_sec) * 1000;
-
   // Work out the alert interval  
-  int32_t alert_event = event_in_ms - now_in_ms;
+  int32_t alert_event = hot->start_minute * 60000 - plan_now_ms;
 
-  // If this is negative then we are after the alert period
-  if (alert_event >= 0) {
+  // Still worth an alert until the due window has passed
+  if (alert_event > -ALERT_DUE_WINDOW_MS) {
 
 	  // Make sure we have the resources for another alert
 	  alerts_issued++;
-	  if (alerts_issued > MAX_ALLOWABLE_ALERTS)	
+	  if (alerts_issued > MAX_ALLOWABLE_ALERTS) {
+		  plan_capped = true;
+		  trace_event(TRACE_ALERT_CAPPED, num, alerts_issued);
 		  return alarms_set;
+	  }
 
 	  // Queue alert
-	  queue_alert(num, event.title, alert_event);
+	  queue_alert(num, string_text(events[num].title), alert_event);
 	  alarms_set++;
   }
 
@@ -169,158 +555,537 @@ int determine_if_alarm_needed(int num) {
  */
 void clear_timers() {
 	for (int i=0; i < MAX_EVENTS; i++) {
-		if (timer_rec[i].active) {
-			timer_rec[i].active = false;
-			memset(timer_rec[i].event_desc, 0, sizeof(event.title));
-			app_timer_cancel(timer_rec[i].handle);
-            memset(timer_rec[i].relative_desc, 0, sizeof(event.title));
+		if (event_hot[i].flags & EVENT_ALERT_ACTIVE) {
+			event_hot[i].flags &= ~EVENT_ALERT_ACTIVE;
+			memset(timer_rec[i].event_desc, 0, sizeof(timer_rec[i].event_desc));
+			timer_rec[i].step = ALERT_WAITING;
+            memset(timer_rec[i].relative_desc, 0, sizeof(timer_rec[i].relative_desc));
+            alert_plan_stats.cancelled++;
 		}
 	}
 }
 
 /*
- * Work through events returned from iphone
+ * Find an unclaimed event in the previous set with the same fingerprint
+ */
+int find_previous_event(uint32_t hash, uint16_t claimed) {
+  for (int j = 0; j < previous_entries; j++) {
+    if (!(claimed & (1 << j)) && planned_hot[j].hash == hash)
+      return j;
+  }
+  return -1;
+}
+
+/*
+ * Work through events returned from iphone. Alerts for events that are unchanged
+ * since the last sync carry over as they are; only the differences are re-planned.
  */
 void process_events() {
-  if (calendar_request_outstanding || max_entries == 0) {
-    clear_timers();	
+  // The plan being replaced moves aside so it can be diffed against
+  TimerRecord *previous = timer_rec;
+  timer_rec = previous_timer_rec;
+  previous_timer_rec = previous;
+  memset(timer_rec, 0, sizeof(TimerRecord) * MAX_EVENTS);
+
+  // Note which alerts the last plan had running - its events may be these same ones
+  uint16_t was_active = 0;
+  for (int j = 0; j < previous_entries; j++) {
+    if (planned_hot[j].flags & EVENT_ALERT_ACTIVE)
+      was_active |= 1 << j;
+    planned_hot[j].flags &= ~EVENT_ALERT_ACTIVE;
+  }
+  for (int i = 0; i < max_entries; i++)
+    event_hot[i].flags &= ~EVENT_ALERT_ACTIVE;
+
+  // A new day means every event's date test may have changed
+  uint16_t day_key = today_day_key();
+  bool incremental = day_key == planned_day_key;
+  bool was_capped = plan_capped;
+  planned_day_key = day_key;
+  plan_now_ms = ms_of_day();
+  plan_capped = false;
+
+  alert_plan_stats.reused = 0;
+  alert_plan_stats.moved = 0;
+  alert_plan_stats.added = 0;
+  alert_plan_stats.cancelled = 0;
+
+  int alerts = 0;
+  uint16_t claimed = 0;
+  alerts_issued = 0;
+  for (int entry_no = 0; entry_no < max_entries; entry_no++) {
+    int j = incremental ? find_previous_event(event_hot[entry_no].hash, claimed) : -1;
+    if (j >= 0)
+      claimed |= 1 << j;
+
+    // New or changed - or left out last time only because the plan was full
+    if (j < 0 || (was_capped && !(was_active & (1 << j)))) {
+      int added = determine_if_alarm_needed(entry_no);
+      alert_plan_stats.added += added;
+      alerts += added;
+      continue;
+    }
+
+    if (!(was_active & (1 << j)))
+      continue; // Didn't need an alert last time, doesn't now
+    if (alerts_issued >= MAX_ALLOWABLE_ALERTS) {
+      plan_capped = true;
+      continue;
+    }
+
+    // Same event - carry its alert over, countdown and all
+    memcpy(&timer_rec[entry_no], &previous[j], sizeof(TimerRecord));
+    event_hot[entry_no].flags |= EVENT_ALERT_ACTIVE;
+    was_active &= ~(1 << j);
+    alerts_issued++;
+    alerts++;
+    if (j == entry_no)
+      alert_plan_stats.reused++;
+    else
+      alert_plan_stats.moved++;
+  }
+
+  // Whatever wasn't carried over is gone
+  for (int j = 0; j < previous_entries; j++) {
+    if (was_active & (1 << j))
+      alert_plan_stats.cancelled++;
+  }
+  memset(previous, 0, sizeof(TimerRecord) * MAX_EVENTS);
+
+  // Only the first alert counts down; the rest wait their turn
+  bool lead = true;
+  for (int i = 0; i < max_entries; i++) {
+    if (!(event_hot[i].flags & EVENT_ALERT_ACTIVE))
+      continue;
+    if (lead && timer_rec[i].step == ALERT_WAITING)
+      start_alert_countdown(i);
+    else if (!lead)
+      timer_rec[i].step = ALERT_WAITING;
+    lead = false;
+  }
+
+  alert_plan_stats.total_reused += alert_plan_stats.reused;
+  alert_plan_stats.total_moved += alert_plan_stats.moved;
+  alert_plan_stats.total_added += alert_plan_stats.added;
+  alert_plan_stats.total_cancelled += alert_plan_stats.cancelled;
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "alerts: %d reused, %d moved, %d added, %d cancelled",
+          alert_plan_stats.reused, alert_plan_stats.moved, alert_plan_stats.added, alert_plan_stats.cancelled);
+  trace_event(TRACE_PLAN, max_entries,
+              alert_plan_stats.reused | alert_plan_stats.moved << 8 |
+              alert_plan_stats.added << 16 | (uint32_t)alert_plan_stats.cancelled << 24);
+
+  planned_hot = event_hot;
+  previous_entries = max_entries;
+  if (alerts > 0) 
+    set_event_status(STATUS_ALERT_SET);
+}
+
+/*
+ * Leave the set just planned from where the worker, and the face's next launch,
+ * can find it. The header is rewritten every sync; the events only when they change.
+ */
+void event_store_save() {
+  EventStoreHeader header = { .synced = time(NULL), .digest = 2166136261u, .count = max_entries,
+                              .version = EVENT_STORE_VERSION };
+  for (int i = 0; i < max_entries; i++) {
+    header.digest ^= event_hot[i].hash;
+    header.digest *= 16777619u;
+  }
+
+  if (header.digest != stored_digest) {
+    StoredEvent chunk[EVENT_STORE_PER_KEY];
+    for (int first = 0; first < max_entries; first += EVENT_STORE_PER_KEY) {
+      int n = 0;
+      for (int i = first; i < max_entries && n < EVENT_STORE_PER_KEY; i++, n++) {
+        chunk[n].hot = event_hot[i];
+        chunk[n].hot.flags &= EVENT_ALL_DAY;
+        strncpy(chunk[n].title, string_text(events[i].title), sizeof(chunk[n].title) - 1);
+        chunk[n].title[sizeof(chunk[n].title) - 1] = '\0';
+      }
+      persist_write_data(EVENT_STORE_PERSIST_KEY + 1 + first / EVENT_STORE_PER_KEY, chunk, n * sizeof(StoredEvent));
+    }
+    stored_digest = header.digest;
+  }
+  persist_write_data(EVENT_STORE_PERSIST_KEY, &header, sizeof(header));
+}
+
+/*
+ * Plan from the set the face last saved. Returns how many seconds ago the phone
+ * sent it, or -1 if there is none.
+ */
+int32_t event_store_load() {
+  EventStoreHeader header;
+  StoredEvent stored[MAX_EVENTS];
+  if (!event_store_read(&header, stored))
+    return -1;
+
+  for (int i = 0; i < header.count; i++) {
+    stored[i].title[sizeof(stored[i].title) - 1] = '\0';
+    string_release(&events[i].title);
+    events[i].title = string_intern(stored[i].title);
+    event_hot[i] = stored[i].hot;
+    event_hot[i].flags &= EVENT_ALL_DAY;
+  }
+  max_entries = header.count;
+  stored_digest = header.digest;
+  process_events();
+  return time(NULL) - header.synced;
+}
+
+/*
+ * A reply tuple was taken. The first of a sync shows how long the phone took to start answering.
+ */
+void link_reply(Tuple *tuple) {
+  if (!link_replied) {
+    link_first_ms = link_now_ms() - link_request_ms;
+    link_replied = true;
+  }
+  link_sync_bytes += tuple->length;
+}
+
+/*
+ * Every event is in - log-bucket how long the whole sync took
+ */
+void link_sync_done() {
+  uint32_t elapsed = link_now_ms() - link_request_ms;
+  int bucket = 0;
+  while (bucket < LINK_LATENCY_BUCKETS - 1 && elapsed >= (uint32_t)LINK_LATENCY_BASE_MS << bucket)
+    bucket++;
+  link_stats.latency[bucket]++;
+  link_stats.completed++;
+  link_stats.bytes += link_sync_bytes;
+  link_stats.last_bytes = link_sync_bytes;
+  link_stats.last_first_ms = link_first_ms;
+  link_stats.last_complete_ms = elapsed;
+  trace_event(TRACE_TRANSFER_DONE, transfer_session, elapsed);
+}
+
+/*
+ * Swap the completed incoming set in and plan alerts from it
+ */
+void commit_transfer() {
+  EventText *previous = events;
+  events = incoming_events;
+  incoming_events = previous;
+  EventHot *previous_hot = event_hot;
+  event_hot = incoming_hot;
+  incoming_hot = previous_hot;
+  for (int i = 0; i < MAX_EVENTS; i++)
+    string_release(&incoming_events[i].title);
+
+  max_entries = count;
+  link_sync_done();
+  calendar_request_outstanding = false;
+  outbox_cancel(OUTBOX_CALENDAR_RESUME);
+  restart_transfer_timer(TRANSFER_PARK_MS);
+  process_events();
+  event_store_save();
+}
+
+/*
+ * Give up on this transfer; the last complete set stays active until the next poll
+ */
+void abandon_transfer() {
+  trace_event(TRACE_TRANSFER_ABANDON, count, received_mask);
+  link_stats.abandoned++;
+  calendar_request_outstanding = false;
+  outbox_cancel(OUTBOX_CALENDAR_RESUME);
+  restart_transfer_timer(TRANSFER_PARK_MS);
+  count = 0;
+  received_rows = 0;
+  received_mask = 0;
+}
+
+void handle_transfer_timer(void *data) {
+  recorder_wake();
+  transfer_timer = NULL;
+  if (!calendar_request_outstanding)
+    return;
+
+  if (transfer_resumable && transfer_resumes < MAX_TRANSFER_RESUMES) {
+    transfer_resumes++;
+    link_stats.resumes++;
+    trace_event(TRACE_TRANSFER_RESUME, transfer_resumes, received_mask);
+    outbox_queue(OUTBOX_CALENDAR_RESUME, calendar_resume_request);
+    restart_transfer_timer(TRANSFER_TIMEOUT_MS);
   } else {
-    clear_timers();	
-	int alerts = 0;
-	alerts_issued = 0;  
-    for (int entry_no = 0; entry_no < max_entries; entry_no++) 
-	  alerts = alerts + determine_if_alarm_needed(entry_no);
-	if (alerts > 0) 
-		set_event_status(STATUS_ALERT_SET);
-   }
+    abandon_transfer();
+  }
+}
+
+void restart_transfer_timer(uint32_t timeout_ms) {
+  if (transfer_timer == NULL || !app_timer_reschedule(transfer_timer, timeout_ms))
+    transfer_timer = app_timer_register(timeout_ms, handle_transfer_timer, NULL);
+}
+
+/*
+ * Store one event in the incoming set - just its title and hot record
+ */
+bool store_incoming_event(const uint8_t *data, uint16_t length) {
+  EventView view;
+  if (!event_view_init(&view, data, length) || event_view_index(&view) >= count) {
+    trace_event(TRACE_EVENT_REJECTED, data[offsetof(Event, index)], length);
+    return false;
+  }
+
+  uint8_t index = event_view_index(&view);
+  string_release(&incoming_events[index].title);
+  incoming_events[index].title = string_intern(event_view_title(&view));
+  decode_event_hot(&view, &incoming_hot[index]);
+  received_mask |= 1 << index;
+  return true;
+}
+
+/*
+ * One compact record into the incoming set. Returns its size, or 0 if it is
+ * cut short - the rest of the tuple can't be found then.
+ */
+uint16_t store_compact_event(const uint8_t *data, uint16_t length) {
+  uint16_t size = COMPACT_HEADER_SIZE;
+  const char *title = NULL;
+  uint8_t title_length = 0;
+  if (length > size && (data[1] & COMPACT_TITLE_DEFINED)) {
+    title_length = data[size];
+    title = (const char *)&data[size + 1];
+    size += 1 + title_length;
+  }
+  if (length <= size || length < size + 1 + data[size]) {
+    trace_event(TRACE_EVENT_REJECTED, 255, length);
+    return 0;
+  }
+  uint8_t start_length = data[size];
+  const uint8_t *start = &data[size + 1];
+  size += 1 + start_length;
+
+  // A whole record that can't be taken is skipped; a resume asks for it again
+  uint8_t index = data[0];
+  uint8_t id = data[2];
+  if (index >= count || start_length >= EVENT_FIELD_SIZE(start_date) ||
+      !(title ? string_define(id, title, title_length) : string_refer(id))) {
+    trace_event(TRACE_EVENT_REJECTED, index, length);
+    return size;
+  }
+
+  char start_date[EVENT_FIELD_SIZE(start_date)] = { 0 };
+  memcpy(start_date, start, start_length);
+  string_release(&incoming_events[index].title);
+  incoming_events[index].title = id;
+  decode_hot(string_text(id), start_date, data[1] & COMPACT_ALL_DAY, &incoming_hot[index]);
+  received_mask |= 1 << index;
+  return size;
+}
+
+/*
+ * A tuple of events, after a count byte if it has one, must hold whole Events.
+ * Compact records vary in size, so they are checked as they are read.
+ */
+bool event_tuple_valid(Tuple *tuple, uint16_t first) {
+  if (tuple->length < first ||
+      (tuple->key != CALENDAR_COMPACT_KEY && (tuple->length - first) % sizeof(Event) != 0)) {
+    trace_event(TRACE_EVENT_REJECTED, 255, tuple->length);
+    return false;
+  }
+  return true;
+}
+
+uint8_t incoming_rows() {
+  uint8_t rows = 0;
+  for (int i = 0; i < count; i++) {
+    if (received_mask & (1 << i))
+      rows++;
+  }
+  return rows;
+}
+
+/*
+ * Session replies carry [session, sequence, last] and always start with the count,
+ * so they can be taken in any order and gaps asked for again.
+ */
+void receive_session_message(Tuple *tuple, Tuple *transfer) {
+  uint8_t *header = transfer->value->data;
+  if (!calendar_request_outstanding || header[0] != transfer_session) {
+    trace_event(TRACE_TRANSFER_STALE, header[0], calendar_request_outstanding ? transfer_session : -1);
+    return; // Left over from an older request
+  }
+  if (!event_tuple_valid(tuple, 1))
+    return; // Asked for again when the watchdog finds the gap
+
+  link_reply(tuple);
+  set_event_status(STATUS_REPLY);
+  transfer_resumable = true;
+  const uint8_t *data = tuple->value->data;
+  count = data[0];
+  if (count > MAX_EVENTS)
+    count = MAX_EVENTS;
+
+  if (tuple->key == CALENDAR_COMPACT_KEY) {
+    uint16_t size = 1;
+    for (uint16_t j = 1; j < tuple->length && size > 0; j += size)
+      size = store_compact_event(&data[j], tuple->length - j);
+  } else {
+    for (uint16_t j = 1; j < tuple->length; j += sizeof(Event))
+      store_incoming_event(&data[j], tuple->length - j);
+  }
+
+  received_rows = incoming_rows();
+
+  if (received_rows == count)
+    commit_transfer();
+  else if (header[2])
+    restart_transfer_timer(0); // End of a burst with gaps - ask for them now
+  else
+    restart_transfer_timer(TRANSFER_TIMEOUT_MS);
+}
+
+/*
+ * Replies without a session: the first carries the count, the rest follow in order
+ */
+void receive_legacy_message(Tuple *tuple) {
+  if (!calendar_request_outstanding)
+    return;
+
+  bool continuing = count > received_rows;
+  if (!event_tuple_valid(tuple, continuing ? 0 : 1))
+    return;
+
+  link_reply(tuple);
+  set_event_status(STATUS_REPLY);
+  const uint8_t *data = tuple->value->data;
+  uint8_t i;
+  uint16_t j;
+
+  if (continuing) {
+    i = received_rows;
+    j = 0;
+  } else {
+    count = data[0];
+    if (count > MAX_EVENTS)
+      count = MAX_EVENTS;
+    i = 0;
+    j = 1;
+  }
+
+  while (i < count && j < tuple->length) {
+    store_incoming_event(&data[j], tuple->length - j);
+    i++;
+    j += sizeof(Event);
+  }
+
+  received_rows = i;
+
+  // Counted through without every index turning up means a message went missing
+  if (count == received_rows && incoming_rows() == count)
+    commit_transfer();
+  else if (count == received_rows)
+    abandon_transfer();
+  else
+    restart_transfer_timer(TRANSFER_TIMEOUT_MS);
 }
 
 /*
  * Messages incoming from the phone
  */
 void received_message(DictionaryIterator *received, void *context) {
-   // Gather the bits of a calendar together	
-   Tuple *tuple = dict_find(received, CALENDAR_RESPONSE_KEY);
-	  
-   if (tuple) {
-	    set_event_status(STATUS_REPLY);
-    	uint8_t i, j;
-
-		if (count > received_rows) {
-      		i = received_rows;
-      		j = 0;
-        } else {
-      	    count = tuple->value->data[0];
-      	    i = 0;
-      	    j = 1;
-        }
-
-        while (i < count && j < tuple->length) {
-    	    memcpy(&temp_event, &tuple->value->data[j], sizeof(Event));
-      	    memcpy(&events[temp_event.index], &temp_event, sizeof(Event));
-
-      	    i++;
-      	    j += sizeof(Event);
-        }
-
-        received_rows = i;
-
-        if (count == received_rows) {
-			    max_entries = count;
-			    calendar_request_outstanding = false;
-			          process_events();
-	    }
-	}
+  recorder_message(received);
+  Tuple *dump = dict_find(received, TRACE_DUMP_KEY);
+  if (dump)
+    trace_dump_request(dump->length >= sizeof(uint32_t) ? dump->value->uint32 : 0);
+  dump = dict_find(received, RECORDER_KEY);
+  if (dump)
+    recorder_dump_request(dump->length >= sizeof(uint32_t) ? dump->value->uint32 : 0);
+  if (dict_find(received, LINK_STATS_KEY))
+    outbox_queue(OUTBOX_LINK_STATS, link_stats_write);
 
-}
+  // Gather the bits of a calendar together. Compact replies only come with a session.
+  Tuple *compact = dict_find(received, CALENDAR_COMPACT_KEY);
+  Tuple *tuple = compact ? compact : dict_find(received, CALENDAR_RESPONSE_KEY);
+  if (!tuple)
+    return;
 
+  Tuple *transfer = dict_find(received, TRANSFER_KEY);
+  if (transfer && transfer->length >= 3)
+    receive_session_message(tuple, transfer);
+  else if (!compact)
+    receive_legacy_message(tuple);
+}
 
+/*
+ * A message didn't fit or got lost on the watch side - ask again once the burst settles
+ */
+void calendar_inbox_dropped(AppMessageResult reason, void *context) {
+  recorder_dropped(reason);
+  trace_event(TRACE_INBOX_DROPPED, 0, reason);
+  link_stats.inbox_dropped++;
+  if (calendar_request_outstanding && transfer_resumable)
+    restart_transfer_timer(TRANSFER_RESUME_DELAY_MS);
+}
 
 /*
- * Timer handling. Includes a hold off for a period of time if there is resource contention
+ * Timer handling - just the first calendar request now; everything periodic runs off the minute tick
  */
 void handle_calendar_timer(void *cookie) {
-	
-  // Show the alert and let the world know
-  if ((int)cookie >= ALERT_EVENT && (int)cookie <= ALERT_EVENT + MAX_EVENTS) {
-	  int num = (int)cookie - ALERT_EVENT;
-	  if (timer_rec[num].active == false)
-		  return; // Already had the data for this event deleted - cannot show it.
-	  timer_rec[num].active = false;
-	  for (int i = num + 1; i < max_entries; i++) {
-		  if (timer_rec[i].active == true) {
-			  handle_calendar_timer((void *)100 + i);
-			  vibes_short_pulse();
-			  light_enable_interaction();
-			  return;
-		  }
-	  }
-	  //draw_date();
+  if (calendar_timer != NULL)
+    recorder_wake(); // Rather than called straight from the tick or a reconnect
+  if ((intptr_t)cookie != REQUEST_CALENDAR_KEY) {
+	  trace_event(TRACE_TIMER_UNKNOWN, 0, (intptr_t)cookie);
 	  return;
   }
+  calendar_timer = NULL;
 
-  if ((int)cookie >= 100 && (int)cookie <= 100 + MAX_EVENTS) {
-	  int num = (int)cookie - 100;
-	  if (timer_rec[num].active == false)
-		  return; // Already had the data for this event
-	  Event event = events[num];
-	  // Compute the event start time as a figure in ms
-	  int time_position = 9;
-	  if (event.start_date[5] != '/')
-		time_position = 6;
+  // Hand the request to the outbox - it coalesces with one still waiting and backs off on failure
+  outbox_queue(OUTBOX_CALENDAR_REQUEST, calendar_request);
+  request_ticks = 0;
+}
 
-	  int hour = a_to_i(&event.start_date[time_position],2);
-	  int minute_position = time_position + 3;
-	  if (event.start_date[time_position + 1] == ':')
-		  minute_position = time_position + 2;
-	  int minute = a_to_i(&event.start_date[minute_position],2);
-
-	  uint32_t event_in_ms = (hour * 3600 + minute * 60) * 1000;
-
-	  // Get now as ms
-	  time_t rawtime;
-	  time(&rawtime);
-	  struct tm *time = localtime(&rawtime);
-	  uint32_t now_in_ms = (time->tm_hour * 3600 + time->tm_min * 60 + time->tm_sec) * 1000;
-
-	  // Work out the alert interval  
-	  int32_t alert_event = event_in_ms - now_in_ms;
-
-	  // If this is negative then we are after the alert period
-	  if (alert_event >= 0) {
-		  set_relative_desc(num, alert_event);
-		  display_event_text(timer_rec[num].event_desc, timer_rec[num].relative_desc);
-
-		  if (alert_event == 0) {
-			  timer_rec[num].handle = app_timer_register(30000, handle_calendar_timer, (void *)ALERT_EVENT + num);
-			  vibes_double_pulse();
-			  light_enable_interaction();
-		  } else if (alert_event > 0) {
-			  timer_rec[num].handle = app_timer_register(60000 - time->tm_sec * 1000, handle_calendar_timer, (void *)100 + num);
-		  }
-	  }
+/*
+ * Called every minute. Moves the lead alert on and polls the phone, without
+ * registering a timer for either - so nothing is allocated minute to minute.
+ */
+void calendar_minute_tick() {
+  // Events the last sync sent as tomorrow's are today's now
+  if (planned_day_key != 0 && today_day_key() != planned_day_key)
+    process_events();
 
-	  return;
+  for (int i = 0; i < max_entries; i++) {
+    if (!(event_hot[i].flags & EVENT_ALERT_ACTIVE))
+      continue;
+    if (timer_rec[i].step == ALERT_COUNTDOWN)
+      step_alert_countdown(i);
+    else if (timer_rec[i].step == ALERT_FINISH)
+      finish_alert(i);
+    break; // Only the lead alert moves
   }
 
-  // Server requests	  
-  if ((int)cookie != REQUEST_CALENDAR_KEY)
-	  return;
-
-  // If we're going to make a call to the phone, then a dictionary is a good idea.
-  DictionaryIterator *iter;
-  app_message_outbox_begin(&iter);
+  if (++request_ticks >= poll_minutes) {
+    if (bt_ok)
+      handle_calendar_timer((void *)REQUEST_CALENDAR_KEY);
+    else
+      request_ticks = poll_minutes; // Due - asked for once the phone is back
+  }
+}
 
-  // We didn't get a dictionary - so go away and wait until resources are available
-  if (!iter) {
-	// Can't get an dictionary then come back in a second
-    app_timer_register(1000, handle_calendar_timer, (void *)cookie);
+/*
+ * Settled Bluetooth changes, once init() has subscribed us (see bluetooth.c). A poll that fell due while the
+ * phone was away goes out when it comes back, not into the outbox's backoff.
+ */
+void calendar_bluetooth_changed(bool connected, uint16_t flaps) {
+  bt_ok = connected;
+  link_stats.flaps += flaps;
+  if (!connected) {
+    link_stats.disconnects++;
     return;
   }
+  if (request_ticks >= poll_minutes)
+    handle_calendar_timer((void *)REQUEST_CALENDAR_KEY);
+}
 
-  // Make the appropriate call to the server
-  if ((int)cookie == REQUEST_CALENDAR_KEY) {
-	calendar_request(iter);
-    app_timer_register(REQUEST_CALENDAR_INTERVAL_MS, handle_calendar_timer, (void *)cookie);
-  } 
-}
\ No newline at end of file
+/*
+ * The power governor moved to another profile (see power.c). A longer poll
+ * interval just lets request_ticks run on; a shorter one that is already
+ * overdue asks at the next tick.
+ */
+void calendar_power_changed(const PowerProfile *profile) {
+  poll_minutes = profile->poll_minutes;
+  countdown_minutes = profile->countdown_minutes;
+  alert_backlight = profile->backlight;
+}
@@ -0,0 +1,927 @@
+/*
+ * Calendar feed - PebbleKit JS companion for the watchface calendar protocol.
+ *
+ * The watch sends REQUEST_CALENDAR_KEY and expects CALENDAR_RESPONSE_KEY byte
+ * arrays of packed Event structs (see common.h) back. When the request names
+ * a transfer session, every reply carries the event count and TRANSFER_KEY,
+ * and RESUME_CALENDAR_KEY asks for a range of events again. Without one the
+ * replies use the iOS app framing: the count leads the first message only.
+ *
+ * A request with STRINGS_KEY comes from a watch that interns titles. It is
+ * answered with CALENDAR_COMPACT_KEY records instead, each defining its
+ * title under an id or referring to one the watch already holds. The feed
+ * remembers the ids it gave out, and refers to them again while the watch's
+ * digest of its strings still matches.
+ *
+ * Events come from a pluggable source ({ fetch: function (callback) }), are
+ * sorted, trimmed to the horizon and serialized ahead of time, so a request
+ * from the watch is answered straight from the cached payload.
+ *
+ * Runs under Node as well:  node src/calendar_feed.js events.ics
+ *
+ * With localStorage trace_dump set, it also reads the watch's trace log once
+ * the app is up (TRACE_DUMP_KEY) and logs each reply as a "trace <hex>" line
+ * for host/trace_decode.js. With link_stats set, it asks for the watch's sync
+ * health (LINK_STATS_KEY) and logs it as one "link ..." line. With recorder
+ * set, it reads the watch's input recording (RECORDER_KEY) when the app is up
+ * and once each calendar reply has gone out, before the ring on the watch
+ * can wrap, and logs "recorder <hex>" lines for host/replay_capture.c.
+ */
+
+// Message keys - keep in step with common.h
+var RECONNECT_KEY = 0;
+var REQUEST_CALENDAR_KEY = 1;
+var CLOCK_STYLE_KEY = 2;
+var CALENDAR_RESPONSE_KEY = 3;
+var TRANSFER_KEY = 4;
+var RESUME_CALENDAR_KEY = 5;
+var TRACE_DUMP_KEY = 6;
+var LINK_STATS_KEY = 7;
+var STRINGS_KEY = 8;
+var CALENDAR_COMPACT_KEY = 9;
+var RECORDER_KEY = 10;
+
+var CLOCK_STYLE_12H = 1;
+var CLOCK_STYLE_24H = 2;
+
+var MAX_EVENTS = 15;
+
+// Event struct layout as laid out by the watch compiler (ARM EABI)
+var EVENT_TITLE_SIZE = 21;
+var EVENT_LOCATION_SIZE = 21;
+var EVENT_START_DATE_SIZE = 18;
+var EVENT_OFFSET_INDEX = 0;
+var EVENT_OFFSET_TITLE = 1;
+var EVENT_OFFSET_HAS_LOCATION = 22;
+var EVENT_OFFSET_LOCATION = 23;
+var EVENT_OFFSET_ALL_DAY = 44;
+var EVENT_OFFSET_START_DATE = 45;
+var EVENT_OFFSET_ALARMS = 64;
+var EVENT_SIZE = 72;
+
+// Compact records and interned strings
+var STRINGS_MAX = 30;
+var STRING_TEXT_SIZE = 21;
+var COMPACT_ALL_DAY = 1;
+var COMPACT_TITLE_DEFINED = 2;
+
+// app_message_open(124, ...) on the watch, less the dictionary and tuple headers
+var WATCH_INBOX_SIZE = 124;
+var DICT_OVERHEAD = 1 + 7;
+var TRANSFER_TUPLE_SIZE = 7 + 3;
+
+var DEFAULT_HORIZON_HOURS = 24;
+var REFRESH_INTERVAL_MS = 600000;
+var SEND_RETRIES = 3;
+
+/*
+ * Helpers
+ */
+function pad2(n) {
+  return (n < 10 ? '0' : '') + n;
+}
+
+// UTF-8 bytes of a string, cut to fit max_len without splitting a character
+function utf8_bytes(str, max_len) {
+  var encoded = unescape(encodeURIComponent(str || ''));
+  var bytes = [];
+  for (var i = 0; i < encoded.length; i++)
+    bytes.push(encoded.charCodeAt(i));
+  if (bytes.length > max_len) {
+    var end = max_len;
+    while (end > 0 && (bytes[end] & 0xC0) === 0x80)
+      end--;
+    bytes.length = end;
+  }
+  return bytes;
+}
+
+function write_string(buffer, offset, size, str) {
+  var bytes = utf8_bytes(str, size - 1);
+  for (var i = 0; i < bytes.length; i++)
+    buffer[offset + i] = bytes[i];
+}
+
+function write_int32(buffer, offset, value) {
+  for (var i = 0; i < 4; i++)
+    buffer[offset + i] = (value >> (i * 8)) & 0xFF;
+}
+
+/*
+ * Format the start date the way calendar.c parses it: "MM/DD" for all day
+ * events, "MM/DD HH:MM" (or "MM/DD h:MM AM") otherwise.
+ */
+function format_start_date(ev, clock_style) {
+  var d = ev.start;
+  var date = pad2(d.getMonth() + 1) + '/' + pad2(d.getDate());
+  if (ev.allDay)
+    return date;
+
+  if (clock_style === CLOCK_STYLE_12H) {
+    var hour = d.getHours() % 12;
+    if (hour === 0)
+      hour = 12;
+    return date + ' ' + hour + ':' + pad2(d.getMinutes()) + (d.getHours() < 12 ? ' AM' : ' PM');
+  }
+  return date + ' ' + pad2(d.getHours()) + ':' + pad2(d.getMinutes());
+}
+
+function serialize_event(ev, index, clock_style) {
+  var buffer = [];
+  for (var i = 0; i < EVENT_SIZE; i++)
+    buffer.push(0);
+
+  buffer[EVENT_OFFSET_INDEX] = index;
+  write_string(buffer, EVENT_OFFSET_TITLE, EVENT_TITLE_SIZE, ev.title);
+  buffer[EVENT_OFFSET_HAS_LOCATION] = ev.location ? 1 : 0;
+  write_string(buffer, EVENT_OFFSET_LOCATION, EVENT_LOCATION_SIZE, ev.location);
+  buffer[EVENT_OFFSET_ALL_DAY] = ev.allDay ? 1 : 0;
+  write_string(buffer, EVENT_OFFSET_START_DATE, EVENT_START_DATE_SIZE, format_start_date(ev, clock_style));
+  write_int32(buffer, EVENT_OFFSET_ALARMS, ev.alarms && ev.alarms.length > 0 ? ev.alarms[0] : 0);
+  write_int32(buffer, EVENT_OFFSET_ALARMS + 4, ev.alarms && ev.alarms.length > 1 ? ev.alarms[1] : 0);
+  return buffer;
+}
+
+/*
+ * What a compact record needs of an event; the watch never reads the
+ * location or alarms.
+ */
+function compact_event(ev, index, clock_style) {
+  return {
+    index: index,
+    all_day: ev.allDay,
+    title: utf8_bytes(ev.title, STRING_TEXT_SIZE - 1),
+    start: utf8_bytes(format_start_date(ev, clock_style), EVENT_START_DATE_SIZE - 1)
+  };
+}
+
+function serialize_compact(ev, id, define) {
+  var buffer = [ev.index, (ev.all_day ? COMPACT_ALL_DAY : 0) | (define ? COMPACT_TITLE_DEFINED : 0), id];
+  if (define)
+    buffer = buffer.concat([ev.title.length], ev.title);
+  return buffer.concat([ev.start.length], ev.start);
+}
+
+/*
+ * Interned strings. The watch digests its table the way strings_digest()
+ * does: FNV-1a over each live id and its text, in id order.
+ */
+function fnv(hash, byte) {
+  return Math.imul(hash ^ byte, 16777619) >>> 0;
+}
+
+function strings_digest(table) {
+  var hash = 2166136261;
+  for (var id = 1; id <= STRINGS_MAX; id++) {
+    if (!table[id])
+      continue;
+    hash = fnv(hash, id);
+    for (var i = 0; i < table[id].length; i++)
+      hash = fnv(hash, table[id][i]);
+  }
+  return hash;
+}
+
+function find_string(table, bytes) {
+  for (var id = 1; id <= STRINGS_MAX; id++) {
+    if (table[id] && table[id].join() === bytes.join())
+      return id;
+  }
+  return 0;
+}
+
+/*
+ * Give each distinct title an id. If the watch holds the table the last
+ * session left it with, titles from it keep their ids and are only referred
+ * to; new ones take ids the watch has no string under.
+ */
+function assign_strings(compact, previous, live_mask, digest) {
+  var reuse = strings_digest(previous) === digest;
+  var strings = { table: [], ids: [], held: [] };
+
+  compact.forEach(function (ev) {
+    var id = find_string(strings.table, ev.title);
+    if (!id && reuse && (id = find_string(previous, ev.title)))
+      strings.held[id] = true;
+    for (var free = 1; !id && free <= STRINGS_MAX; free++) {
+      if (!strings.table[free] && !((live_mask >>> free) & 1))
+        id = free;
+    }
+    strings.table[id] = ev.title;
+    strings.ids.push(id);
+  });
+  return strings;
+}
+
+/*
+ * Sort by start time, drop anything before today or past the horizon, and
+ * keep at most MAX_EVENTS - the watch has no room for more. Recurring events
+ * count once for each occurrence in between.
+ */
+function select_events(events, now, horizon_hours) {
+  var day_start = new Date(now.getFullYear(), now.getMonth(), now.getDate()).getTime();
+  var horizon_end = now.getTime() + horizon_hours * 3600000;
+
+  var selected = [];
+  events.forEach(function (ev) {
+    selected = selected.concat(occurrences(ev, day_start, horizon_end));
+  });
+  selected.sort(function (a, b) {
+    return a.start.getTime() - b.start.getTime();
+  });
+  return selected.slice(0, MAX_EVENTS);
+}
+
+function pack_events(events, clock_style) {
+  return events.map(function (ev, i) {
+    return serialize_event(ev, i, clock_style);
+  });
+}
+
+function pack_compact_events(events, clock_style) {
+  return events.map(function (ev, i) {
+    return compact_event(ev, i, clock_style);
+  });
+}
+
+/*
+ * Legacy framing, as the iOS app sends it: the count leads the first message
+ * only, then as many whole events per message as the watch inbox allows.
+ */
+function build_payload(packed, inbox_size) {
+  var max_tuple = (inbox_size || WATCH_INBOX_SIZE) - DICT_OVERHEAD;
+  var messages = [];
+  var current = [packed.length];
+
+  for (var i = 0; i < packed.length; i++) {
+    if (current.length + packed[i].length > max_tuple) {
+      messages.push(current);
+      current = [];
+    }
+    current = current.concat(packed[i]);
+  }
+  messages.push(current);
+
+  return messages.map(function (msg) {
+    var dict = {};
+    dict[CALENDAR_RESPONSE_KEY] = msg;
+    return dict;
+  });
+}
+
+/*
+ * Session framing: every message leads with the count and carries
+ * TRANSFER_KEY [session, sequence, last], so the watch can take them in any
+ * order and ask again for events [first, last] if some go missing.
+ */
+function build_session_messages(packed, first, last, session, inbox_size) {
+  var max_tuple = (inbox_size || WATCH_INBOX_SIZE) - DICT_OVERHEAD - TRANSFER_TUPLE_SIZE;
+  var bodies = [];
+  var current = [packed.length];
+
+  for (var i = first; i <= last && i < packed.length; i++) {
+    if (current.length > 1 && current.length + packed[i].length > max_tuple) {
+      bodies.push(current);
+      current = [packed.length];
+    }
+    current = current.concat(packed[i]);
+  }
+  bodies.push(current);
+
+  return bodies.map(function (body, seq) {
+    var dict = {};
+    dict[CALENDAR_RESPONSE_KEY] = body;
+    dict[TRANSFER_KEY] = [session, seq & 0xFF, seq === bodies.length - 1 ? 1 : 0];
+    return dict;
+  });
+}
+
+/*
+ * Session framing for compact records. A title the watch doesn't hold yet is
+ * defined by the first record using it in each message, so every message
+ * still stands on its own.
+ */
+function build_compact_messages(compact, strings, first, last, session, inbox_size) {
+  var max_tuple = (inbox_size || WATCH_INBOX_SIZE) - DICT_OVERHEAD - TRANSFER_TUPLE_SIZE;
+  var bodies = [];
+  var current = [compact.length];
+  var defined = [];
+
+  for (var i = first; i <= last && i < compact.length; i++) {
+    var id = strings.ids[i];
+    var record = serialize_compact(compact[i], id, !strings.held[id] && !defined[id]);
+    if (current.length > 1 && current.length + record.length > max_tuple) {
+      bodies.push(current);
+      current = [compact.length];
+      defined = [];
+      record = serialize_compact(compact[i], id, !strings.held[id]);
+    }
+    current = current.concat(record);
+    defined[id] = true;
+  }
+  bodies.push(current);
+
+  return bodies.map(function (body, seq) {
+    var dict = {};
+    dict[CALENDAR_COMPACT_KEY] = body;
+    dict[TRANSFER_KEY] = [session, seq & 0xFF, seq === bodies.length - 1 ? 1 : 0];
+    return dict;
+  });
+}
+
+/*
+ * ICS source - a local stand-in for the phone calendar. The loader hands back
+ * the raw file text; fromFile() works under Node, fromUrl() on the phone.
+ *
+ * Recurring events are expanded by RRULE with FREQ, INTERVAL, COUNT, UNTIL
+ * and a plain BYDAY list, less EXDATEs and occurrences moved by a
+ * RECURRENCE-ID. Rules with anything else (BYMONTHDAY, BYSETPOS, 2MO...)
+ * only show on their first DTSTART.
+ */
+function ics_unescape(value) {
+  return value.replace(/\\n/gi, ' ').replace(/\\([,;\\])/g, '$1');
+}
+
+function ics_parse_date(value, params) {
+  var m = /^(\d{4})(\d{2})(\d{2})(?:T(\d{2})(\d{2})(\d{2})(Z?))?$/.exec(value);
+  if (!m)
+    return null;
+
+  var all_day = !m[4] || /VALUE=DATE(;|$)/.test(params);
+  if (all_day)
+    return { date: new Date(+m[1], +m[2] - 1, +m[3]), allDay: true, utc: false };
+  if (m[7] === 'Z')
+    return { date: new Date(Date.UTC(+m[1], +m[2] - 1, +m[3], +m[4], +m[5], +m[6])), allDay: false, utc: true };
+  // TZID and floating times are taken as local time
+  return { date: new Date(+m[1], +m[2] - 1, +m[3], +m[4], +m[5], +m[6]), allDay: false, utc: false };
+}
+
+var ICS_WEEKDAYS = ['SU', 'MO', 'TU', 'WE', 'TH', 'FR', 'SA'];
+
+// FREQ, INTERVAL, COUNT, UNTIL and a plain BYDAY list; null for anything else
+function ics_parse_rrule(value) {
+  var rule = { freq: null, interval: 1, count: 0, until: null, byday: null };
+  var parts = value.toUpperCase().split(';');
+  for (var i = 0; i < parts.length; i++) {
+    var kv = parts[i].split('=');
+    if (kv[0] === 'FREQ') {
+      rule.freq = kv[1];
+    } else if (kv[0] === 'INTERVAL') {
+      rule.interval = Math.max(1, +kv[1] || 1);
+    } else if (kv[0] === 'COUNT') {
+      rule.count = +kv[1] || 0;
+    } else if (kv[0] === 'UNTIL') {
+      var until = ics_parse_date(kv[1], '');
+      if (until && until.allDay)
+        until.date = new Date(until.date.getFullYear(), until.date.getMonth(), until.date.getDate() + 1, 0, 0, -1);
+      rule.until = until ? until.date : null;
+    } else if (kv[0] === 'BYDAY') {
+      rule.byday = kv[1].split(',').map(function (day) { return ICS_WEEKDAYS.indexOf(day); });
+      if (rule.byday.indexOf(-1) >= 0)
+        return null; // Numbered days (1MO, -1FR) aren't supported
+    } else if (kv[0] !== 'WKST') {
+      return null; // BYMONTHDAY, BYSETPOS and the like
+    }
+  }
+  return /^(DAILY|WEEKLY|MONTHLY|YEARLY)$/.test(rule.freq) ? rule : null;
+}
+
+// The event's time of day on another date, in the zone its start was given in
+function ics_on_day(ev, year, month, day) {
+  var s = ev.start;
+  if (ev.utc)
+    return new Date(Date.UTC(year, month, day, s.getUTCHours(), s.getUTCMinutes(), s.getUTCSeconds()));
+  return new Date(year, month, day, s.getHours(), s.getMinutes(), s.getSeconds());
+}
+
+// Starts of the rule's nth period, in order; months without the start's day are skipped
+function ics_period_starts(ev, rule, n) {
+  var s = ev.start;
+  var year = ev.utc ? s.getUTCFullYear() : s.getFullYear();
+  var month = ev.utc ? s.getUTCMonth() : s.getMonth();
+  var day = ev.utc ? s.getUTCDate() : s.getDate();
+  var step = n * rule.interval;
+
+  if (rule.freq === 'DAILY')
+    return [ics_on_day(ev, year, month, day + step)];
+  if (rule.freq === 'WEEKLY') {
+    var weekday = ev.utc ? s.getUTCDay() : s.getDay();
+    var days = (rule.byday || [weekday]).slice().sort();
+    return days.map(function (d) { return ics_on_day(ev, year, month, day + step * 7 - weekday + d); });
+  }
+  var date = rule.freq === 'MONTHLY' ? ics_on_day(ev, year, month + step, day) : ics_on_day(ev, year + step, month, day);
+  return (ev.utc ? date.getUTCDate() : date.getDate()) === day ? [date] : [];
+}
+
+/*
+ * The event once for each start in [from, to). A rule the parser didn't
+ * take leaves just the first start, as before recurrences were expanded.
+ */
+function occurrences(ev, from, to) {
+  var at = function (start) {
+    var copy = {};
+    for (var key in ev)
+      copy[key] = ev[key];
+    copy.start = start;
+    return copy;
+  };
+  if (!ev.rrule) {
+    var start = ev.start.getTime();
+    return start >= from && start < to ? [ev] : [];
+  }
+
+  var found = [];
+  var seen = 0;
+  for (var n = 0; ; n++) {
+    var starts = ics_period_starts(ev, ev.rrule, n);
+    for (var i = 0; i < starts.length; i++) {
+      var time = starts[i].getTime();
+      if (time < ev.start.getTime())
+        continue; // Earlier in the first week than the start itself
+      if (time >= to || (ev.rrule.until && time > ev.rrule.until.getTime()) ||
+          (ev.rrule.count && seen >= ev.rrule.count))
+        return found;
+      seen++;
+      if (time >= from && ev.exdates.indexOf(time) < 0)
+        found.push(at(starts[i]));
+    }
+  }
+}
+
+function ics_parse_trigger(value) {
+  var m = /^(-)?P(?:(\d+)D)?(?:T(?:(\d+)H)?(?:(\d+)M)?)?$/.exec(value);
+  if (!m)
+    return null;
+  return ((+m[2] || 0) * 1440 + (+m[3] || 0) * 60 + (+m[4] || 0)) * (m[1] ? 1 : -1);
+}
+
+function parse_ics(text) {
+  var lines = text.replace(/\r\n[ \t]/g, '').replace(/\n[ \t]/g, '').split(/\r?\n/);
+  var events = [];
+  var ev = null;
+  var in_alarm = false;
+
+  for (var i = 0; i < lines.length; i++) {
+    var line = lines[i];
+    var colon = line.indexOf(':');
+    if (colon < 0)
+      continue;
+    var name_params = line.substring(0, colon).split(';');
+    var name = name_params[0].toUpperCase();
+    var params = name_params.slice(1).join(';').toUpperCase();
+    var value = line.substring(colon + 1);
+
+    if (name === 'BEGIN' && value === 'VEVENT') {
+      ev = { title: '', location: '', allDay: false, utc: false, start: null, alarms: [], uid: '', rrule: null,
+             exdates: [], recurrence_id: null };
+    } else if (name === 'END' && value === 'VEVENT') {
+      if (ev && ev.start)
+        events.push(ev);
+      ev = null;
+    } else if (!ev) {
+      continue;
+    } else if (name === 'BEGIN' && value === 'VALARM') {
+      in_alarm = true;
+    } else if (name === 'END' && value === 'VALARM') {
+      in_alarm = false;
+    } else if (in_alarm) {
+      if (name === 'TRIGGER' && ev.alarms.length < 2) {
+        var minutes = ics_parse_trigger(value);
+        if (minutes !== null)
+          ev.alarms.push(minutes);
+      }
+    } else if (name === 'SUMMARY') {
+      ev.title = ics_unescape(value);
+    } else if (name === 'LOCATION') {
+      ev.location = ics_unescape(value);
+    } else if (name === 'DTSTART') {
+      var start = ics_parse_date(value, params);
+      if (start) {
+        ev.start = start.date;
+        ev.allDay = start.allDay;
+        ev.utc = start.utc;
+      }
+    } else if (name === 'UID') {
+      ev.uid = value;
+    } else if (name === 'RRULE') {
+      ev.rrule = ics_parse_rrule(value);
+    } else if (name === 'EXDATE') {
+      value.split(',').forEach(function (date) {
+        var excluded = ics_parse_date(date, params);
+        if (excluded)
+          ev.exdates.push(excluded.date.getTime());
+      });
+    } else if (name === 'RECURRENCE-ID') {
+      var original = ics_parse_date(value, params);
+      if (original)
+        ev.recurrence_id = original.date.getTime();
+    }
+  }
+
+  // A moved or edited occurrence comes as an event of its own, standing in for the one the rule gives
+  events.forEach(function (moved) {
+    if (moved.recurrence_id === null)
+      return;
+    events.forEach(function (series) {
+      if (series.rrule && series.uid === moved.uid)
+        series.exdates.push(moved.recurrence_id);
+    });
+  });
+  return events;
+}
+
+function IcsSource(loader) {
+  this.loader = loader;
+}
+
+IcsSource.prototype.fetch = function (callback) {
+  this.loader(function (err, text) {
+    if (err)
+      callback(err);
+    else
+      callback(null, parse_ics(text));
+  });
+};
+
+IcsSource.fromFile = function (path) {
+  return new IcsSource(function (callback) {
+    require('fs').readFile(path, 'utf8', callback);
+  });
+};
+
+IcsSource.fromUrl = function (url) {
+  return new IcsSource(function (callback) {
+    if (!url) {
+      callback(new Error('no calendar_ics_url set'));
+      return;
+    }
+    var req = new XMLHttpRequest();
+    req.open('GET', url, true);
+    req.onload = function () {
+      if (req.status === 200)
+        callback(null, req.responseText);
+      else
+        callback(new Error('HTTP ' + req.status));
+    };
+    req.onerror = function () {
+      callback(new Error('network error'));
+    };
+    req.send(null);
+  });
+};
+
+/*
+ * The feed: keeps the serialized events for the last clock style asked for
+ * and refreshes them from the source off the request path.
+ *
+ * Until the source has loaded once there is nothing to answer with - an
+ * empty reply would have the watch drop its alerts and overwrite the store
+ * its worker reads. A request that comes first waits for the load and is
+ * answered then; if the load fails it gets no answer, and the watch keeps
+ * what it had until it asks again.
+ */
+function CalendarFeed(source, options) {
+  options = options || {};
+  this.source = source;
+  this.horizon_hours = options.horizonHours || DEFAULT_HORIZON_HOURS;
+  this.inbox_size = options.inboxSize || WATCH_INBOX_SIZE;
+  this.clock_style = CLOCK_STYLE_24H;
+  this.events = [];
+  this.packed = null;
+  this.compact = null;
+  this.packed_day = -1;
+  this.strings = [];  // What the watch holds once the last compact session commits, by id
+  this.session = null;
+  this.outgoing = [];
+  this.sending = false;
+  this.loaded = false;
+  this.waiting = null;  // { payload, send_fn } of a request that came before the first load
+}
+
+CalendarFeed.prototype.refresh = function (callback) {
+  var self = this;
+  this.source.fetch(function (err, events) {
+    if (!err) {
+      self.events = events;
+      self.loaded = true;
+      self.rebuild(new Date());
+    }
+    var waiting = self.waiting;
+    self.waiting = null;
+    if (waiting && self.loaded)
+      self.handle_request(waiting.payload, waiting.send_fn);
+    if (callback)
+      callback(err, self.packed);
+  });
+};
+
+CalendarFeed.prototype.rebuild = function (now) {
+  var selected = select_events(this.events, now, this.horizon_hours);
+  this.packed = pack_events(selected, this.clock_style);
+  this.compact = pack_compact_events(selected, this.clock_style);
+  this.packed_day = now.getDate();
+};
+
+// Cached events for the request; only rebuilt when the style or day changed
+CalendarFeed.prototype.packed_for = function (clock_style, now) {
+  if (clock_style && clock_style !== this.clock_style) {
+    this.clock_style = clock_style;
+    this.packed = null;
+  }
+  if (!this.packed || this.packed_day !== now.getDate())
+    this.rebuild(now);
+  return this.packed;
+};
+
+// Send queued messages one after another, each waiting for the previous ack
+CalendarFeed.prototype.send = function (messages, send_fn) {
+  var self = this;
+  var retries = 0;
+  this.outgoing = this.outgoing.concat(messages);
+
+  function send_next() {
+    if (self.outgoing.length === 0) {
+      self.sending = false;
+      return;
+    }
+    self.sending = true;
+    send_fn(self.outgoing[0], function () {
+      self.outgoing.shift();
+      retries = 0;
+      send_next();
+    }, function () {
+      if (++retries > SEND_RETRIES) {
+        self.outgoing.shift();
+        retries = 0;
+      }
+      send_next();
+    });
+  }
+  if (!this.sending)
+    send_next();
+};
+
+function payload_value(payload, key) {
+  return payload[key] !== undefined ? payload[key] : payload['' + key];
+}
+
+CalendarFeed.prototype.handle_request = function (payload, send_fn) {
+  if (!this.loaded) {
+    this.waiting = { payload: payload, send_fn: send_fn };
+    return;
+  }
+  var packed = this.packed_for(payload_value(payload, CLOCK_STYLE_KEY), new Date());
+  var session = payload_value(payload, TRANSFER_KEY);
+  var held = payload_value(payload, STRINGS_KEY);
+
+  // A new request supersedes whatever was still queued for the last one
+  this.outgoing = [];
+  if (session === undefined) {
+    this.session = null;
+    this.send(build_payload(packed, this.inbox_size), send_fn);
+  } else if (!held || held.length < 8) {
+    // Pin the events, so a resume gets the same set even if the source refreshes
+    this.session = { id: session, packed: packed };
+    this.send(build_session_messages(packed, 0, packed.length - 1, session, this.inbox_size), send_fn);
+  } else {
+    var strings = assign_strings(this.compact, this.strings, read_uint32(held, 0), read_uint32(held, 4));
+    this.strings = strings.table;
+    this.session = { id: session, packed: packed, compact: this.compact, strings: strings };
+    this.send(build_compact_messages(this.compact, strings, 0, packed.length - 1, session, this.inbox_size), send_fn);
+  }
+};
+
+CalendarFeed.prototype.handle_resume = function (payload, send_fn) {
+  var range = payload_value(payload, RESUME_CALENDAR_KEY);
+  if (!this.session || !range || range[0] !== this.session.id)
+    return;
+  var packed = this.session.packed;
+  var last = Math.min(range[2], packed.length - 1);
+  if (this.session.compact)
+    this.send(build_compact_messages(this.session.compact, this.session.strings, range[1], last, this.session.id,
+                                     this.inbox_size), send_fn);
+  else
+    this.send(build_session_messages(packed, range[1], last, this.session.id, this.inbox_size), send_fn);
+};
+
+/*
+ * Trace log dump. Each reply starts with [first, total] as little-endian
+ * uint32s; keep asking from where it ended until the total is reached.
+ */
+function read_uint32(bytes, offset) {
+  return (bytes[offset] | (bytes[offset + 1] << 8) | (bytes[offset + 2] << 16) | (bytes[offset + 3] << 24)) >>> 0;
+}
+
+var TRACE_HEADER_SIZE = 8;
+var TRACE_RECORD_SIZE = 12;
+
+function TraceDump(log_fn) {
+  this.log = log_fn;
+}
+
+TraceDump.prototype.start = function (send_fn) {
+  var dict = {};
+  dict[TRACE_DUMP_KEY] = 0;
+  send_fn(dict);
+};
+
+TraceDump.prototype.handle_reply = function (payload, send_fn) {
+  var bytes = payload_value(payload, TRACE_DUMP_KEY);
+  if (!bytes || bytes.length < TRACE_HEADER_SIZE)
+    return;
+  this.log('trace ' + bytes.map(function (b) { return (b < 16 ? '0' : '') + b.toString(16); }).join(''));
+
+  var records = Math.floor((bytes.length - TRACE_HEADER_SIZE) / TRACE_RECORD_SIZE);
+  var next = read_uint32(bytes, 0) + records;
+  if (records > 0 && next < read_uint32(bytes, 4)) {
+    var dict = {};
+    dict[TRACE_DUMP_KEY] = next;
+    send_fn(dict);
+  }
+};
+
+/*
+ * Input recording. Each reply is [capture, first, total] as little-endian
+ * uint32s and then the bytes from first on. The capture is the watch's launch
+ * time; a new one starts again from its beginning.
+ */
+var RECORDER_HEADER_SIZE = 12;
+var RECORDER_PULL_DELAY_MS = 5000; // After a calendar request, for the reply to go out first
+
+function RecorderDump(log_fn) {
+  this.log = log_fn;
+  this.capture = null;
+  this.next = 0;
+}
+
+RecorderDump.prototype.request = function (send_fn) {
+  var dict = {};
+  dict[RECORDER_KEY] = this.next;
+  send_fn(dict);
+};
+
+RecorderDump.prototype.handle_reply = function (payload, send_fn) {
+  var bytes = payload_value(payload, RECORDER_KEY);
+  if (!bytes || bytes.length < RECORDER_HEADER_SIZE)
+    return;
+  this.log('recorder ' + bytes.map(function (b) { return (b < 16 ? '0' : '') + b.toString(16); }).join(''));
+
+  var capture = read_uint32(bytes, 0);
+  var first = read_uint32(bytes, 4);
+  if (capture !== this.capture && first !== 0) {
+    // Picked up partway through a launch we hadn't seen - go back for the start
+    this.capture = capture;
+    this.next = 0;
+    this.request(send_fn);
+    return;
+  }
+  this.capture = capture;
+  this.next = first + bytes.length - RECORDER_HEADER_SIZE;
+  if (bytes.length > RECORDER_HEADER_SIZE && this.next < read_uint32(bytes, 8))
+    this.request(send_fn);
+};
+
+/*
+ * Link health. The watch sends its LinkStats as little-endian uint32s in the
+ * order of LINK_STATS_FIELDS, then the latency histogram; bucket i counts
+ * syncs under LINK_LATENCY_BASE_MS << i, the last one everything slower.
+ */
+var LINK_STATS_FIELDS = ['requests', 'completed', 'abandoned', 'retries', 'resumes', 'inbox_dropped',
+                         'disconnects', 'flaps', 'bytes', 'last_bytes', 'last_first_ms', 'last_complete_ms'];
+var LINK_LATENCY_BUCKETS = 8;
+var LINK_LATENCY_BASE_MS = 250;
+
+function decode_link_stats(bytes) {
+  if (!bytes || bytes.length < (LINK_STATS_FIELDS.length + LINK_LATENCY_BUCKETS) * 4)
+    return null;
+  var stats = {};
+  LINK_STATS_FIELDS.forEach(function (name, i) { stats[name] = read_uint32(bytes, i * 4); });
+  stats.latency = [];
+  for (var i = 0; i < LINK_LATENCY_BUCKETS; i++)
+    stats.latency.push(read_uint32(bytes, (LINK_STATS_FIELDS.length + i) * 4));
+  return stats;
+}
+
+function format_link_stats(stats) {
+  var buckets = stats.latency.map(function (n, i) {
+    var label = i < LINK_LATENCY_BUCKETS - 1 ? '<' + (LINK_LATENCY_BASE_MS << i) : '>=' + (LINK_LATENCY_BASE_MS << (i - 1));
+    return label + ':' + n;
+  });
+  return 'link requests=' + stats.requests + ' completed=' + stats.completed + ' abandoned=' + stats.abandoned +
+         ' retries=' + stats.retries + ' resumes=' + stats.resumes + ' dropped=' + stats.inbox_dropped +
+         ' disconnects=' + stats.disconnects + ' flaps=' + stats.flaps +
+         ' bytes_per_sync=' + (stats.completed ? Math.round(stats.bytes / stats.completed) : 0) +
+         ' last_first_ms=' + stats.last_first_ms + ' last_ms=' + stats.last_complete_ms +
+         ' latency_ms ' + buckets.join(' ');
+}
+
+/*
+ * Wiring on the phone
+ */
+if (typeof Pebble !== 'undefined') {
+  var feed = new CalendarFeed(IcsSource.fromUrl(localStorage.getItem('calendar_ics_url') || ''));
+
+  var trace_dump = new TraceDump(function (line) { console.log(line); });
+  var recorder_dump = new RecorderDump(function (line) { console.log(line); });
+
+  var send_app_message = function (dict, ack, nack) {
+    Pebble.sendAppMessage(dict, ack, nack);
+  };
+
+  Pebble.addEventListener('ready', function () {
+    feed.refresh();
+    setInterval(function () { feed.refresh(); }, REFRESH_INTERVAL_MS);
+    if (localStorage.getItem('trace_dump'))
+      trace_dump.start(send_app_message);
+    if (localStorage.getItem('recorder'))
+      recorder_dump.request(send_app_message);
+    if (localStorage.getItem('link_stats')) {
+      var dict = {};
+      dict[LINK_STATS_KEY] = 0;
+      send_app_message(dict);
+    }
+  });
+
+  Pebble.addEventListener('appmessage', function (e) {
+    if (localStorage.getItem('recorder') &&
+        (payload_value(e.payload, REQUEST_CALENDAR_KEY) !== undefined || payload_value(e.payload, RESUME_CALENDAR_KEY) !== undefined))
+      setTimeout(function () { recorder_dump.request(send_app_message); }, RECORDER_PULL_DELAY_MS);
+
+    if (payload_value(e.payload, REQUEST_CALENDAR_KEY) !== undefined)
+      feed.handle_request(e.payload, send_app_message);
+    else if (payload_value(e.payload, RESUME_CALENDAR_KEY) !== undefined)
+      feed.handle_resume(e.payload, send_app_message);
+    else if (payload_value(e.payload, TRACE_DUMP_KEY) !== undefined)
+      trace_dump.handle_reply(e.payload, send_app_message);
+    else if (payload_value(e.payload, RECORDER_KEY) !== undefined)
+      recorder_dump.handle_reply(e.payload, send_app_message);
+    else if (payload_value(e.payload, LINK_STATS_KEY) !== undefined) {
+      var stats = decode_link_stats(payload_value(e.payload, LINK_STATS_KEY));
+      if (stats)
+        console.log(format_link_stats(stats));
+    }
+  });
+}
+
+/*
+ * Node: module exports and a small dump of what the watch would receive
+ */
+if (typeof module !== 'undefined' && module.exports) {
+  module.exports = {
+    CalendarFeed: CalendarFeed,
+    TraceDump: TraceDump,
+    RecorderDump: RecorderDump,
+    decode_link_stats: decode_link_stats,
+    format_link_stats: format_link_stats,
+    IcsSource: IcsSource,
+    parse_ics: parse_ics,
+    select_events: select_events,
+    pack_events: pack_events,
+    build_payload: build_payload,
+    build_session_messages: build_session_messages,
+    build_compact_messages: build_compact_messages,
+    pack_compact_events: pack_compact_events,
+    assign_strings: assign_strings,
+    strings_digest: strings_digest,
+    serialize_event: serialize_event,
+    format_start_date: format_start_date,
+    EVENT_SIZE: EVENT_SIZE,
+    CALENDAR_RESPONSE_KEY: CALENDAR_RESPONSE_KEY,
+    REQUEST_CALENDAR_KEY: REQUEST_CALENDAR_KEY,
+    CLOCK_STYLE_KEY: CLOCK_STYLE_KEY,
+    TRANSFER_KEY: TRANSFER_KEY,
+    RESUME_CALENDAR_KEY: RESUME_CALENDAR_KEY,
+    TRACE_DUMP_KEY: TRACE_DUMP_KEY,
+    LINK_STATS_KEY: LINK_STATS_KEY,
+    STRINGS_KEY: STRINGS_KEY,
+    CALENDAR_COMPACT_KEY: CALENDAR_COMPACT_KEY,
+    RECORDER_KEY: RECORDER_KEY,
+    CLOCK_STYLE_12H: CLOCK_STYLE_12H,
+    CLOCK_STYLE_24H: CLOCK_STYLE_24H
+  };
+
+  if (require.main === module) {
+    var cli_feed = new CalendarFeed(IcsSource.fromFile(process.argv[2]));
+    cli_feed.refresh(function (err, packed) {
+      if (err) {
+        console.error(err.message);
+        process.exit(1);
+      }
+      select_events(cli_feed.events, new Date(), cli_feed.horizon_hours).forEach(function (ev) {
+        console.log(format_start_date(ev, CLOCK_STYLE_24H) + '  ' + ev.title + (ev.location ? ' @ ' + ev.location : ''));
+      });
+      build_session_messages(packed, 0, packed.length - 1, 1, cli_feed.inbox_size).forEach(function (msg, i) {
+        console.log('message ' + i + ': ' + msg[CALENDAR_RESPONSE_KEY].length + ' bytes, transfer ' + JSON.stringify(msg[TRANSFER_KEY]));
+      });
+      // As a watch that interns titles gets them: first with nothing held, then on the next poll
+      var compact = cli_feed.compact;
+      var strings = assign_strings(compact, [], 0, strings_digest([]));
+      var mask = strings.ids.reduce(function (bits, id) { return (bits | (1 << id)) >>> 0; }, 0);
+      [strings, assign_strings(compact, strings.table, mask, strings_digest(strings.table))].forEach(function (held, sync) {
+        build_compact_messages(compact, held, 0, compact.length - 1, 1, cli_feed.inbox_size).forEach(function (msg, i) {
+          console.log((sync ? 'next poll' : 'compact') + ' message ' + i + ': ' + msg[CALENDAR_COMPACT_KEY].length + ' bytes');
+        });
+      });
+    });
+  }
+}
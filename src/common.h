@@ -2,6 +2,7 @@
 #define common_h
 
 #include <pebble.h>
+#include "event_store.h"
 	
 //#define INVERSE
 
@@ -9,13 +10,17 @@
 #define REQUEST_CALENDAR_KEY 1
 #define CLOCK_STYLE_KEY 2
 #define CALENDAR_RESPONSE_KEY 3
-#define ALERT_EVENT 10
+#define TRANSFER_KEY 4
+#define RESUME_CALENDAR_KEY 5
+#define TRACE_DUMP_KEY 6
+#define LINK_STATS_KEY 7
+#define STRINGS_KEY 8
+#define CALENDAR_COMPACT_KEY 9
+#define RECORDER_KEY 10
 
 #define CLOCK_STYLE_12H 1
 #define CLOCK_STYLE_24H 2
 	
-#define MAX_EVENTS 15
-
 #define STATUS_REQUEST 1
 #define STATUS_REPLY 2
 #define STATUS_ALERT_SET 3
@@ -32,20 +37,278 @@ typedef struct {
   int32_t alarms[2];
 } Event;
 
+// All the watch keeps of an Event besides its EventHot record
+typedef struct {
+  uint8_t title;  // String id, or STRING_NONE
+} EventText;
+
+/*
+ * Event strings, interned. Each distinct title is held once however many
+ * events - in either set - use it, and freed with the last. Ids are 1 to
+ * STRINGS_MAX; the phone picks them for the strings it defines, so it can
+ * refer to them again in later syncs instead of resending the text.
+ *
+ * The request carries STRINGS_KEY: [live id mask, digest] as little endian
+ * uint32s, bit n of the mask for id n. The digest covers every live id and
+ * its text; a phone holding the same table may refer to any of them.
+ */
+#define STRINGS_MAX (2 * MAX_EVENTS)  // Both sets, all titles different
+#define STRING_NONE 0
+#define STRING_TEXT_SIZE 21
+
 typedef struct {
-  AppTimer *handle;
+  char text[STRING_TEXT_SIZE];
+  uint8_t refs;
+} InternedString;
+
+const char *string_text(uint8_t id);
+void string_release(uint8_t *id);
+uint32_t strings_live_mask();
+uint32_t strings_digest();
+
+/*
+ * CALENDAR_COMPACT_KEY replies hold a count, then per event
+ *
+ *   uint8 index, flags, title id
+ *   if COMPACT_TITLE_DEFINED: uint8 length, the title (no terminator)
+ *   uint8 length, the start date (no terminator)
+ *
+ * A title the phone hasn't defined in this message must be one the watch
+ * holds already. The location and alarms, never used on the watch, are left out.
+ */
+#define COMPACT_ALL_DAY 1
+#define COMPACT_TITLE_DEFINED 2
+#define COMPACT_HEADER_SIZE 3
+
+// An Event read where it lies in the inbox buffer. event_view_init() only
+// makes one once the whole record is there and its index is in range.
+typedef struct {
+  const uint8_t *data;
+} EventView;
+
+bool event_view_init(EventView *view, const uint8_t *data, uint16_t length);
+uint8_t event_view_index(const EventView *view);
+const char *event_view_title(const EventView *view);
+const char *event_view_start_date(const EventView *view);
+bool event_view_all_day(const EventView *view);
+void decode_event_hot(const EventView *view, EventHot *hot);
+
+// What the next minute tick does for an alert; only the lead one ever leaves ALERT_WAITING
+#define ALERT_WAITING 0
+#define ALERT_COUNTDOWN 1
+#define ALERT_FINISH 2
+
+#define ALERT_EARLY_MS 250          // A wake this close before the start is on time
+#define ALERT_DUE_WINDOW_MS 60000   // After the start an alert still goes off, late, until the next tick
+
+typedef struct {
+  uint8_t step;
   char event_desc[21];
-  bool active;
   char relative_desc[21];
 } TimerRecord;
 
-#define REQUEST_CALENDAR_INTERVAL_MS 600003
+// How the last re-plan treated alerts, and running totals
+typedef struct {
+  uint8_t reused;
+  uint8_t moved;
+  uint8_t added;
+  uint8_t cancelled;
+  uint32_t total_reused;
+  uint32_t total_moved;
+  uint32_t total_added;
+  uint32_t total_cancelled;
+} AlertPlanStats;
+
+#define REQUEST_CALENDAR_INTERVAL_MINUTES 10
+
+// Resumable transfers
+#define TRANSFER_TIMEOUT_MS 10000
+#define TRANSFER_RESUME_DELAY_MS 500
+#define MAX_TRANSFER_RESUMES 3
+#define TRANSFER_ALL_EVENTS 0xFF
+// Between syncs the watchdog is pushed out past the next request rather than cancelled
+#define TRANSFER_PARK_MS ((POWER_POLL_MINUTES_MAX + 1) * 60000)
+
+// Outbound messages, most important first
+#define OUTBOX_CALENDAR_REQUEST 0
+#define OUTBOX_CALENDAR_RESUME 1
+#define OUTBOX_TRACE_DUMP 2
+#define OUTBOX_LINK_STATS 3
+#define OUTBOX_RECORDER_DUMP 4
+#define OUTBOX_KINDS 5
+
+#define OUTBOX_RETRY_BASE_MS 1000
+#define OUTBOX_RETRY_MAX_MS 60000
+#define OUTBOX_RETRY_MAX_SHIFT 6
+
+typedef void (*OutboxWriter)(DictionaryIterator *iter);
+
+// Calendar link health, kept across launches. Sent as is for LINK_STATS_KEY,
+// so the phone reads it as little-endian uint32s in this order.
+#define LINK_LATENCY_BUCKETS 8
+#define LINK_LATENCY_BASE_MS 250  // Bucket i holds syncs under 250 << i ms; the last, the rest
+#define LINK_STATS_PERSIST_KEY 30
+
+typedef struct {
+  uint32_t requests;
+  uint32_t completed;
+  uint32_t abandoned;
+  uint32_t retries;         // Requests sent again before the last was answered
+  uint32_t resumes;
+  uint32_t inbox_dropped;
+  uint32_t disconnects;     // Bluetooth, once settled
+  uint32_t flaps;           // Bluetooth changes that went back before settling
+  uint32_t bytes;           // Calendar payload received by completed syncs
+  uint32_t last_bytes;
+  uint32_t last_first_ms;   // Request to first reply, last completed sync
+  uint32_t last_complete_ms;
+  uint32_t latency[LINK_LATENCY_BUCKETS];
+} LinkStats;
+
+// Power governor - see power.c
+#define POWER_FULL 0
+#define POWER_REDUCED 1
+#define POWER_CRITICAL 2
+#define POWER_PROFILES 3
+#define POWER_REDUCED_PERCENT 20
+#define POWER_CRITICAL_PERCENT 10
+#define POWER_HYSTERESIS_PERCENT 10
+#define POWER_ACTIVE_MINUTES 2      // A tap keeps the reduced profile at full this long
+#define POWER_POLL_MINUTES_MAX 60
+#define POWER_MAX_HANDLERS 3
+
+typedef struct {
+  bool animate;                // Slide the time digits rather than snapping them
+  bool backlight;              // Light up for alerts
+  uint8_t poll_minutes;        // Between calendar requests
+  uint8_t countdown_minutes;   // Between countdown redraws; 0 for only when the event is due
+} PowerProfile;
+
+typedef void (*PowerHandler)(const PowerProfile *profile);
+
+void power_init(BatteryChargeState charge);
+void power_battery(BatteryChargeState charge);
+void power_tap();
+void power_minute_tick();
+void power_subscribe(PowerHandler handler);
+int power_profile();
 
 void calendar_init();
+void calendar_deinit();
 void handle_calendar_timer(void *cookie);
+void calendar_minute_tick();
+void calendar_bluetooth_changed(bool connected, uint16_t flaps);
+void calendar_power_changed(const PowerProfile *profile);
 void display_event_text(char *text, char *relative);
 //void draw_date();
 void received_message(DictionaryIterator *received, void *context);
+void calendar_inbox_dropped(AppMessageResult reason, void *context);
+void restart_transfer_timer(uint32_t timeout_ms);
 void set_event_status(int new_status_display);
 
+// Bluetooth link state, debounced - see bluetooth.c
+#define BLUETOOTH_DOWN_SETTLE_MS 5000
+#define BLUETOOTH_UP_SETTLE_MS 2000
+#define BLUETOOTH_MAX_HANDLERS 3
+
+typedef void (*BluetoothHandler)(bool connected, uint16_t flaps);
+
+void bluetooth_init();
+void bluetooth_deinit();
+void bluetooth_subscribe(BluetoothHandler handler);
+bool bluetooth_is_connected();
+
+void outbox_init();
+void outbox_queue(int kind, OutboxWriter writer);
+void outbox_cancel(int kind);
+bool outbox_is_pending(int kind);
+
+// Trace log - see trace.c. Record ids are fixed; host/trace_decode.js knows them.
+#define TRACE_BOOT 1              // a: -, b: records written before this boot
+#define TRACE_TRANSFER_START 2    // a: session
+#define TRACE_TRANSFER_STALE 3    // a: session in the message, b: current session, or -1 if none outstanding
+#define TRACE_TRANSFER_RESUME 4   // a: resumes so far, b: received mask
+#define TRACE_TRANSFER_ABANDON 5  // a: event count, b: received mask
+#define TRACE_INBOX_DROPPED 6     // b: AppMessageResult
+#define TRACE_OUTBOX_FAILED 7     // a: outbox kind, b: AppMessageResult
+#define TRACE_PLAN 8              // a: events, b: reused | moved << 8 | added << 16 | cancelled << 24
+#define TRACE_ALERT_QUEUED 9      // a: event, b: ms until start
+#define TRACE_ALERT_CAPPED 10     // a: event, b: alerts issued
+#define TRACE_COUNTDOWN 11        // a: event, b: ms until start
+#define TRACE_ALERT_DUE 12        // a: event, b: ms after the start it went off (negative if early)
+#define TRACE_ALERT_LATE 13       // a: event, b: ms until start (negative)
+#define TRACE_ALERT_DONE 14       // a: event
+#define TRACE_TIMER_STALE 15      // a: event, b: cookie (alert timers before they moved to the minute tick)
+#define TRACE_TIMER_UNKNOWN 16    // b: cookie
+#define TRACE_BLUETOOTH 17        // a: connected, b: flaps absorbed since the last change
+#define TRACE_EVENT_REJECTED 18   // a: event index, or 255 if the tuple was cut short, b: bytes left in the tuple
+#define TRACE_TRANSFER_DONE 19    // a: session, b: ms from request to the last event
+#define TRACE_POWER 20            // a: new profile, b: battery percent | charging << 8 | old profile << 16
+
+#define TRACE_CAPACITY 96
+#define TRACE_CHUNK_RECORDS 16    // per persist key, and per dump message
+#define TRACE_CHUNKS (TRACE_CAPACITY / TRACE_CHUNK_RECORDS)
+#define TRACE_PERSIST_KEY 10      // record count; the chunks follow at 11 onwards
+#define TRACE_FLUSH_INTERVAL_MINUTES 5
+
+typedef struct {
+  uint32_t time;
+  uint16_t ms;
+  uint8_t id;
+  uint8_t a;
+  int32_t b;
+} TraceRecord;
+
+void trace_init();
+void trace_event(uint8_t id, uint8_t a, int32_t b);
+void trace_flush();
+void trace_minute_tick();
+void trace_dump_request(uint32_t first);
+
+// Input recorder - see recorder.c. Record kinds are fixed; host/replay_capture.c knows them.
+// Each record is the kind, the ms since the record before as a varint, then:
+#define RECORD_START 1      // uint8 version, uint32 time, uint16 ms, int16 minutes east of UTC, uint8 battery percent, uint8 RECORD_ flags
+#define RECORD_PERSIST 2    // uint8 key, varint length, the data - the event store as init() reads it
+#define RECORD_TICK 3       // uint8 units changed, varint timer wakeups since the last tick, uint16 decision digest
+#define RECORD_TAP 4        // uint8 axis, int8 direction
+#define RECORD_BLUETOOTH 5  // uint8 connected, as the firmware reported it
+#define RECORD_BATTERY 6    // uint8 percent, uint8 RECORD_ flags
+#define RECORD_MESSAGE 7    // varint length, the dictionary as received
+#define RECORD_DROPPED 8    // varint AppMessageResult
+#define RECORD_SENT 9       // -
+#define RECORD_FAILED 10    // varint AppMessageResult
+#define RECORD_ZONE 11      // int16 minutes east of UTC, before the tick that found it changed
+
+#define RECORD_CHARGING 1
+#define RECORD_PLUGGED 2
+#define RECORD_CONNECTED 4
+#define RECORD_24H 8
+
+#define RECORDER_VERSION 1
+#define RECORDER_BYTES 2048       // A launch with a full event store takes about 800; how far the rest goes is in recorder.c
+#define RECORDER_DUMP_BYTES 224   // per dump message after [capture, first, total]; fills the 256 byte outbox
+
+void recorder_init();
+void recorder_start();
+void recorder_wake();
+void recorder_note(uint8_t id, uint8_t a);
+void recorder_tick(struct tm *tick_time, TimeUnits units_changed);
+void recorder_tap(AccelAxisType axis, int32_t direction);
+void recorder_bluetooth(bool connected);
+void recorder_battery(BatteryChargeState charge);
+void recorder_message(DictionaryIterator *received);
+void recorder_dropped(AppMessageResult reason);
+void recorder_outbox(AppMessageResult result);
+void recorder_dump_request(uint32_t first);
+
+// Time digits as row-wise runs, filled a run at a time - see digits.c
+#define DIGITS_VERSION 1
+#define DIGITS_HEADER_BYTES 4
+#define DIGITS_MAX_BYTES 2560   // The ten 70x70 digits encode to 2376
+
+bool digits_load(uint32_t resource_id);
+void digits_unload();
+size_t digits_bytes();
+void digits_draw(GContext *ctx, int digit, GPoint origin, GRect clip);
+
 #endif
\ No newline at end of file
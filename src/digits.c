@@ -0,0 +1,111 @@
+#include "common.h"
+
+/*
+ * Time digits as row-wise runs of ink. A 70x70 digit is one to two solid
+ * runs a row, so the ten of them come to about 2.4 KB as runs against
+ * 8.4 KB as decoded 1 bit bitmaps. They are drawn by filling each run as a
+ * one pixel high rectangle in the context's fill colour - background
+ * untouched, since the window has already cleared it.
+ *
+ * A digit sliding in or out is drawn at its offset position and cut down
+ * to the clip run by run; nothing outside the clip is written. The runs are
+ * read into a static DIGITS_MAX_BYTES buffer once, at startup.
+ *
+ * host/encode_digits.js makes the resource from the PNGs. Little endian:
+ *
+ *   uint8  width, height, digit count, version
+ *   uint16 offset of each digit's first row, from the start
+ *   each row: uint8 run count, then per run uint8 x, uint8 length
+ */
+
+uint8_t digits_data[DIGITS_MAX_BYTES];
+size_t digits_size = 0;  // 0 until loaded
+
+static uint16_t digits_offset(int digit) {
+  const uint8_t *p = &digits_data[DIGITS_HEADER_BYTES + digit * 2];
+  return p[0] | (p[1] << 8);
+}
+
+// Walk every row of every digit once, so drawing never has to check
+static bool digits_valid() {
+  uint8_t width = digits_data[0];
+  uint8_t height = digits_data[1];
+  uint8_t count = digits_data[2];
+  if (digits_data[3] != DIGITS_VERSION || digits_size < (size_t)DIGITS_HEADER_BYTES + count * 2)
+    return false;
+
+  for (int digit = 0; digit < count; digit++) {
+    size_t pos = digits_offset(digit);
+    for (int y = 0; y < height; y++) {
+      if (pos >= digits_size)
+        return false;
+      uint8_t runs = digits_data[pos++];
+      if (pos + runs * 2 > digits_size)
+        return false;
+      for (int i = 0; i < runs; i++, pos += 2) {
+        if (digits_data[pos] + digits_data[pos + 1] > width)
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool digits_load(uint32_t resource_id) {
+  digits_unload();
+  ResHandle handle = resource_get_handle(resource_id);
+  size_t size = resource_size(handle);
+  if (size < DIGITS_HEADER_BYTES || size > DIGITS_MAX_BYTES) {
+    APP_LOG(APP_LOG_LEVEL_ERROR, "time digits resource is %u bytes", (unsigned)size);
+    return false;
+  }
+
+  digits_size = resource_load(handle, digits_data, size);
+  if (digits_size != size || !digits_valid()) {
+    APP_LOG(APP_LOG_LEVEL_ERROR, "time digits resource is damaged");
+    digits_unload();
+    return false;
+  }
+  return true;
+}
+
+void digits_unload() {
+  digits_size = 0;
+}
+
+size_t digits_bytes() {
+  return digits_size;
+}
+
+// Draws in the fill colour of ctx; origin and clip are in the layer's bounds
+void digits_draw(GContext *ctx, int digit, GPoint origin, GRect clip) {
+  if (digits_size == 0 || digit < 0 || digit >= digits_data[2])
+    return;
+
+  int clip_x0 = clip.origin.x;
+  int clip_y0 = clip.origin.y;
+  int clip_x1 = clip.origin.x + clip.size.w;
+  int clip_y1 = clip.origin.y + clip.size.h;
+
+  const uint8_t *p = &digits_data[digits_offset(digit)];
+  for (int y = origin.y; y < origin.y + digits_data[1]; y++) {
+    uint8_t runs = *p++;
+    const uint8_t *run = p;
+    p += runs * 2;
+    if (y < clip_y0)
+      continue;
+    if (y >= clip_y1)
+      break;
+
+    for (int i = 0; i < runs; i++, run += 2) {
+      int x0 = origin.x + run[0];
+      int x1 = x0 + run[1];
+      if (x0 < clip_x0)
+        x0 = clip_x0;
+      if (x1 > clip_x1)
+        x1 = clip_x1;
+      if (x0 < x1)
+        graphics_fill_rect(ctx, GRect(x0, y, x1 - x0, 1), 0, GCornerNone);
+    }
+  }
+}
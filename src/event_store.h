@@ -0,0 +1,70 @@
+#ifndef event_store_h
+#define event_store_h
+
+/*
+ * What the watchface and its background worker share. They are built as two
+ * binaries - the worker against pebble_worker.h - so this must not need
+ * anything from common.h, and both must include their SDK header first.
+ *
+ * After each sync the face writes the set it planned from to persistent
+ * storage: a header, then the events EVENT_STORE_PER_KEY to a key. The face
+ * picks it up again on launch and the worker reads it whenever the face goes.
+ */
+
+#define MAX_EVENTS 15
+
+// EventHot flags
+#define EVENT_ALL_DAY 1
+#define EVENT_ALERT_ACTIVE 2
+
+// The few fields alert planning scans, decoded from an Event when it arrives
+typedef struct {
+  uint32_t hash;
+  uint16_t day_key;
+  int16_t start_minute;
+  uint8_t flags;
+} EventHot;
+
+#define EVENT_STORE_VERSION 1
+#define EVENT_STORE_PERSIST_KEY 20   // EventStoreHeader; the events follow at 21 onwards
+#define EVENT_STORE_PER_KEY 7
+#define EVENT_STORE_KEYS ((MAX_EVENTS + EVENT_STORE_PER_KEY - 1) / EVENT_STORE_PER_KEY)
+
+typedef struct {
+  uint32_t synced;   // When the phone last sent the set
+  uint32_t digest;   // Of the events' hashes - unchanged means the keys after this one are too
+  uint8_t count;
+  uint8_t version;
+} EventStoreHeader;
+
+typedef struct {
+  EventHot hot;      // Only EVENT_ALL_DAY is kept in flags
+  char title[21];
+} StoredEvent;
+
+/*
+ * Read the store back. false if there isn't one this build understands.
+ */
+static inline bool event_store_read(EventStoreHeader *header, StoredEvent *events) {
+  if (persist_read_data(EVENT_STORE_PERSIST_KEY, header, sizeof(EventStoreHeader)) != sizeof(EventStoreHeader) ||
+      header->version != EVENT_STORE_VERSION || header->count > MAX_EVENTS)
+    return false;
+
+  for (int key = 0; key * EVENT_STORE_PER_KEY < header->count; key++) {
+    int first = key * EVENT_STORE_PER_KEY;
+    int n = header->count - first < EVENT_STORE_PER_KEY ? header->count - first : EVENT_STORE_PER_KEY;
+    if (persist_read_data(EVENT_STORE_PERSIST_KEY + 1 + key, &events[first], n * sizeof(StoredEvent)) !=
+        (int)(n * sizeof(StoredEvent)))
+      return false;
+  }
+  return true;
+}
+
+// Worker messages, face to worker
+#define WORKER_FACE_UP 1
+#define WORKER_FACE_DOWN 2   // The store is final; alerts are the worker's until the face is back
+
+// The worker brings the face back once an event is this close, so it counts down and buzzes as usual
+#define WORKER_LAUNCH_LEAD_MINUTES 1
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef layout_h
+#define layout_h
+
+#include <pebble.h>
+
+/*
+ * Screen geometry. Each display is described by the handful of numbers in
+ * its block below; LAYOUT_TABLE expands them at compile time into the const
+ * table Revolution.c draws from, so slot frames, slide offsets and widget
+ * rects are never worked out at run time. Another display size needs only
+ * another block.
+ */
+
+#if defined(PBL_PLATFORM_CHALK) || defined(PBL_PLATFORM_EMERY)
+#error "No layout for this display yet - add a description block to layout.h"
+#else
+// 144x168 rectangular (aplite, basalt, diorite)
+#define SCREEN_WIDTH        144
+#define SCREEN_HEIGHT       168
+
+#define TIME_IMAGE_WIDTH    70
+#define TIME_IMAGE_HEIGHT   70
+
+#define DATE_IMAGE_WIDTH    20
+#define DATE_IMAGE_HEIGHT   20
+
+#define SECOND_IMAGE_WIDTH  10
+#define SECOND_IMAGE_HEIGHT 10
+
+#define DAY_IMAGE_WIDTH     20
+#define DAY_IMAGE_HEIGHT    10
+
+#define MARGIN              1
+#define TIME_SLOT_SPACE     2
+#define DATE_PART_SPACE     4
+#define DATE_PART_GAP       3 // Extra pixels between the day and month digits
+
+#define SMALL_TEXT_WIDTH    140
+#define SMALL_TEXT_HEIGHT   55
+
+#define STATUS_ICON_WIDTH   38
+#define STATUS_ICON_HEIGHT  9
+#endif
+
+// Derived from the description
+#define TIME_AREA_SIZE      SCREEN_WIDTH
+#define FOOTER_HEIGHT       (SCREEN_HEIGHT - TIME_AREA_SIZE)
+#define DATE_AREA_WIDTH     (DATE_IMAGE_WIDTH + MARGIN + DATE_IMAGE_WIDTH + DATE_PART_SPACE + DATE_IMAGE_WIDTH + MARGIN + DATE_IMAGE_WIDTH)
+
+#define LAYOUT_TIME_SLOTS   4
+#define LAYOUT_DATE_SLOTS   4
+
+typedef struct {
+  GRect time_layer;
+  GRect time_slots[LAYOUT_TIME_SLOTS];
+  GRect slide_in_from[LAYOUT_TIME_SLOTS];
+  GRect slide_out_to[LAYOUT_TIME_SLOTS];
+  GRect footer_layer;
+  GRect day_layer;
+  GRect date_layer;
+  GRect date_slots[LAYOUT_DATE_SLOTS];
+  GRect seconds_layer;
+  GRect small_time;
+  GRect bt_icon;
+  GRect battery_icon;
+  GRect week_text;
+  GRect event_text;
+  GRect event_relative_text;
+  GRect event_status;
+  GRect status_icon;
+} Layout;
+
+// Digits sit in a 2x2 grid; each slides in and out along its own edge
+#define LAYOUT_SLOT_X(n)    (MARGIN + ((n) % 2) * (TIME_IMAGE_WIDTH + TIME_SLOT_SPACE))
+#define LAYOUT_SLOT_Y(n)    (MARGIN + ((n) / 2) * (TIME_IMAGE_HEIGHT + TIME_SLOT_SPACE))
+#define LAYOUT_SLOT(n, dx, dy) \
+  { { LAYOUT_SLOT_X(n) + (dx), LAYOUT_SLOT_Y(n) + (dy) }, { TIME_IMAGE_WIDTH, TIME_IMAGE_HEIGHT } }
+#define LAYOUT_RECT(x, y, w, h) { { (x), (y) }, { (w), (h) } }
+
+#define LAYOUT_STEP_X       (TIME_IMAGE_WIDTH + MARGIN)
+#define LAYOUT_STEP_Y       (TIME_IMAGE_HEIGHT + MARGIN)
+
+#define LAYOUT_DATE_SLOT(n) \
+  LAYOUT_RECT((n) * (DATE_IMAGE_WIDTH + MARGIN) + ((n) >= 2 ? DATE_PART_GAP : 0), 0, DATE_IMAGE_WIDTH, DATE_IMAGE_HEIGHT)
+
+#define LAYOUT_TABLE { \
+  .time_layer = LAYOUT_RECT(0, 0, TIME_AREA_SIZE, TIME_AREA_SIZE), \
+  .time_slots = { \
+    LAYOUT_SLOT(0, 0, 0), LAYOUT_SLOT(1, 0, 0), LAYOUT_SLOT(2, 0, 0), LAYOUT_SLOT(3, 0, 0) \
+  }, \
+  .slide_in_from = { \
+    LAYOUT_SLOT(0, -LAYOUT_STEP_X, 0), LAYOUT_SLOT(1, 0, -LAYOUT_STEP_Y), \
+    LAYOUT_SLOT(2, 0, LAYOUT_STEP_Y),  LAYOUT_SLOT(3, LAYOUT_STEP_X, 0) \
+  }, \
+  .slide_out_to = { \
+    LAYOUT_SLOT(0, 0, -LAYOUT_STEP_Y), LAYOUT_SLOT(1, LAYOUT_STEP_X, 0), \
+    LAYOUT_SLOT(2, -LAYOUT_STEP_X, 0), LAYOUT_SLOT(3, 0, LAYOUT_STEP_Y) \
+  }, \
+  .footer_layer = LAYOUT_RECT(0, TIME_AREA_SIZE, SCREEN_WIDTH, FOOTER_HEIGHT), \
+  .day_layer = LAYOUT_RECT(MARGIN, FOOTER_HEIGHT - DAY_IMAGE_HEIGHT - MARGIN, DAY_IMAGE_WIDTH, DAY_IMAGE_HEIGHT), \
+  .date_layer = LAYOUT_RECT((SCREEN_WIDTH - DATE_AREA_WIDTH) / 2, FOOTER_HEIGHT - DATE_IMAGE_HEIGHT - MARGIN, \
+                            DATE_AREA_WIDTH, DATE_IMAGE_HEIGHT), \
+  .date_slots = { LAYOUT_DATE_SLOT(0), LAYOUT_DATE_SLOT(1), LAYOUT_DATE_SLOT(2), LAYOUT_DATE_SLOT(3) }, \
+  .seconds_layer = LAYOUT_RECT(SCREEN_WIDTH - SECOND_IMAGE_WIDTH - MARGIN - SECOND_IMAGE_WIDTH - MARGIN, \
+                               FOOTER_HEIGHT - SECOND_IMAGE_HEIGHT - MARGIN, \
+                               SECOND_IMAGE_WIDTH + MARGIN + SECOND_IMAGE_WIDTH, SECOND_IMAGE_HEIGHT), \
+  .small_time = LAYOUT_RECT(2, 24, SMALL_TEXT_WIDTH, SMALL_TEXT_HEIGHT), \
+  .bt_icon = LAYOUT_RECT(2, 2, 28, 24), \
+  .battery_icon = LAYOUT_RECT(SCREEN_WIDTH - 41, 2, 41, 24), \
+  .week_text = LAYOUT_RECT(SCREEN_WIDTH / 2 - 40, SMALL_TEXT_HEIGHT + 22, 80, 30), \
+  .event_text = LAYOUT_RECT(1, SMALL_TEXT_HEIGHT + 44, SCREEN_WIDTH, 21), \
+  .event_relative_text = LAYOUT_RECT(1, SMALL_TEXT_HEIGHT + 62, SCREEN_WIDTH, 21), \
+  .event_status = LAYOUT_RECT((SCREEN_WIDTH - STATUS_ICON_WIDTH) / 2 + 1, 1, STATUS_ICON_WIDTH, STATUS_ICON_HEIGHT), \
+  .status_icon = LAYOUT_RECT(0, 0, STATUS_ICON_WIDTH, STATUS_ICON_HEIGHT), \
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include "common.h"
+
+/*
+ * Outbound message queue. One slot per kind of message, so queuing a message
+ * that is already waiting just coalesces with it. Lower kinds go first. Only
+ * one message is in flight at a time, and failures back off exponentially.
+ */
+
+typedef struct {
+  OutboxWriter writer;
+  bool pending;
+} OutboxSlot;
+
+OutboxSlot outbox_slots[OUTBOX_KINDS];
+int outbox_in_flight = -1;
+uint8_t outbox_attempts = 0;
+AppTimer *outbox_retry_timer = NULL;
+uint32_t outbox_jitter = 1;  // xorshift state, seeded at init
+
+void outbox_send_next();
+
+/*
+ * Backoff with jitter: half the delay is fixed, the other half random, so
+ * watches that lost the phone together don't all come back at once. The
+ * outbox has its own generator rather than rand(), which other code may
+ * draw from, so a replay seeded the same (see recorder.c) backs off the same.
+ */
+uint32_t outbox_backoff_ms(uint8_t attempts) {
+  uint32_t delay = OUTBOX_RETRY_BASE_MS << (attempts < OUTBOX_RETRY_MAX_SHIFT ? attempts : OUTBOX_RETRY_MAX_SHIFT);
+  if (delay > OUTBOX_RETRY_MAX_MS)
+    delay = OUTBOX_RETRY_MAX_MS;
+  outbox_jitter ^= outbox_jitter << 13;
+  outbox_jitter ^= outbox_jitter >> 17;
+  outbox_jitter ^= outbox_jitter << 5;
+  return delay / 2 + outbox_jitter % (delay / 2 + 1);
+}
+
+void handle_outbox_retry(void *data) {
+  recorder_wake();
+  outbox_retry_timer = NULL;
+  outbox_send_next();
+}
+
+void outbox_schedule_retry() {
+  if (outbox_retry_timer != NULL)
+    return;
+  outbox_retry_timer = app_timer_register(outbox_backoff_ms(outbox_attempts), handle_outbox_retry, NULL);
+  if (outbox_attempts < 255)
+    outbox_attempts++;
+}
+
+/*
+ * Send the most important pending message, unless one is already on its way
+ */
+void outbox_send_next() {
+  if (outbox_in_flight >= 0 || outbox_retry_timer != NULL)
+    return;
+
+  int kind;
+  for (kind = 0; kind < OUTBOX_KINDS; kind++) {
+    if (outbox_slots[kind].pending)
+      break;
+  }
+  if (kind == OUTBOX_KINDS)
+    return;
+
+  DictionaryIterator *iter;
+  if (app_message_outbox_begin(&iter) != APP_MSG_OK || !iter) {
+    outbox_schedule_retry();
+    return;
+  }
+
+  outbox_slots[kind].pending = false;
+  outbox_in_flight = kind;
+  outbox_slots[kind].writer(iter);
+  if (app_message_outbox_send() != APP_MSG_OK) {
+    outbox_slots[kind].pending = true;
+    outbox_in_flight = -1;
+    outbox_schedule_retry();
+  }
+}
+
+void outbox_sent_handler(DictionaryIterator *sent, void *context) {
+  recorder_outbox(APP_MSG_OK);
+  outbox_in_flight = -1;
+  outbox_attempts = 0;
+  outbox_send_next();
+}
+
+void outbox_failed_handler(DictionaryIterator *failed, AppMessageResult reason, void *context) {
+  recorder_outbox(reason);
+  trace_event(TRACE_OUTBOX_FAILED, outbox_in_flight, reason);
+  // Back into its slot - if it was queued again meanwhile the two coalesce
+  if (outbox_in_flight >= 0)
+    outbox_slots[outbox_in_flight].pending = true;
+  outbox_in_flight = -1;
+  outbox_schedule_retry();
+}
+
+/*
+ * Queue a message. The writer fills in the dictionary when it is sent.
+ */
+void outbox_queue(int kind, OutboxWriter writer) {
+  if (kind < 0 || kind >= OUTBOX_KINDS)
+    return;
+  outbox_slots[kind].writer = writer;
+  outbox_slots[kind].pending = true;
+  outbox_send_next();
+}
+
+/*
+ * Drop a queued message that is no longer wanted. One already in flight still goes.
+ */
+void outbox_cancel(int kind) {
+  if (kind < 0 || kind >= OUTBOX_KINDS)
+    return;
+  outbox_slots[kind].pending = false;
+}
+
+bool outbox_is_pending(int kind) {
+  return outbox_slots[kind].pending || outbox_in_flight == kind;
+}
+
+void outbox_init() {
+  memset(outbox_slots, 0, sizeof(outbox_slots));
+  outbox_in_flight = -1;
+  outbox_attempts = 0;
+  outbox_retry_timer = NULL;
+  outbox_jitter = time(NULL) | 1;
+  app_message_register_outbox_sent(outbox_sent_handler);
+  app_message_register_outbox_failed(outbox_failed_handler);
+}
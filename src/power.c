@@ -0,0 +1,98 @@
+#include "common.h"
+
+/*
+ * Power governor. Picks a profile from the battery level, whether it is
+ * charging and how recently the watch was tapped, and tells subscribers
+ * when that changes. Each profile says what the face may spend power on:
+ * digit slides, backlight on alerts, how often to poll the phone and how
+ * often a running countdown is redrawn.
+ *
+ * Going down a profile happens at the threshold; coming back up takes
+ * POWER_HYSTERESIS_PERCENT more, so a level sitting on a threshold doesn't
+ * flip the face back and forth. While charging it is always full. In the
+ * reduced profile a recent tap brings back full - someone is looking.
+ */
+
+const PowerProfile power_profiles[POWER_PROFILES] = {
+  [POWER_FULL]     = { .animate = true,  .backlight = true,  .poll_minutes = REQUEST_CALENDAR_INTERVAL_MINUTES, .countdown_minutes = 1 },
+  [POWER_REDUCED]  = { .animate = false, .backlight = true,  .poll_minutes = 20, .countdown_minutes = 5 },
+  [POWER_CRITICAL] = { .animate = false, .backlight = false, .poll_minutes = POWER_POLL_MINUTES_MAX, .countdown_minutes = 0 },
+};
+
+PowerHandler power_handlers[POWER_MAX_HANDLERS];
+uint8_t power_handler_count = 0;
+uint8_t power_current = POWER_FULL;
+uint8_t power_level = 100;
+bool power_charging = false;
+uint8_t power_idle_minutes = POWER_ACTIVE_MINUTES; // Since the last tap, up to POWER_ACTIVE_MINUTES
+
+int power_profile_for(int level) {
+  if (level <= POWER_CRITICAL_PERCENT)
+    return POWER_CRITICAL;
+  if (level <= POWER_REDUCED_PERCENT)
+    return POWER_REDUCED;
+  return POWER_FULL;
+}
+
+int power_choose() {
+  if (power_charging)
+    return POWER_FULL;
+
+  int profile = power_profile_for(power_level);
+  if (profile < power_current)
+    profile = power_profile_for(power_level - POWER_HYSTERESIS_PERCENT);
+  if (profile == POWER_REDUCED && power_idle_minutes < POWER_ACTIVE_MINUTES)
+    profile = POWER_FULL;
+  return profile;
+}
+
+void power_update() {
+  int profile = power_choose();
+  if (profile == power_current)
+    return;
+
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "power: profile %d -> %d at %d%%%s", power_current, profile, power_level,
+          power_charging ? ", charging" : "");
+  trace_event(TRACE_POWER, profile, power_level | power_charging << 8 | power_current << 16);
+  power_current = profile;
+  for (int i = 0; i < power_handler_count; i++)
+    power_handlers[i](&power_profiles[profile]);
+}
+
+void power_battery(BatteryChargeState charge) {
+  power_level = charge.charge_percent;
+  power_charging = charge.is_charging || charge.is_plugged;
+  power_update();
+}
+
+void power_tap() {
+  power_idle_minutes = 0;
+  power_update();
+}
+
+void power_minute_tick() {
+  if (power_idle_minutes < POWER_ACTIVE_MINUTES)
+    power_idle_minutes++;
+  power_update();
+}
+
+/*
+ * Handlers are called straight away with the current profile, then on every change
+ */
+void power_subscribe(PowerHandler handler) {
+  if (power_handler_count >= POWER_MAX_HANDLERS)
+    return;
+  power_handlers[power_handler_count++] = handler;
+  handler(&power_profiles[power_current]);
+}
+
+int power_profile() {
+  return power_current;
+}
+
+void power_init(BatteryChargeState charge) {
+  power_handler_count = 0;
+  power_current = POWER_FULL;
+  power_idle_minutes = POWER_ACTIVE_MINUTES;
+  power_battery(charge);
+}
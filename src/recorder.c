@@ -0,0 +1,252 @@
+#include "common.h"
+
+/*
+ * Input recorder, so a run on someone's wrist can be played again on the
+ * host (host/replay_capture.c). From launch, everything the face reacts to
+ * is appended to a byte ring: minute ticks, taps, Bluetooth as the firmware
+ * reports it, battery changes, messages from the phone byte for byte,
+ * dropped messages and send results. A record is its kind, the ms since the
+ * record before as a varint, then the kind's fields (common.h).
+ *
+ * A capture opens with what init() reads to start from: the clock, the time
+ * zone, battery, Bluetooth and the event store; a zone change is noted at
+ * the next tick. Timers aren't inputs - they come from the same code on
+ * replay - but each tick carries a check of them: the timer wakeups since
+ * the last tick and a digest of the decisions traced so far. A replay that
+ * writes the same bytes took the same path.
+ *
+ * recorder_total counts every byte written and byte n sits at n %
+ * RECORDER_BYTES. Like the trace log, the phone reads it from an offset with
+ * RECORDER_KEY; each reply is [capture, first, total] as uint32s, the
+ * capture being the launch time, then up to RECORDER_DUMP_BYTES. Once the
+ * phone has asked, the watch sends the next reply unasked whenever a quarter
+ * of the ring is unread, so the phone keeps up through a sync; a compact
+ * one fits the ring with room to spare. Where the ring did wrap first, the
+ * phone starts again from the oldest byte and the replay stops at the gap.
+ * Nothing is persisted - a launch is a new capture.
+ *
+ * What the ring holds unread, going by soak_heap -r and bench_protocol: a
+ * tick is 8 bytes, so about four hours of ticks alone - a phone out of
+ * reach, since then nothing else comes in. A message is its dictionary plus
+ * about 4, and a dictionary the payload plus about 18: a compact sync of 15
+ * events comes to about 470 bytes, the same sync an event a message to about
+ * 1.4 KB. Syncing every 10 minutes, the ring covers about half an hour of a
+ * phone that is there but not reading - past that, only what it read.
+ */
+
+uint8_t recorder_ring[RECORDER_BYTES];
+uint32_t recorder_total = 0;
+uint32_t recorder_capture = 0;
+int16_t recorder_zone = 0;
+bool recorder_listening = false;  // Inputs count once init() is done calling the handlers itself
+uint32_t recorder_last_ms = 0;
+uint16_t recorder_wakes = 0;
+uint32_t recorder_digest = 2166136261u;
+uint32_t recorder_dump_first = 0;  // Where the phone has read to, as it last said
+bool recorder_followed = false;     // The phone has asked since launch
+uint32_t recorder_nudged = 0;       // recorder_dump_first when the watch last sent unasked
+
+void recorder_dump(DictionaryIterator *iter);
+
+static uint32_t recorder_now_ms() {
+  time_t now;
+  uint16_t ms = time_ms(&now, NULL);
+  return (uint32_t)now * 1000 + ms;
+}
+
+static void put(uint8_t byte) {
+  recorder_ring[recorder_total++ % RECORDER_BYTES] = byte;
+}
+
+static void put_bytes(const void *data, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++)
+    put(((const uint8_t *)data)[i]);
+}
+
+static void put_varint(uint32_t value) {
+  while (value >= 0x80) {
+    put(value | 0x80);
+    value >>= 7;
+  }
+  put(value);
+}
+
+static void begin(uint8_t kind) {
+  if (recorder_followed && recorder_total - recorder_dump_first > RECORDER_BYTES / 4 &&
+      recorder_nudged != recorder_dump_first) {
+    recorder_nudged = recorder_dump_first;
+    outbox_queue(OUTBOX_RECORDER_DUMP, recorder_dump);
+  }
+
+  uint32_t now = recorder_now_ms();
+  put(kind);
+  put_varint(now - recorder_last_ms);
+  recorder_last_ms = now;
+}
+
+// Minutes east of UTC. Worked out from the date rather than with gmtime(), which may share localtime()'s buffer.
+static int16_t utc_offset(const struct tm *local, time_t now) {
+  int year = local->tm_year + 1900 - 1;
+  int64_t days = (year - 1969) * 365 + year / 4 - year / 100 + year / 400 - 477 + local->tm_yday; // Since 1970
+  int64_t diff = days * 86400 + local->tm_hour * 3600 + local->tm_min * 60 + local->tm_sec - (int64_t)now;
+  return (diff + (diff >= 0 ? 30 : -30)) / 60;
+}
+
+static uint8_t battery_flags(BatteryChargeState charge) {
+  return (charge.is_charging ? RECORD_CHARGING : 0) | (charge.is_plugged ? RECORD_PLUGGED : 0);
+}
+
+/*
+ * Start a capture with the state init() is about to read. Call before calendar_init().
+ */
+void recorder_init() {
+  recorder_total = 0;
+  recorder_listening = false;
+  recorder_wakes = 0;
+  recorder_digest = 2166136261u;
+  recorder_dump_first = 0;
+  recorder_followed = false;
+  recorder_nudged = UINT32_MAX;
+
+  time_t now;
+  uint16_t ms = time_ms(&now, NULL);
+  recorder_zone = utc_offset(localtime(&now), now);
+  BatteryChargeState charge = battery_state_service_peek();
+  uint8_t flags = battery_flags(charge) | (bluetooth_connection_service_peek() ? RECORD_CONNECTED : 0) |
+                  (clock_is_24h_style() ? RECORD_24H : 0);
+  recorder_capture = now;
+  recorder_last_ms = (uint32_t)now * 1000 + ms;
+  begin(RECORD_START);
+  put(RECORDER_VERSION);
+  put_bytes(&recorder_capture, sizeof(uint32_t));
+  put_bytes(&ms, sizeof(uint16_t));
+  put_bytes(&recorder_zone, sizeof(int16_t));
+  put(charge.charge_percent);
+  put(flags);
+
+  for (uint32_t key = EVENT_STORE_PERSIST_KEY; key <= EVENT_STORE_PERSIST_KEY + EVENT_STORE_KEYS; key++) {
+    uint8_t data[PERSIST_DATA_MAX_LENGTH];
+    int length = persist_read_data(key, data, sizeof(data));
+    if (length <= 0)
+      continue;
+    put(RECORD_PERSIST);
+    put_varint(0); // As of the start, however long reading it took
+    put(key);
+    put_varint(length);
+    put_bytes(data, length);
+  }
+}
+
+void recorder_start() {
+  recorder_listening = true;
+}
+
+// A timer callback ran
+void recorder_wake() {
+  recorder_wakes++;
+}
+
+// Called by trace_event(). b is left out: it is mostly times, which a replay gets to the ms but not the clock.
+void recorder_note(uint8_t id, uint8_t a) {
+  recorder_digest = (recorder_digest ^ id) * 16777619u;
+  recorder_digest = (recorder_digest ^ a) * 16777619u;
+}
+
+/*
+ * Inputs, each called first thing in its handler
+ */
+void recorder_tick(struct tm *tick_time, TimeUnits units_changed) {
+  if (!recorder_listening)
+    return;
+  int16_t zone = utc_offset(tick_time, time(NULL));
+  if (zone != recorder_zone) {
+    recorder_zone = zone;
+    begin(RECORD_ZONE);
+    put_bytes(&recorder_zone, sizeof(int16_t));
+  }
+  uint16_t digest = recorder_digest;
+  begin(RECORD_TICK);
+  put(units_changed);
+  put_varint(recorder_wakes);
+  put_bytes(&digest, sizeof(uint16_t));
+  recorder_wakes = 0;
+}
+
+void recorder_tap(AccelAxisType axis, int32_t direction) {
+  if (!recorder_listening)
+    return;
+  begin(RECORD_TAP);
+  put(axis);
+  put(direction);
+}
+
+void recorder_bluetooth(bool connected) {
+  if (!recorder_listening)
+    return;
+  begin(RECORD_BLUETOOTH);
+  put(connected);
+}
+
+void recorder_battery(BatteryChargeState charge) {
+  if (!recorder_listening)
+    return;
+  begin(RECORD_BATTERY);
+  put(charge.charge_percent);
+  put(battery_flags(charge));
+}
+
+void recorder_message(DictionaryIterator *received) {
+  if (!recorder_listening)
+    return;
+  uint32_t length = (const uint8_t *)received->end - (const uint8_t *)received->dictionary;
+  begin(RECORD_MESSAGE);
+  put_varint(length);
+  put_bytes(received->dictionary, length);
+}
+
+void recorder_dropped(AppMessageResult reason) {
+  if (!recorder_listening)
+    return;
+  begin(RECORD_DROPPED);
+  put_varint(reason);
+}
+
+void recorder_outbox(AppMessageResult result) {
+  if (!recorder_listening)
+    return;
+  if (result == APP_MSG_OK) {
+    begin(RECORD_SENT);
+  } else {
+    begin(RECORD_FAILED);
+    put_varint(result);
+  }
+}
+
+/*
+ * Dump replies - written by the outbox when it is this message's turn
+ */
+void recorder_dump(DictionaryIterator *iter) {
+  uint8_t buffer[3 * sizeof(uint32_t) + RECORDER_DUMP_BYTES];
+  uint32_t oldest = recorder_total > RECORDER_BYTES ? recorder_total - RECORDER_BYTES : 0;
+  uint32_t first = recorder_dump_first;
+  if (first < oldest || first > recorder_total)
+    first = oldest; // Overwritten meanwhile, or from an earlier capture - start again from the oldest
+
+  uint32_t bytes = recorder_total - first;
+  if (bytes > RECORDER_DUMP_BYTES)
+    bytes = RECORDER_DUMP_BYTES;
+
+  memcpy(&buffer[0], &recorder_capture, sizeof(uint32_t));
+  memcpy(&buffer[sizeof(uint32_t)], &first, sizeof(uint32_t));
+  memcpy(&buffer[2 * sizeof(uint32_t)], &recorder_total, sizeof(uint32_t));
+  for (uint32_t i = 0; i < bytes; i++)
+    buffer[3 * sizeof(uint32_t) + i] = recorder_ring[(first + i) % RECORDER_BYTES];
+
+  dict_write_data(iter, RECORDER_KEY, buffer, 3 * sizeof(uint32_t) + bytes);
+}
+
+void recorder_dump_request(uint32_t first) {
+  recorder_dump_first = first;
+  recorder_followed = true;
+  outbox_queue(OUTBOX_RECORDER_DUMP, recorder_dump);
+}
@@ -0,0 +1,106 @@
+#include "common.h"
+
+/*
+ * Trace log for working out what happened after the fact - a missed alert,
+ * a sync that never landed. trace_event() fills the next slot of a fixed
+ * ring of 12 byte records; nothing else happens on the hot path. Every
+ * TRACE_FLUSH_INTERVAL_MINUTES at most, the chunks that changed are copied to
+ * persistent storage, so the log survives the watchface being closed.
+ *
+ * trace_seq counts every record ever written and record s sits in slot
+ * s % TRACE_CAPACITY, so the newest TRACE_CAPACITY are always there.
+ *
+ * The phone reads it by sending TRACE_DUMP_KEY with the first sequence number
+ * it wants. Each reply is [first, trace_seq] as two uint32s followed by up to
+ * TRACE_CHUNK_RECORDS records; the phone asks again from where that left off
+ * until it reaches trace_seq. host/trace_decode.js prints the timeline.
+ */
+
+TraceRecord trace_ring[TRACE_CAPACITY];
+uint32_t trace_seq = 0;
+uint8_t trace_dirty = 0; // One bit per chunk changed since the last flush
+uint8_t trace_ticks = 0;
+uint32_t trace_dump_first = 0;
+
+void trace_event(uint8_t id, uint8_t a, int32_t b) {
+  uint32_t slot = trace_seq % TRACE_CAPACITY;
+  TraceRecord *record = &trace_ring[slot];
+  time_t now;
+  record->ms = time_ms(&now, NULL);
+  record->time = now;
+  record->id = id;
+  record->a = a;
+  record->b = b;
+  trace_seq++;
+
+  trace_dirty |= 1 << (slot / TRACE_CHUNK_RECORDS);
+  recorder_note(id, a);
+}
+
+/*
+ * Write out whatever changed. Also called on the way out.
+ */
+void trace_flush() {
+  trace_ticks = 0;
+  if (!trace_dirty)
+    return;
+
+  for (int chunk = 0; chunk < TRACE_CHUNKS; chunk++) {
+    if (trace_dirty & (1 << chunk))
+      persist_write_data(TRACE_PERSIST_KEY + 1 + chunk, &trace_ring[chunk * TRACE_CHUNK_RECORDS],
+                         TRACE_CHUNK_RECORDS * sizeof(TraceRecord));
+  }
+  persist_write_int(TRACE_PERSIST_KEY, trace_seq);
+  trace_dirty = 0;
+}
+
+void trace_minute_tick() {
+  if (++trace_ticks >= TRACE_FLUSH_INTERVAL_MINUTES)
+    trace_flush();
+}
+
+/*
+ * Pick up the log from the last run
+ */
+void trace_init() {
+  memset(trace_ring, 0, sizeof(trace_ring));
+  trace_seq = 0;
+  trace_dirty = 0;
+  trace_ticks = 0;
+
+  if (persist_exists(TRACE_PERSIST_KEY)) {
+    trace_seq = persist_read_int(TRACE_PERSIST_KEY);
+    for (int chunk = 0; chunk < TRACE_CHUNKS; chunk++)
+      persist_read_data(TRACE_PERSIST_KEY + 1 + chunk, &trace_ring[chunk * TRACE_CHUNK_RECORDS],
+                        TRACE_CHUNK_RECORDS * sizeof(TraceRecord));
+  }
+  trace_event(TRACE_BOOT, 0, trace_seq);
+}
+
+/*
+ * Dump replies - written by the outbox when it is this message's turn
+ */
+void trace_dump(DictionaryIterator *iter) {
+  uint8_t buffer[2 * sizeof(uint32_t) + TRACE_CHUNK_RECORDS * sizeof(TraceRecord)];
+  uint32_t oldest = trace_seq > TRACE_CAPACITY ? trace_seq - TRACE_CAPACITY : 0;
+  uint32_t first = trace_dump_first;
+  if (first < oldest || first > trace_seq)
+    first = oldest; // Overwritten meanwhile, or from an earlier log - start again from the oldest
+
+  uint32_t records = trace_seq - first;
+  if (records > TRACE_CHUNK_RECORDS)
+    records = TRACE_CHUNK_RECORDS;
+
+  memcpy(&buffer[0], &first, sizeof(uint32_t));
+  memcpy(&buffer[sizeof(uint32_t)], &trace_seq, sizeof(uint32_t));
+  for (uint32_t i = 0; i < records; i++)
+    memcpy(&buffer[2 * sizeof(uint32_t) + i * sizeof(TraceRecord)],
+           &trace_ring[(first + i) % TRACE_CAPACITY], sizeof(TraceRecord));
+
+  dict_write_data(iter, TRACE_DUMP_KEY, buffer, 2 * sizeof(uint32_t) + records * sizeof(TraceRecord));
+}
+
+void trace_dump_request(uint32_t first) {
+  trace_dump_first = first;
+  outbox_queue(OUTBOX_TRACE_DUMP, trace_dump);
+}
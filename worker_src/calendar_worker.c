@@ -0,0 +1,120 @@
+#include <pebble_worker.h>
+#include "../src/event_store.h"
+
+/*
+ * Background worker - keeps calendar alerts going while another app is in
+ * front. A worker can't reach the phone, draw or buzz, so this one only
+ * watches the clock against the event store the face left behind and
+ * brings the face back within WORKER_LAUNCH_LEAD_MINUTES of an event's start.
+ * The face plans from the store as it launches, then counts down and buzzes
+ * as usual. Syncing stays with the face, which is the only side with
+ * AppMessage; the store is as fresh as its last sync.
+ */
+
+#define MINUTES_PER_DAY (24 * 60)
+
+static EventStoreHeader header;
+static StoredEvent events[MAX_EVENTS];
+
+// Assume not, so a worker restarted with the watch still raises alerts.
+// Bringing forward a face that is already there costs a redraw at worst.
+static bool face_up = false;
+
+// Events the face was brought back for, or was up for anyway, so each gets one launch
+typedef struct {
+  uint32_t hash;
+  uint16_t day_key;
+  int16_t start_minute;
+} Launched;
+
+static Launched launched[MAX_EVENTS];
+static int launched_next = 0;
+
+static void load_store(void) {
+  if (!event_store_read(&header, events))
+    header.count = 0;
+}
+
+static bool was_launched(const EventHot *hot) {
+  for (int i = 0; i < MAX_EVENTS; i++) {
+    if (launched[i].hash == hot->hash && launched[i].day_key == hot->day_key &&
+        launched[i].start_minute == hot->start_minute)
+      return true;
+  }
+  return false;
+}
+
+static void mark_launched(const EventHot *hot) {
+  launched[launched_next] = (Launched){ hot->hash, hot->day_key, hot->start_minute };
+  launched_next = (launched_next + 1) % MAX_EVENTS;
+}
+
+// Same day key the face plans with
+static uint16_t day_key_of(const struct tm *t) {
+  return (t->tm_mon + 1) * 32 + t->tm_mday;
+}
+
+/*
+ * Launch for any event starting within WORKER_LAUNCH_LEAD_MINUTES that
+ * hasn't had its launch, rather than only at the exact minute before - a
+ * tick that comes late or not at all would lose the alert. An event just
+ * after midnight is filed under tomorrow's day key, so it counts from the
+ * end of today.
+ */
+static void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed) {
+  uint16_t today = day_key_of(tick_time);
+  int16_t now_minute = tick_time->tm_hour * 60 + tick_time->tm_min;
+  // Around noon tomorrow, whatever a DST change does to the day's length. After tick_time is read,
+  // since localtime() may hand back the same buffer.
+  time_t noon_tomorrow = time(NULL) + (MINUTES_PER_DAY - now_minute + 12 * 60) * 60;
+  uint16_t tomorrow = day_key_of(localtime(&noon_tomorrow));
+
+  bool launch = false;
+  for (int i = 0; i < header.count; i++) {
+    EventHot *hot = &events[i].hot;
+    if (hot->flags & EVENT_ALL_DAY)
+      continue;
+
+    int minutes;
+    if (hot->day_key == today)
+      minutes = hot->start_minute - now_minute;
+    else if (hot->day_key == tomorrow)
+      minutes = hot->start_minute + MINUTES_PER_DAY - now_minute;
+    else
+      continue;
+    if (minutes < 0 || minutes > WORKER_LAUNCH_LEAD_MINUTES || was_launched(hot))
+      continue;
+    mark_launched(hot);
+    launch = true;
+  }
+
+  if (launch && !face_up)
+    worker_launch_app();
+}
+
+static void handle_face_message(uint16_t type, AppWorkerMessage *data) {
+  if (type == WORKER_FACE_UP) {
+    face_up = true;
+  } else if (type == WORKER_FACE_DOWN) {
+    face_up = false;
+    load_store();
+  }
+}
+
+static void init(void) {
+  load_store();
+  app_worker_message_subscribe(handle_face_message);
+  tick_timer_service_subscribe(MINUTE_UNIT, handle_minute_tick);
+}
+
+static void deinit(void) {
+  tick_timer_service_unsubscribe();
+  app_worker_message_unsubscribe();
+}
+
+int main(void) {
+  init();
+  worker_event_loop();
+  deinit();
+  return 0;
+}